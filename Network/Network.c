@@ -3,19 +3,43 @@
 #include "stdbool.h"
 #include "Network.h"
 #include "nrf24.h"
+#include "hpTimer.h"
 #include "debug_log.h"
+#if !defined(NRF24_HOST_SIM)
 #include "boards.h"
-
-uint16_t mask_check = 0xFFFF;
-uint16_t node_mask;
+#include "nrf.h"
+#endif
+
+#define NW_HOP_TIME_US 1000 // Time a relay needs to pass a fragment on and return to RX
+#define NW_BACKOFF_US 500	// Random delay added to every retransmission, so that a relay and its sender fall out of step
+
+#if defined(NRF24_HOST_SIM)
+// the thread of a simulated node only runs between its interrupts
+#define NW_CRITICAL_ENTER() uint32_t primask = 0
+#define NW_CRITICAL_EXIT() (void)primask
+#else
+// nw_send() runs in thread context while the radio and timer interrupts send ACKs and forward packets
+#define NW_CRITICAL_ENTER()            \
+	uint32_t primask = __get_PRIMASK(); \
+	__disable_irq()
+#define NW_CRITICAL_EXIT() __set_PRIMASK(primask)
+#endif
+
+NRF24_STATE uint16_t mask_check = 0xFFFF;
+NRF24_STATE uint16_t node_mask;
 
 const uint8_t address_pool[7] = {0xc3, 0x3c, 0x33, 0xce, 0x3e, 0xe3, 0xec};
 
-uint8_t node_physical_address[5] = {0xCC, 0xCC, 0xCC, 0xCC, 0xCC};
+NRF24_STATE uint8_t node_physical_address[5] = {0xCC, 0xCC, 0xCC, 0xCC, 0xCC};
+
+NRF24_STATE bool nw_available = false;
+
+NRF24_STATE network_instance_t instance;
 
-bool nw_available = false;
+// Starts a message given to nw_send() from interrupt context and delays the fragments of a multi-hop route
+NRF24_STATE HP_TIMER_DEF(fragment_timer);
 
-network_instance_t instance;
+static const nrf24_tx_policy_t nw_tx_policy = {.retransmit_delay_us = 0, .max_retries = 15, .backoff_us = NW_BACKOFF_US};
 
 static void physical_address(uint16_t node, uint8_t *result)
 {
@@ -54,24 +78,57 @@ static uint16_t parent_node()
 	return ((node_mask >> 3) & instance.node_address);
 }
 
-void nw_send(uint16_t dest_node, uint8_t *message, uint8_t length, nw_msg_type_t nw_msg_type)
+/*Function to get the depth of a node in the tree, the number of octal digits of its address.
+ */
+static uint8_t node_depth(uint16_t node)
 {
+	uint8_t depth = 0;
 
-	uint8_t next_hop_physical_address[5] = {0xCC, 0xCC, 0xCC, 0xCC, 0xCC};
-	uint16_t next_hop;
+	while (node)
+	{
+		depth++;
+		node >>= 3;
+	}
 
-	memset(&instance.tx_packet, 0, sizeof(instance.tx_packet));
+	return depth;
+}
 
-	// Set packet header and payload
-	instance.tx_packet.header.from_node = instance.node_address;
-	instance.tx_packet.header.to_node = dest_node;
-	instance.tx_packet.header.msg_type = nw_msg_type;
-	instance.tx_packet.length = length;
-	memcpy(instance.tx_packet.payload, message, length);
+/*Function to get the number of hops from this node to node, up the tree to their common parent and down again.
+ */
+static uint8_t route_hops(uint16_t node)
+{
+	uint16_t from = instance.node_address;
+	uint8_t from_depth = node_depth(from);
+	uint8_t to_depth = node_depth(node);
+	uint8_t hops = 0;
+
+	while (from != node)
+	{
+		// the deeper node moves to its parent by clearing its highest digit
+		if (from_depth >= to_depth)
+		{
+			from &= ~(7 << (3 * --from_depth));
+		}
+		else
+		{
+			node &= ~(7 << (3 * --to_depth));
+		}
+		hops++;
+	}
 
-	if (is_descendent(dest_node))
+	return hops;
+}
+
+/* Function to send a packet to the next hop towards its destination.
+ */
+static void nw_send_packet(network_packet_t *packet)
+{
+	uint8_t next_hop_physical_address[5] = {0xCC, 0xCC, 0xCC, 0xCC, 0xCC};
+	uint16_t next_hop;
+
+	if (is_descendent(packet->header.to_node))
 	{
-		next_hop = next_hop_node(dest_node);
+		next_hop = next_hop_node(packet->header.to_node);
 	}
 	else
 	{
@@ -86,7 +143,240 @@ void nw_send(uint16_t dest_node, uint8_t *message, uint8_t length, nw_msg_type_t
 
 	nrf24_set_tx_address(next_hop_physical_address);
 	nrf24_set_mode(NRF24_MODE_TX);
-	nrf24_send((uint8_t *)&instance.tx_packet, sizeof(instance.tx_packet));
+	nrf24_send((uint8_t *)packet, sizeof(*packet));
+}
+
+/*Function to send the fragment tx_frag_index of the message in tx_message.
+ */
+static void nw_send_fragment()
+{
+	uint16_t offset = instance.tx_frag_index * NW_FRAGMENT_PAYLOAD_SIZE;
+	uint16_t length = instance.tx_length - offset;
+
+	if (length > NW_FRAGMENT_PAYLOAD_SIZE)
+		length = NW_FRAGMENT_PAYLOAD_SIZE;
+
+	memset(&instance.tx_packet, 0, sizeof(instance.tx_packet));
+
+	// Set packet header and payload
+	instance.tx_packet.header.from_node = instance.node_address;
+	instance.tx_packet.header.to_node = instance.tx_dest_node;
+	instance.tx_packet.header.msg_type = instance.tx_msg_type;
+	instance.tx_packet.header.msg_id = instance.tx_msg_id;
+	instance.tx_packet.header.frag_index = instance.tx_frag_index;
+	instance.tx_packet.header.frag_count = instance.tx_frag_count;
+	instance.tx_packet.length = length;
+	memcpy(instance.tx_packet.payload, &instance.tx_message[offset], length);
+
+	nw_send_packet(&instance.tx_packet);
+}
+
+/*Function to start sending the pending message with its first fragment.
+ */
+static void nw_start_message()
+{
+	instance.msg_pending = false;
+	instance.tx_state = NW_TX_MESSAGE;
+	nw_send_fragment();
+}
+
+/* Function to send a message. The message is copied and sent one fragment at a time,
+ * each fragment is sent when the previous one has been acknowledged by the next hop.
+ * The packets of a node are only sent from interrupt context, so the message is started by fragment_timer
+ * or, if an ACK or a forwarded packet is being sent, when that is done.
+ */
+bool nw_send(uint16_t dest_node, uint8_t *message, uint16_t length, nw_msg_type_t nw_msg_type)
+{
+	if (length > NW_MAX_MESSAGE_SIZE)
+	{
+		debug_log_print("Message too long: %d bytes", length);
+		return false;
+	}
+
+	NW_CRITICAL_ENTER();
+
+	if (instance.tx_state == NW_TX_MESSAGE || instance.tx_state == NW_TX_WAIT || instance.msg_pending)
+	{
+		NW_CRITICAL_EXIT();
+		debug_log_print("Previous message is still being sent");
+		return false;
+	}
+
+	memcpy(instance.tx_message, message, length);
+	instance.tx_length = length;
+	instance.tx_frag_index = 0;
+	instance.tx_frag_count = length ? (length + NW_FRAGMENT_PAYLOAD_SIZE - 1) / NW_FRAGMENT_PAYLOAD_SIZE : 1;
+	instance.tx_msg_id++;
+	instance.tx_dest_node = dest_node;
+	instance.tx_msg_type = nw_msg_type;
+	instance.tx_hops = route_hops(dest_node);
+	instance.msg_pending = true;
+
+	if (instance.tx_state == NW_TX_IDLE)
+		hpTimer_start(&fragment_timer, 0);
+
+	NW_CRITICAL_EXIT();
+
+	return true;
+}
+
+/* Timeout handler of fragment_timer. Sends the fragment which waited for the previous one to cross the relays,
+ * or starts the message given to nw_send() if nothing is being sent.
+ */
+static void fragment_timer_handler(void *context)
+{
+	if (instance.tx_state == NW_TX_WAIT)
+	{
+		instance.tx_state = NW_TX_MESSAGE;
+		nw_send_fragment();
+	}
+	else if (instance.tx_state == NW_TX_IDLE && instance.msg_pending)
+	{
+		nw_start_message();
+	}
+}
+
+/* Function to acknowledge the received message in rx_packet to its source node.
+ */
+static void nw_send_ack()
+{
+	// only a node in RX receives, so nothing is being sent
+	if (instance.tx_state != NW_TX_IDLE)
+	{
+		debug_log_print("Busy, ACK to node:-> 0%o dropped", instance.rx_packet.header.from_node);
+		return;
+	}
+
+	memset(&instance.tx_packet, 0, sizeof(instance.tx_packet));
+	instance.tx_packet.header.from_node = instance.node_address;
+	instance.tx_packet.header.to_node = instance.rx_packet.header.from_node;
+	instance.tx_packet.header.msg_type = NW_MSG_ACK;
+	instance.tx_packet.header.msg_id = instance.rx_packet.header.msg_id;
+	instance.tx_packet.header.frag_count = 1;
+
+	instance.tx_state = NW_TX_ACK;
+	nw_send_packet(&instance.tx_packet);
+}
+
+/* Function to send the next fragment of the message being sent.
+ * On a route over relays the next hop is busy passing the previous fragment on, so the fragment is
+ * delayed by the time the relays need. Otherwise the sender and the relay retransmit in lock-step.
+ * Returns false if the message is complete.
+ */
+static bool nw_send_next_fragment()
+{
+	if (instance.tx_frag_index + 1 >= instance.tx_frag_count)
+		return false;
+
+	instance.tx_frag_index++;
+
+	if (instance.tx_hops > 1)
+	{
+		instance.tx_state = NW_TX_WAIT;
+		hpTimer_start(&fragment_timer, (instance.tx_hops - 1) * NW_HOP_TIME_US);
+	}
+	else
+	{
+		nw_send_fragment();
+	}
+
+	return true;
+}
+
+/* Function to end the message, ACK or forwarded packet being sent.
+ * A pending message is started, otherwise the node returns to RX. The outcome of a message is reported to the application.
+ */
+static void nw_tx_done(bool sent)
+{
+	nw_tx_state_t done = instance.tx_state;
+
+	instance.tx_state = NW_TX_IDLE;
+
+	if (instance.msg_pending)
+	{
+		nw_start_message();
+		return;
+	}
+
+	// Tx completed, now switch to rx mode;
+	nrf24_set_mode(NRF24_MODE_RX);
+
+	if (done == NW_TX_MESSAGE && instance.nw_tx_evt_handler != NULL)
+		instance.nw_tx_evt_handler(instance.tx_dest_node, sent);
+}
+
+/* Function to add a received fragment to the reassembly buffer of its message.
+ * A node sends one message at a time, so the buffer of a node is restarted when a fragment of a new message arrives.
+ * If all buffers are taken, the least recently used one is given up.
+ * Returns the buffer once all fragments have been received, NULL otherwise.
+ */
+static nw_reassembly_t *nw_reassemble(const network_packet_t *packet)
+{
+	const network_header_t *header = &packet->header;
+	nw_reassembly_t *buffer = NULL;
+
+	// only the last fragment may be shorter than NW_FRAGMENT_PAYLOAD_SIZE
+	if (header->frag_count > NW_MAX_FRAGMENTS || header->frag_index >= header->frag_count ||
+		packet->length > NW_FRAGMENT_PAYLOAD_SIZE ||
+		(header->frag_index + 1 < header->frag_count && packet->length != NW_FRAGMENT_PAYLOAD_SIZE))
+	{
+		debug_log_print("Invalid fragment from node:-> 0%o", header->from_node);
+		return NULL;
+	}
+
+	for (uint8_t i = 0; i < NW_REASSEMBLY_BUFFERS; i++)
+	{
+		if (instance.reassembly[i].in_use && instance.reassembly[i].from_node == header->from_node)
+		{
+			buffer = &instance.reassembly[i];
+			break;
+		}
+	}
+
+	if (buffer == NULL)
+	{
+		buffer = &instance.reassembly[0];
+
+		for (uint8_t i = 0; i < NW_REASSEMBLY_BUFFERS; i++)
+		{
+			nw_reassembly_t *candidate = &instance.reassembly[i];
+
+			if (!candidate->in_use)
+			{
+				buffer = candidate;
+				break;
+			}
+
+			if (instance.reassembly_clock - candidate->last_used > instance.reassembly_clock - buffer->last_used)
+				buffer = candidate;
+		}
+	}
+
+	if (!buffer->in_use || buffer->from_node != header->from_node ||
+		buffer->msg_id != header->msg_id || buffer->frag_count != header->frag_count)
+	{
+		if (buffer->in_use)
+			debug_log_print("Incomplete message from node:-> 0%o dropped", buffer->from_node);
+
+		buffer->in_use = true;
+		buffer->from_node = header->from_node;
+		buffer->msg_id = header->msg_id;
+		buffer->frag_count = header->frag_count;
+		buffer->received = 0;
+		buffer->length = 0;
+	}
+
+	buffer->last_used = ++instance.reassembly_clock;
+	memcpy(&buffer->data[header->frag_index * NW_FRAGMENT_PAYLOAD_SIZE], packet->payload, packet->length);
+	buffer->received |= 1UL << header->frag_index;
+
+	if (header->frag_index + 1 == header->frag_count)
+		buffer->length = header->frag_index * NW_FRAGMENT_PAYLOAD_SIZE + packet->length;
+
+	if (buffer->received != (0xFFFFFFFFUL >> (32 - buffer->frag_count)))
+		return NULL;
+
+	return buffer;
 }
 
 void nw_update()
@@ -97,12 +387,35 @@ void nw_update()
 
 		if (instance.rx_packet.header.msg_type == NW_MSG_DATA)
 		{
+			uint8_t *message = instance.rx_packet.payload;
+			uint16_t length = instance.rx_packet.length;
+			nw_reassembly_t *buffer = NULL;
+
+			if (instance.rx_packet.header.frag_count > 1)
+			{
+				buffer = nw_reassemble(&instance.rx_packet);
+
+				// wait for the other fragments
+				if (buffer == NULL)
+					return;
+
+				message = buffer->data;
+				length = buffer->length;
+			}
+			else if (length > NW_FRAGMENT_PAYLOAD_SIZE)
+			{
+				length = NW_FRAGMENT_PAYLOAD_SIZE;
+			}
+
 			debug_log_print("Incoming message from node:-> 0%o",
 							instance.rx_packet.header.from_node);
-			instance.nw_evt_handler(instance.rx_packet.payload,
-									instance.rx_packet.length);
-			char ack_msg[26] = "";
-			nw_send(instance.rx_packet.header.from_node, (uint8_t *)ack_msg, 0, NW_MSG_ACK); // Send ACK message;
+
+			// the ACK goes first, the source is listening for it while a reply of the handler would wait
+			nw_send_ack();
+			instance.nw_evt_handler(message, length);
+
+			if (buffer != NULL)
+				buffer->in_use = false;
 		}
 		else if (instance.rx_packet.header.msg_type == NW_MSG_ACK)
 		{
@@ -114,35 +427,19 @@ void nw_update()
 	{
 
 		debug_log_print("Forwarding Message arrived!");
-		uint16_t next_hop;
-		uint8_t next_hop_physical_address[5] = {0xCC, 0xCC, 0xCC, 0xCC, 0xCC};
-
-		memset(&instance.tx_packet, 0, sizeof(instance.tx_packet));
-		instance.tx_packet = instance.rx_packet;
 
-		if (is_descendent(instance.tx_packet.header.to_node))
-		{
-			debug_log_print("Descendent");
-			next_hop = next_hop_node(instance.tx_packet.header.to_node);
-		}
-		else
+		// only a node in RX receives, so nothing is being sent
+		if (instance.tx_state != NW_TX_IDLE)
 		{
-			debug_log_print("Not a Descendent");
-			next_hop = parent_node();
+			debug_log_print("Busy, packet for node:-> 0%o dropped", instance.rx_packet.header.to_node);
+			return;
 		}
 
-		physical_address(next_hop, next_hop_physical_address);
-		debug_log_print("Next hop= 0%o", next_hop);
-		debug_log_print("TX address= %X:%X:%X:%X:%X",
-						next_hop_physical_address[0], next_hop_physical_address[1],
-						next_hop_physical_address[2], next_hop_physical_address[3],
-						next_hop_physical_address[4]);
-		nrf24_set_tx_address(next_hop_physical_address);
-
-		nrf24_set_mode(NRF24_MODE_TX);
+		memset(&instance.tx_packet, 0, sizeof(instance.tx_packet));
+		instance.tx_packet = instance.rx_packet;
 
-		nrf24_send((uint8_t *)&instance.tx_packet,
-				   sizeof(instance.tx_packet) - 4);
+		instance.tx_state = NW_TX_FORWARD;
+		nw_send_packet(&instance.tx_packet);
 	}
 }
 
@@ -161,13 +458,17 @@ void nrf24_nw_evt_handler(nrf24_event_t *evt)
 		break;
 	case NRF24_TX_SUCCESS:
 		debug_log_print("TX SUCCESS!");
-		// Tx completed, now switch to rx mode;
-		nrf24_set_mode(NRF24_MODE_RX);
+		// send the next fragment of the message
+		if (instance.tx_state == NW_TX_MESSAGE && nw_send_next_fragment())
+			break;
+
+		nw_tx_done(true);
 
 		break;
 	case NRF24_TX_FAILED:
 		debug_log_print("TX FAILED!");
-		nrf24_set_mode(NRF24_MODE_RX);
+		// the rest of the message is given up, the destination drops its incomplete message
+		nw_tx_done(false);
 		break;
 	case NRF24_INVALID_OPERATION:
 		debug_log_print("INVALID OPERATION!");
@@ -177,6 +478,11 @@ void nrf24_nw_evt_handler(nrf24_event_t *evt)
 	}
 }
 
+void nw_set_tx_evt_handler(nw_tx_evt_handler_t evt_handler)
+{
+	instance.nw_tx_evt_handler = evt_handler;
+}
+
 void network_init(uint16_t node_address, nw_evt_handler_t evt_handler)
 {
 
@@ -185,6 +491,8 @@ void network_init(uint16_t node_address, nw_evt_handler_t evt_handler)
 	setup_address();
 	nrf24_init();
 	nrf24_set_evt_handler(nrf24_nw_evt_handler);
+	nrf24_set_tx_policy(&nw_tx_policy);
+	hpTimer_create(&fragment_timer, fragment_timer_handler, HP_TIMER_MODE_SINGLE_SHOT, NULL);
 	nrf24_set_rx_address(node_physical_address, 1);
 	debug_log_print("RX address= %X:%X:%X:%X:%X", node_physical_address[0],
 					node_physical_address[1], node_physical_address[2],
@@ -1,36 +1,90 @@
 #ifndef _NETWORK_H_
 #define _NETWORK_H_
 
-typedef void(*nw_evt_handler_t)(uint8_t* data, uint8_t length);
+#define NW_FRAGMENT_PAYLOAD_SIZE 23 // Message bytes per packet, the rest of the 32 byte nrf24 payload is the header and the length
+#define NW_MAX_FRAGMENTS 16			// Maximum number of packets of a message, up to 32
+#define NW_MAX_MESSAGE_SIZE (NW_FRAGMENT_PAYLOAD_SIZE * NW_MAX_FRAGMENTS)
+#define NW_REASSEMBLY_BUFFERS 2		// Messages from different nodes reassembled at the same time
+
+#if NW_MAX_FRAGMENTS > 32
+#error "NW_MAX_FRAGMENTS must be up to 32"
+#endif
+
+typedef void(*nw_evt_handler_t)(uint8_t* data, uint16_t length);
+// Called when a message given to nw_send() is done: sent is true if all its fragments were acknowledged by the next hop
+typedef void(*nw_tx_evt_handler_t)(uint16_t dest_node, bool sent);
 
 typedef enum{
 	NW_MSG_DATA, NW_MSG_ACK, NW_MSG_PING, NW_MSG_PING_ACK
 }nw_msg_type_t;
 
+typedef enum{
+	NW_TX_IDLE, NW_TX_MESSAGE, NW_TX_WAIT, NW_TX_ACK, NW_TX_FORWARD // NW_TX_WAIT: the next fragment waits for the relays
+}nw_tx_state_t;
+
 typedef struct {
 	uint16_t to_node;
 	uint16_t from_node;
-	nw_msg_type_t msg_type;
+	uint8_t msg_type;	// nw_msg_type_t
+	uint8_t msg_id;		// Message number of the source node, the same in all fragments of a message
+	uint8_t frag_index; // Position of the fragment in the message
+	uint8_t frag_count; // Number of fragments of the message, 1 if it is not fragmented
 
 } network_header_t;
 
 typedef struct {
 	network_header_t header;
 	uint8_t length;
-	uint8_t payload[26];
+	uint8_t payload[NW_FRAGMENT_PAYLOAD_SIZE];
 } network_packet_t;
 
+/* Buffer collecting the fragments of a message at its destination.
+ * received has one bit per fragment, the message is complete when all frag_count bits are set.
+ */
+typedef struct {
+	bool in_use;
+	uint16_t from_node;
+	uint8_t msg_id;
+	uint8_t frag_count;
+	uint32_t received;
+	uint16_t length;
+	uint32_t last_used; // Reassembly clock at the last fragment, the least recently used buffer is reused when all are taken
+	uint8_t data[NW_MAX_MESSAGE_SIZE];
+} nw_reassembly_t;
+
 typedef struct {
 	uint16_t node_address;
 	nw_evt_handler_t nw_evt_handler;
+	nw_tx_evt_handler_t nw_tx_evt_handler;
 	network_packet_t tx_packet;
 	network_packet_t rx_packet;
 
+	// message being sent, one fragment at a time
+	uint8_t tx_message[NW_MAX_MESSAGE_SIZE];
+	uint16_t tx_length;
+	uint8_t tx_frag_index;
+	uint8_t tx_frag_count;
+	uint8_t tx_msg_id;
+	uint16_t tx_dest_node;
+	uint8_t tx_msg_type; // nw_msg_type_t
+	uint8_t tx_hops;	 // Hops to tx_dest_node, the fragments are paced on a route over relays
+	uint8_t tx_state;	 // nw_tx_state_t: what the packet being sent belongs to
+	bool msg_pending;	 // The message waits for the ACK or the forwarded packet being sent
+
+	nw_reassembly_t reassembly[NW_REASSEMBLY_BUFFERS];
+	uint32_t reassembly_clock;
+
 } network_instance_t;
 
 void network_init(uint16_t node_address, nw_evt_handler_t evt_handler);
+void nw_set_tx_evt_handler(nw_tx_evt_handler_t evt_handler);
 void nw_update();
-void nw_send(uint16_t dest_node, uint8_t *message, uint8_t length, nw_msg_type_t nw_msg_type);
+/* Function to send a message of up to NW_MAX_MESSAGE_SIZE bytes, split into fragments of NW_FRAGMENT_PAYLOAD_SIZE bytes.
+ * One message is sent at a time. Returns false if the message is too long or the previous one is still being sent,
+ * otherwise the tx event handler reports whether the message has been sent. A message given while the ACK of a
+ * received message is being sent, e.g. a reply from the nw_evt_handler, is sent after the ACK.
+ */
+bool nw_send(uint16_t dest_node, uint8_t *message, uint16_t length, nw_msg_type_t nw_msg_type);
 
 
 
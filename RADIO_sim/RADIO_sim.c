@@ -0,0 +1,1220 @@
+/**
+ * @file RADIO_sim.c
+ * @author Surya Poudel
+ * @brief Host-side model of the RADIO peripheral on a shared 2.4 GHz medium
+ *
+ * Every node has the registers and the state machine of a RADIO. A START in TX_IDLE puts a
+ * transmission on the air. Receivers listening on its channel and data rate lock onto it when
+ * its address has been sent and matches one of their logical addresses, and get the END event
+ * when it ends. Time advances from event to event, so idle stretches cost nothing.
+ *
+ * Timing follows the nRF52840 product specification: ramp-up as configured, 6 us to disable
+ * the TX, an immediate RX disable, and the airtime of preamble, address, header, payload and
+ * CRC at the data rate. The Coded PHY adds its long range preamble, coding indicator and TERM fields.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "radio_driver.h"
+#include "hpTimer.h"
+#include "RADIO_sim.h"
+
+#define RADIO_SIM_MAX_AIR 64                // Transmissions kept for the reception and the collision check
+#define RADIO_SIM_MAX_TIMERS 32             // hpTimer instances of all nodes
+#define RADIO_SIM_MAX_FRAME (3 + 255)       // S0, LENGTH and S1 bytes and the longest payload
+#define RADIO_SIM_TX_DISABLE_US 6           // TX_DISABLE to DISABLED
+#define RADIO_SIM_NO_AIR 0xFF
+
+#define MODE_NRF_2MBIT 1
+#define MODE_BLE_LR125KBIT 5
+
+typedef enum
+{
+    TRANSITION_NONE,
+    TRANSITION_READY,    // Ramp-up done
+    TRANSITION_TX_END,   // Last bit sent
+    TRANSITION_DISABLED  // Disable done
+} transition_t;
+
+typedef struct
+{
+    // configuration
+    uint32_t frequency;
+    uint32_t mode;
+    uint8_t lflen, s0len, s1len, statlen, maxlen, balen;
+    uint8_t crc_len;
+    uint32_t crc_poly, crc_init;
+    uint32_t prefix0, prefix1, base0, base1;
+    uint8_t txaddress, rxaddresses;
+    uint32_t shorts;
+    bool end_int, disabled_int;
+    uint8_t *packet_ptr;
+    radio_event_handler_t end_handler, disabled_handler;
+    void (*swi_handler)(void);
+
+    // state
+    radio_state_t state;
+    transition_t transition;
+    uint64_t transition_time;
+    uint8_t air; // Transmission being sent or received, RADIO_SIM_NO_AIR if none
+    bool events_ready, events_end, events_disabled;
+    bool swi_pending;
+    uint8_t crc_status, rxmatch, rssi_sample;
+    uint32_t rxcrc;
+    uint64_t listen_start; // Time of the START which put the receiver in RX
+    uint8_t isr_depth;
+    bool irq_scheduled; // A pending interrupt will be taken at irq_time, after the interrupt latency
+    uint64_t irq_time;
+    RADIO_sim_stats_t stats;
+} sim_node_t;
+
+typedef struct
+{
+    bool used;
+    bool aborted; // The transmitter was disabled before the end of the packet
+    uint8_t from;
+    uint32_t frequency, mode;
+    uint8_t prefix, balen;
+    uint32_t base;
+    uint8_t frame[RADIO_SIM_MAX_FRAME];
+    uint16_t frame_length;
+    uint64_t start, address_end, end; // Times at the receivers, latency included
+    bool address_done, end_done;
+} sim_air_t;
+
+/* hpTimer instance of a node. The instances of all nodes share one address when they are
+ * RADIO_SIM_NODE_STATE, so the timer state is kept here and the instance is only written with its node selected.
+ */
+typedef struct
+{
+    hpTimer_node_t *instance;
+    uint8_t node;
+    bool running;
+    hp_timer_mode_t mode;
+    hp_timeout_handler_t handler;
+    void *context;
+    uint32_t interval;
+    uint64_t deadline;
+    bool expired; // Deadline reached, handler not called yet
+} sim_timer_t;
+
+// Linker generated bounds of the RADIO_SIM_NODE_STATE section, NULL if no module has node state
+extern uint8_t __start_radio_sim_node[] __attribute__((weak));
+extern uint8_t __stop_radio_sim_node[] __attribute__((weak));
+
+static struct
+{
+    RADIO_sim_config_t config;
+    uint8_t node_count;
+    sim_node_t nodes[RADIO_SIM_MAX_NODES];
+    uint8_t loss[RADIO_SIM_MAX_NODES][RADIO_SIM_MAX_NODES];
+    int8_t rssi[RADIO_SIM_MAX_NODES][RADIO_SIM_MAX_NODES];
+    sim_air_t air[RADIO_SIM_MAX_AIR];
+    sim_timer_t timers[RADIO_SIM_MAX_TIMERS];
+    uint8_t timer_count;
+    uint8_t current;
+    uint8_t loaded; // Node whose state is in the RADIO_SIM_NODE_STATE section
+    uint8_t *images[RADIO_SIM_MAX_NODES]; // Node state of the other nodes
+    uint64_t now;
+    uint32_t random;
+} sim;
+
+static uint8_t *initial_image; // RADIO_SIM_NODE_STATE section before the first RADIO_sim_init(), the state of a new node
+
+#define CURRENT (&sim.nodes[sim.current])
+
+static size_t node_state_size()
+{
+    return __start_radio_sim_node ? (size_t)(__stop_radio_sim_node - __start_radio_sim_node) : 0;
+}
+
+/*Function to select a node: its RADIO is used by the radio_driver.h API and its state is swapped into the RADIO_SIM_NODE_STATE section.
+ */
+static void node_select(uint8_t node)
+{
+    sim.current = node;
+
+    if (node == sim.loaded || node_state_size() == 0)
+        return;
+
+    memcpy(sim.images[sim.loaded], __start_radio_sim_node, node_state_size());
+    memcpy(__start_radio_sim_node, sim.images[node], node_state_size());
+    sim.loaded = node;
+}
+
+static void task_txen(sim_node_t *n);
+static void task_rxen(sim_node_t *n);
+static void task_disable(sim_node_t *n);
+
+/*Function to get a pseudo random percentage from the seeded generator, so that runs can be repeated.
+ */
+static uint8_t random_percent()
+{
+    sim.random = sim.random * 1103515245UL + 12345UL;
+    return (sim.random >> 16) % 100;
+}
+
+static uint32_t crc_compute(const sim_node_t *n, const uint8_t *data, uint16_t length)
+{
+    uint8_t bits = n->crc_len * 8;
+    uint32_t mask = bits ? (bits == 32 ? 0xFFFFFFFFUL : (1UL << bits) - 1) : 0;
+    uint32_t crc = n->crc_init & mask;
+
+    for (uint16_t i = 0; i < length; i++)
+    {
+        for (uint8_t b = 0; b < 8; b++)
+        {
+            bool bit = ((data[i] >> (7 - b)) & 1) ^ ((crc >> (bits - 1)) & 1);
+            crc = (crc << 1) & mask;
+            if (bit)
+                crc ^= n->crc_poly & mask;
+        }
+    }
+
+    return crc;
+}
+
+// Function to get the prefix byte of a logical address
+static uint8_t address_prefix(const sim_node_t *n, uint8_t logical_address)
+{
+    uint32_t prefix = logical_address < 4 ? n->prefix0 : n->prefix1;
+
+    return (prefix >> ((logical_address % 4) * 8)) & 0xFF;
+}
+
+// Function to get the base address of a logical address, reduced to the BALEN most significant bytes
+static uint32_t address_base(const sim_node_t *n, uint8_t logical_address)
+{
+    uint32_t base = logical_address == 0 ? n->base0 : n->base1;
+
+    return n->balen >= 4 ? base : base & ~(0xFFFFFFFFUL >> (8 * n->balen));
+}
+
+/*Function to get the airtime of a packet. header_bits are the S0, LENGTH and S1 bits on air.
+ */
+static uint64_t airtime_us(const sim_node_t *n, uint16_t header_bits, uint16_t payload_length)
+{
+    uint32_t bits = (n->balen + 1) * 8 + header_bits + payload_length * 8 + n->crc_len * 8;
+
+    switch (n->mode)
+    {
+    case MODE_NRF_2MBIT:
+        return (16 + bits + 1) / 2;
+    case MODE_BLE_LR125KBIT:
+        // long range preamble, coding indicator and TERM1 are sent at S=8, then the coded frame and TERM2
+        return 80 + 16 + 24 + bits * 8 + 24;
+    default:
+        return 8 + bits;
+    }
+}
+
+// Function to get the time from the start of a transmission until its address has been sent
+static uint64_t address_time_us(const sim_node_t *n)
+{
+    switch (n->mode)
+    {
+    case MODE_NRF_2MBIT:
+        return (16 + (n->balen + 1) * 8) / 2;
+    case MODE_BLE_LR125KBIT:
+        return 80 + 16 + 24 + (n->balen + 1) * 8 * 8;
+    default:
+        return 8 + (n->balen + 1) * 8;
+    }
+}
+
+static bool air_overlap(const sim_air_t *a, const sim_air_t *b)
+{
+    return a->start < b->end && b->start < a->end;
+}
+
+/*Function to check if a transmission overlaps with another one on the same channel.
+ */
+static bool air_collided(uint8_t index)
+{
+    sim_air_t *a = &sim.air[index];
+
+    for (uint8_t i = 0; i < RADIO_SIM_MAX_AIR; i++)
+    {
+        sim_air_t *b = &sim.air[i];
+
+        if (i != index && b->used && b->frequency == a->frequency && b->from != a->from && air_overlap(a, b))
+            return true;
+    }
+
+    return false;
+}
+
+/*Function to check if an ended transmission can still collide with one that has not ended yet.
+ */
+static bool air_needed(uint8_t index)
+{
+    sim_air_t *a = &sim.air[index];
+
+    if (!a->end_done)
+        return true;
+
+    for (uint8_t i = 0; i < RADIO_SIM_MAX_AIR; i++)
+    {
+        if (sim.air[i].used && !sim.air[i].end_done && sim.air[i].start < a->end)
+            return true;
+    }
+
+    return false;
+}
+
+/*Function to get a free transmission slot. Ended transmissions are reused once they can't collide any more.
+ */
+static uint8_t air_alloc()
+{
+    for (uint8_t i = 0; i < RADIO_SIM_MAX_AIR; i++)
+    {
+        if (!sim.air[i].used || !air_needed(i))
+            return i;
+    }
+
+    fprintf(stderr, "RADIO_sim: too many transmissions on the air\n");
+    return 0;
+}
+
+/*Function to put the packet at PACKETPTR of the node on the air.
+ */
+static void air_start(sim_node_t *n)
+{
+    uint8_t index = air_alloc();
+    sim_air_t *a = &sim.air[index];
+    uint8_t header_length = n->s0len + (n->lflen ? 1 : 0) + (n->s1len ? 1 : 0);
+    uint16_t payload_length = n->statlen;
+
+    if (n->lflen)
+        payload_length += n->packet_ptr[n->s0len] & ((1U << n->lflen) - 1);
+    if (payload_length > n->maxlen)
+        payload_length = n->maxlen;
+
+    memset(a, 0, sizeof(*a));
+    a->used = true;
+    a->from = n - sim.nodes;
+    a->frequency = n->frequency;
+    a->mode = n->mode;
+    a->prefix = address_prefix(n, n->txaddress);
+    a->base = address_base(n, n->txaddress);
+    a->balen = n->balen;
+    a->frame_length = header_length + payload_length;
+    memcpy(a->frame, n->packet_ptr, a->frame_length);
+
+    uint64_t airtime = airtime_us(n, n->s0len * 8 + n->lflen + n->s1len, payload_length);
+
+    a->start = sim.now + sim.config.latency_us;
+    a->address_end = a->start + address_time_us(n);
+    a->end = a->start + airtime;
+
+    n->air = index;
+    n->state = TX;
+    n->transition = TRANSITION_TX_END;
+    n->transition_time = sim.now + airtime;
+    n->stats.tx_packets++;
+    n->stats.tx_airtime_us += airtime;
+}
+
+static void task_start(sim_node_t *n)
+{
+    if (n->state == TX_IDLE)
+        air_start(n);
+    else if (n->state == RX_IDLE)
+    {
+        n->state = RX; // listening for an address
+        n->listen_start = sim.now;
+    }
+}
+
+static void ramp_up(sim_node_t *n, radio_state_t state)
+{
+    if (n->state != DISABLED)
+        return;
+
+    n->state = state;
+    n->transition = TRANSITION_READY;
+    n->transition_time = sim.now + sim.config.ramp_up_us;
+}
+
+static void task_txen(sim_node_t *n)
+{
+    ramp_up(n, TX_RU);
+}
+
+static void task_rxen(sim_node_t *n)
+{
+    ramp_up(n, RX_RU);
+}
+
+/*Function to disable the node. A packet being sent is cut off, a packet being received is lost.
+ */
+static void task_disable(sim_node_t *n)
+{
+    if (n->state == DISABLED)
+    {
+        n->events_disabled = true;
+        return;
+    }
+
+    bool tx = n->state == TX_RU || n->state == TX_IDLE || n->state == TX;
+
+    if (n->state == TX && n->air != RADIO_SIM_NO_AIR)
+    {
+        sim_air_t *a = &sim.air[n->air];
+
+        a->aborted = true;
+        a->end = sim.now + sim.config.latency_us;
+        if (a->address_end > a->end)
+            a->address_end = a->end;
+    }
+    n->air = RADIO_SIM_NO_AIR;
+
+    n->state = tx ? TX_DISABLE : RX_DISABLE;
+    n->transition = TRANSITION_DISABLED;
+    n->transition_time = sim.now + (tx ? RADIO_SIM_TX_DISABLE_US : 0);
+}
+
+/*Function to handle the END event of a node: shortcut to DISABLE.
+ */
+static void event_end(sim_node_t *n)
+{
+    n->events_end = true;
+
+    if (n->shorts & RADIO_SHORT_END_DISABLE)
+        task_disable(n);
+}
+
+static void node_transition(sim_node_t *n)
+{
+    transition_t transition = n->transition;
+
+    n->transition = TRANSITION_NONE;
+
+    switch (transition)
+    {
+    case TRANSITION_READY:
+        n->state = n->state == TX_RU ? TX_IDLE : RX_IDLE;
+        n->events_ready = true;
+        if (n->shorts & RADIO_SHORT_READY_START)
+            task_start(n);
+        break;
+
+    case TRANSITION_TX_END:
+        n->state = TX_IDLE;
+        n->air = RADIO_SIM_NO_AIR;
+        event_end(n);
+        break;
+
+    case TRANSITION_DISABLED:
+        n->state = DISABLED;
+        n->events_disabled = true;
+        if (n->shorts & RADIO_SHORT_DISABLED_TXEN)
+            task_txen(n);
+        else if (n->shorts & RADIO_SHORT_DISABLED_RXEN)
+            task_rxen(n);
+        break;
+
+    default:
+        break;
+    }
+}
+
+/*Function to let the listening receivers lock onto a transmission whose address has been sent.
+ */
+static void air_address(uint8_t index)
+{
+    sim_air_t *a = &sim.air[index];
+
+    a->address_done = true;
+    if (a->aborted)
+        return;
+
+    for (uint8_t i = 0; i < sim.node_count; i++)
+    {
+        sim_node_t *n = &sim.nodes[i];
+
+        // the receiver must have been listening when the preamble started
+        if (i == a->from || n->state != RX || n->air != RADIO_SIM_NO_AIR || n->listen_start > a->start)
+            continue;
+        if (n->frequency != a->frequency || n->mode != a->mode || n->balen != a->balen)
+            continue;
+
+        for (uint8_t la = 0; la < 8; la++)
+        {
+            if ((n->rxaddresses & (1 << la)) && address_prefix(n, la) == a->prefix && address_base(n, la) == a->base)
+            {
+                n->air = index;
+                n->rxmatch = la;
+                if (n->shorts & RADIO_SHORT_ADDRESS_RSSISTART)
+                    n->rssi_sample = -sim.rssi[a->from][i];
+                break;
+            }
+        }
+    }
+}
+
+/*Function to end a transmission at its receivers. The packet is written to their PACKETPTR with the
+ * CRC status given by the loss model and the collision check.
+ */
+static void air_end(uint8_t index)
+{
+    sim_air_t *a = &sim.air[index];
+
+    a->end_done = true;
+
+    for (uint8_t i = 0; i < sim.node_count; i++)
+    {
+        sim_node_t *n = &sim.nodes[i];
+
+        if (n->air != index || n->state != RX)
+            continue;
+
+        n->air = RADIO_SIM_NO_AIR;
+
+        // a packet cut off by its transmitter never ends at the receiver, which keeps listening
+        if (a->aborted)
+            continue;
+
+        // PACKETPTR points into the state of the receiver
+        node_select(i);
+
+        uint8_t header_length = n->s0len + (n->lflen ? 1 : 0) + (n->s1len ? 1 : 0);
+        uint16_t length = a->frame_length;
+
+        if (length > header_length + n->maxlen)
+            length = header_length + n->maxlen;
+        memcpy(n->packet_ptr, a->frame, length);
+
+        bool collided = sim.config.collisions && air_collided(index);
+        bool lost = !collided && random_percent() < sim.loss[a->from][i];
+
+        n->crc_status = !collided && !lost;
+        n->rxcrc = crc_compute(n, a->frame, a->frame_length);
+        if (collided)
+            n->stats.rx_collisions++;
+        if (lost)
+            n->stats.rx_lost++;
+        if (n->crc_status)
+            n->stats.rx_packets++;
+        else
+            n->stats.rx_crc_errors++;
+
+        n->state = RX_IDLE;
+        event_end(n);
+    }
+}
+
+/*Function to check if an interrupt of a node is pending.
+ */
+static bool irq_pending(uint8_t node)
+{
+    sim_node_t *n = &sim.nodes[node];
+
+    if (n->events_disabled && n->disabled_int && n->disabled_handler)
+        return true;
+    if (n->events_end && n->end_int && n->state == RX_IDLE && n->end_handler)
+        return true;
+    if (n->swi_pending)
+        return true;
+
+    for (uint8_t i = 0; i < sim.timer_count; i++)
+    {
+        if (sim.timers[i].node == node && sim.timers[i].expired)
+            return true;
+    }
+
+    return false;
+}
+
+/*Function to call the interrupt handlers of a node as long as one of its interrupts is pending,
+ * unless the node is already in an interrupt. Mirrors RADIO_IRQHandler() of radio_driver.c.
+ */
+static void deliver_irq(uint8_t node)
+{
+    sim_node_t *n = &sim.nodes[node];
+
+    if (n->isr_depth)
+        return;
+
+    uint8_t previous = sim.current;
+
+    while (1)
+    {
+        node_select(node);
+        n->isr_depth++;
+
+        bool called = false;
+
+        if (n->events_disabled && n->disabled_int && n->disabled_handler)
+        {
+            n->events_disabled = false;
+            n->disabled_handler();
+            called = true;
+        }
+        else if (n->events_end && n->end_int && n->state == RX_IDLE && n->end_handler)
+        {
+            n->events_end = false;
+            n->end_handler();
+            called = true;
+        }
+        else if (n->swi_pending)
+        {
+            n->swi_pending = false;
+            n->swi_handler();
+            called = true;
+        }
+        else
+        {
+            for (uint8_t i = 0; i < sim.timer_count; i++)
+            {
+                sim_timer_t *t = &sim.timers[i];
+
+                if (t->node != node || !t->expired)
+                    continue;
+
+                t->expired = false;
+                if (t->mode == HP_TIMER_MODE_SINGLE_SHOT)
+                    t->instance->is_running = false;
+                t->handler(t->context);
+                called = true;
+                break;
+            }
+        }
+
+        n->isr_depth--;
+
+        if (!called)
+            break;
+    }
+
+    node_select(previous);
+}
+
+/*Function to take the pending interrupts of a node, at once or after the interrupt latency.
+ */
+static void irq_schedule(uint8_t node)
+{
+    sim_node_t *n = &sim.nodes[node];
+
+    if (sim.config.irq_latency_us == 0)
+    {
+        deliver_irq(node);
+        return;
+    }
+
+    if (!n->irq_scheduled && !n->isr_depth && irq_pending(node))
+    {
+        n->irq_scheduled = true;
+        n->irq_time = sim.now + sim.config.irq_latency_us;
+    }
+}
+
+/*Function to find the next event of the medium. Returns false if there is none.
+ */
+static bool next_event(uint64_t *time)
+{
+    bool found = false;
+
+    for (uint8_t i = 0; i < sim.node_count; i++)
+    {
+        sim_node_t *n = &sim.nodes[i];
+
+        if (n->transition != TRANSITION_NONE && (!found || n->transition_time < *time))
+        {
+            *time = n->transition_time;
+            found = true;
+        }
+        if (n->irq_scheduled && (!found || n->irq_time < *time))
+        {
+            *time = n->irq_time;
+            found = true;
+        }
+    }
+
+    for (uint8_t i = 0; i < RADIO_SIM_MAX_AIR; i++)
+    {
+        sim_air_t *a = &sim.air[i];
+
+        if (!a->used)
+            continue;
+        if (!a->address_done && (!found || a->address_end < *time))
+        {
+            *time = a->address_end;
+            found = true;
+        }
+        if (!a->end_done && (!found || a->end < *time))
+        {
+            *time = a->end;
+            found = true;
+        }
+    }
+
+    for (uint8_t i = 0; i < sim.timer_count; i++)
+    {
+        sim_timer_t *t = &sim.timers[i];
+
+        if (t->running && !t->expired && (!found || t->deadline < *time))
+        {
+            *time = t->deadline;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+/*Function to process one event due at the current time. Returns false if there is none.
+ * RADIO events are processed with their node selected, as they write its RAM (PACKETPTR).
+ */
+static bool process_due_event()
+{
+    for (uint8_t i = 0; i < sim.node_count; i++)
+    {
+        sim_node_t *n = &sim.nodes[i];
+
+        if (n->transition != TRANSITION_NONE && n->transition_time <= sim.now)
+        {
+            node_select(i);
+            node_transition(n);
+            irq_schedule(i);
+            return true;
+        }
+
+        if (n->irq_scheduled && n->irq_time <= sim.now)
+        {
+            n->irq_scheduled = false;
+            deliver_irq(i);
+            return true;
+        }
+    }
+
+    for (uint8_t i = 0; i < RADIO_SIM_MAX_AIR; i++)
+    {
+        sim_air_t *a = &sim.air[i];
+
+        if (a->used && !a->address_done && a->address_end <= sim.now)
+        {
+            air_address(i);
+            return true;
+        }
+        if (a->used && !a->end_done && a->end <= sim.now)
+        {
+            air_end(i);
+            for (uint8_t j = 0; j < sim.node_count; j++)
+                irq_schedule(j);
+            return true;
+        }
+    }
+
+    for (uint8_t i = 0; i < sim.timer_count; i++)
+    {
+        sim_timer_t *t = &sim.timers[i];
+
+        if (t->running && !t->expired && t->deadline <= sim.now)
+        {
+            t->expired = true;
+            if (t->mode == HP_TIMER_MODE_REPEATED)
+                t->deadline += t->interval;
+            else
+                t->running = false;
+            irq_schedule(t->node);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool process_event()
+{
+    uint8_t previous = sim.current;
+    bool processed = process_due_event();
+
+    node_select(previous);
+
+    return processed;
+}
+
+/*Function to process all events up to the time limit. It is called again from the busy-waits
+ * of the handlers, so the other nodes carry on while one node waits.
+ */
+static void process_until(uint64_t limit)
+{
+    uint64_t time;
+
+    while (next_event(&time) && time <= limit)
+    {
+        if (time > sim.now)
+            sim.now = time;
+        if (!process_event())
+            break;
+    }
+
+    if (limit > sim.now)
+        sim.now = limit;
+}
+
+/*Function to busy-wait until the condition holds for the selected node, like the register polling of radio_driver.c.
+ */
+static void wait_for(bool (*condition)(const sim_node_t *n))
+{
+    sim_node_t *n = CURRENT;
+    uint64_t time;
+
+    while (!condition(n))
+    {
+        if (!next_event(&time))
+        {
+            fprintf(stderr, "RADIO_sim: node %d waits for an event that never comes\n", (int)(n - sim.nodes));
+            return;
+        }
+
+        if (time > sim.now)
+            sim.now = time;
+        if (!process_event())
+        {
+            fprintf(stderr, "RADIO_sim: node %d waits for an event that is never processed\n", (int)(n - sim.nodes));
+            return;
+        }
+    }
+}
+
+/* The DISABLED event is polled like in radio_disable() of radio_driver.c. If the DISABLED interrupt
+ * is enabled and the node is not in an interrupt, the handler clears the event first and the wait never ends, as on target.
+ */
+static bool is_disabled(const sim_node_t *n) { return n->events_disabled; }
+static bool is_ready(const sim_node_t *n) { return n->events_ready; }
+static bool is_end(const sim_node_t *n) { return n->events_end; }
+
+/*Function to reset the medium. Every node starts from the RADIO_SIM_NODE_STATE section as it was
+ * before the first call, so the nodes must not have run before.
+ */
+void RADIO_sim_init(uint8_t nodes, const RADIO_sim_config_t *config)
+{
+    size_t state_size = node_state_size();
+
+    for (uint8_t i = 0; i < RADIO_SIM_MAX_NODES; i++)
+        free(sim.images[i]);
+
+    if (state_size && initial_image == NULL)
+    {
+        initial_image = malloc(state_size);
+        memcpy(initial_image, __start_radio_sim_node, state_size);
+    }
+
+    memset(&sim, 0, sizeof(sim));
+
+    sim.config = *config;
+    sim.node_count = nodes > RADIO_SIM_MAX_NODES ? RADIO_SIM_MAX_NODES : nodes;
+    sim.random = config->seed;
+
+    for (uint8_t i = 0; i < RADIO_SIM_MAX_NODES; i++)
+    {
+        sim.nodes[i].state = DISABLED;
+        sim.nodes[i].air = RADIO_SIM_NO_AIR;
+        sim.nodes[i].balen = 4;
+        sim.nodes[i].maxlen = 255;
+
+        if (state_size)
+        {
+            sim.images[i] = malloc(state_size);
+            memcpy(sim.images[i], initial_image, state_size);
+        }
+
+        for (uint8_t j = 0; j < RADIO_SIM_MAX_NODES; j++)
+        {
+            sim.loss[i][j] = config->loss_percent;
+            sim.rssi[i][j] = config->rssi_dbm;
+        }
+    }
+
+    if (state_size)
+        memcpy(__start_radio_sim_node, initial_image, state_size);
+}
+
+void RADIO_sim_set_link(uint8_t from, uint8_t to, uint8_t loss_percent, int8_t rssi_dbm)
+{
+    if (from >= RADIO_SIM_MAX_NODES || to >= RADIO_SIM_MAX_NODES)
+        return;
+
+    sim.loss[from][to] = loss_percent;
+    sim.rssi[from][to] = rssi_dbm;
+}
+
+void RADIO_sim_select_node(uint8_t node)
+{
+    if (node < sim.node_count)
+        node_select(node);
+}
+
+uint8_t RADIO_sim_current_node()
+{
+    return sim.current;
+}
+
+void RADIO_sim_trigger_swi(void (*handler)(void))
+{
+    CURRENT->swi_handler = handler;
+    CURRENT->swi_pending = true;
+    irq_schedule(sim.current);
+}
+
+void RADIO_sim_advance(uint64_t us)
+{
+    process_until(sim.now + us);
+}
+
+uint64_t RADIO_sim_time_us()
+{
+    return sim.now;
+}
+
+void RADIO_sim_get_stats(uint8_t node, RADIO_sim_stats_t *stats)
+{
+    if (node < RADIO_SIM_MAX_NODES)
+        *stats = sim.nodes[node].stats;
+}
+
+/* radio_driver.h API of the selected node */
+
+void radio_set_evt_handler(radio_event_handler_t evt_handler)
+{
+    CURRENT->end_handler = evt_handler;
+}
+
+void radio_set_disabled_evt_handler(radio_event_handler_t evt_handler)
+{
+    CURRENT->disabled_handler = evt_handler;
+}
+
+void radio_enable_mode(radio_mode_t mode)
+{
+    if (mode == MODE_TX)
+        task_txen(CURRENT);
+    else
+        task_rxen(CURRENT);
+}
+
+radio_state_t radio_get_state()
+{
+    return CURRENT->state;
+}
+
+void radio_disable()
+{
+    CURRENT->events_disabled = false;
+    task_disable(CURRENT);
+    wait_for(is_disabled);
+    CURRENT->events_disabled = false;
+}
+
+void radio_set_mode(radio_mode_t mode)
+{
+    radio_disable();
+
+    CURRENT->events_ready = false;
+    radio_enable_mode(mode);
+    wait_for(is_ready);
+    CURRENT->events_ready = false;
+}
+
+void radio_tx()
+{
+    if (CURRENT->state == DISABLED)
+    {
+        CURRENT->events_ready = false;
+        task_txen(CURRENT);
+        wait_for(is_ready);
+        CURRENT->events_ready = false;
+    }
+
+    radio_start_tx();
+    radio_disable();
+}
+
+uint8_t radio_get_crc_status()
+{
+    return CURRENT->crc_status;
+}
+
+void radio_start_rx()
+{
+    if (CURRENT->state == RX_IDLE)
+        task_start(CURRENT);
+}
+
+void radio_start_tx()
+{
+    if (CURRENT->state == TX_IDLE)
+    {
+        CURRENT->events_end = false;
+        task_start(CURRENT);
+        wait_for(is_end);
+        CURRENT->events_end = false;
+    }
+}
+
+void radio_set_frequency(uint32_t frequency)
+{
+    CURRENT->frequency = frequency;
+}
+
+void radio_set_tx_power(uint32_t tx_power)
+{
+}
+
+void radio_set_data_rate(radio_data_rate_t data_rate)
+{
+    CURRENT->mode = (uint32_t)data_rate;
+}
+
+void radio_set_len_field_size(uint8_t bits)
+{
+    CURRENT->lflen = bits;
+}
+
+void radio_set_s0_field_size(uint8_t bytes)
+{
+    CURRENT->s0len = bytes;
+}
+
+void radio_set_s1_field_size(uint8_t bits)
+{
+    CURRENT->s1len = bits;
+}
+
+void radio_set_static_payload_size(uint32_t static_pl_size)
+{
+    CURRENT->statlen = static_pl_size;
+}
+
+void radio_set_max_payload_size(uint32_t max_pl_size)
+{
+    CURRENT->maxlen = max_pl_size;
+}
+
+void radio_set_address_width(uint8_t add_width)
+{
+    CURRENT->balen = add_width - 1;
+}
+
+void radio_set_payload_endian(radio_endian_t endian)
+{
+}
+
+void radio_enable_whitening(bool en)
+{
+}
+
+void radio_set_whiteiv(uint8_t init_value)
+{
+}
+
+int8_t radio_get_rssi()
+{
+    return -(int8_t)CURRENT->rssi_sample;
+}
+
+uint8_t radio_get_received_address()
+{
+    return CURRENT->rxmatch;
+}
+
+void radio_set_tx_logical_address(uint8_t logical_address)
+{
+    CURRENT->txaddress = logical_address;
+}
+
+void radio_set_rx_logical_address(uint8_t logical_address)
+{
+    CURRENT->rxaddresses |= 1 << logical_address;
+}
+
+void radio_set_rx_logical_addresses(uint8_t logical_address_mask)
+{
+    CURRENT->rxaddresses = logical_address_mask;
+}
+
+uint32_t radio_get_rx_crc()
+{
+    return CURRENT->rxcrc;
+}
+
+void radio_set_address(const uint8_t *address, uint8_t logical_address)
+{
+    sim_node_t *n = CURRENT;
+    uint8_t prefix_shift = (logical_address % 4) * 8;
+    uint32_t prefix_mask = 0x000000FFUL << prefix_shift;
+    uint32_t base = 0;
+
+    if (logical_address < 4)
+        n->prefix0 = (n->prefix0 & ~prefix_mask) | (uint32_t)address[0] << prefix_shift;
+    else
+        n->prefix1 = (n->prefix1 & ~prefix_mask) | (uint32_t)address[0] << prefix_shift;
+
+    for (uint8_t i = 0; i < 4; i++)
+        base |= (uint32_t)address[4 - i] << (8 * i);
+
+    if (logical_address == 0)
+        n->base0 = base;
+    else if (logical_address <= 7)
+        n->base1 = base;
+}
+
+void radio_set_tx_address(const uint8_t *tx_address, uint8_t logical_address)
+{
+    radio_set_address(tx_address, logical_address);
+    radio_set_tx_logical_address(logical_address);
+}
+
+void radio_set_rx_address(const uint8_t *rx_address, uint8_t logical_address)
+{
+    radio_set_address(rx_address, logical_address);
+    radio_set_rx_logical_address(logical_address);
+}
+
+void radio_configure_crc(uint8_t crc_len, uint8_t crc_add, uint32_t crc_poly, uint32_t crc_init_val)
+{
+    CURRENT->crc_len = crc_len;
+    CURRENT->crc_poly = crc_poly;
+    CURRENT->crc_init = crc_init_val;
+}
+
+void radio_set_packet_ptr(uint8_t *ptr)
+{
+    CURRENT->packet_ptr = ptr;
+}
+
+void radio_set_shorts(uint32_t shorts)
+{
+    CURRENT->shorts = shorts;
+}
+
+void radio_enable_disabled_interrupt(bool enable)
+{
+    CURRENT->disabled_int = enable;
+    CURRENT->end_int = !enable;
+    if (!enable)
+        CURRENT->events_end = false;
+}
+
+bool radio_end_event()
+{
+    if (!CURRENT->events_end)
+        return false;
+
+    CURRENT->events_end = false;
+    return true;
+}
+
+void radio_trigger_disable()
+{
+    task_disable(CURRENT);
+}
+
+uint32_t radio_disable_task_address()
+{
+    // there is no PPI in the host build, hpTimer_ppi_event_start() never grants a channel
+    return 0;
+}
+
+void radio_enable_interrupts()
+{
+    CURRENT->end_int = true;
+}
+
+/* hpTimer.h API on the virtual time. Timers belong to the node selected when they are created. */
+
+void hpTimer_init()
+{
+}
+
+static sim_timer_t *timer_find(hpTimer_node_t *instance)
+{
+    for (uint8_t i = 0; i < sim.timer_count; i++)
+    {
+        if (sim.timers[i].instance == instance && sim.timers[i].node == sim.current)
+            return &sim.timers[i];
+    }
+
+    return NULL;
+}
+
+void hpTimer_create(hpTimer_node_t *instance, hp_timeout_handler_t timeout_handler, hp_timer_mode_t mode, void *context)
+{
+    sim_timer_t *t = timer_find(instance);
+
+    instance->is_running = false;
+    instance->mode = mode;
+    instance->timeout_handler = timeout_handler;
+    instance->context = context;
+    instance->next_node = NULL;
+
+    if (t == NULL)
+    {
+        if (sim.timer_count == RADIO_SIM_MAX_TIMERS)
+        {
+            fprintf(stderr, "RADIO_sim: too many hpTimer instances\n");
+            return;
+        }
+
+        t = &sim.timers[sim.timer_count++];
+        t->instance = instance;
+        t->node = sim.current;
+    }
+
+    t->running = false;
+    t->expired = false;
+    t->mode = mode;
+    t->handler = timeout_handler;
+    t->context = context;
+}
+
+void hpTimer_start(hpTimer_node_t *instance, uint32_t interval_us)
+{
+    sim_timer_t *t = timer_find(instance);
+
+    if (t == NULL || t->running)
+        return;
+
+    if (interval_us == 0)
+        interval_us = 1;
+    if (interval_us > HP_TIMER_MAX_INTERVAL)
+        interval_us = HP_TIMER_MAX_INTERVAL;
+
+    instance->interval = interval_us;
+    instance->deadline = (uint32_t)(sim.now + interval_us);
+    instance->is_running = true;
+    t->interval = interval_us;
+    t->deadline = sim.now + interval_us;
+    t->running = true;
+    t->expired = false;
+}
+
+void hpTimer_stop(hpTimer_node_t *instance)
+{
+    sim_timer_t *t = timer_find(instance);
+
+    instance->is_running = false;
+    if (t != NULL)
+    {
+        t->running = false;
+        t->expired = false;
+    }
+}
+
+uint32_t hpTimer_now()
+{
+    return (uint32_t)sim.now;
+}
+
+uint32_t hpTimer_ppi_event_start(uint32_t delay_us, uint8_t *p_channel)
+{
+    return 0;
+}
+
+void hpTimer_ppi_event_stop(uint8_t channel)
+{
+}
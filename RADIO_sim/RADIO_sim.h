@@ -0,0 +1,93 @@
+/**
+ * @file RADIO_sim.h
+ * @author Surya Poudel
+ * @brief Host-side model of the RADIO peripheral on a shared 2.4 GHz medium
+ *
+ * RADIO_sim.c replaces radio_driver.c and hpTimer.c in host builds: it implements the
+ * radio_driver.h and hpTimer.h APIs on a model of the RADIO of several nodes sharing one
+ * medium, in virtual time. nrf24.c compiled with NRF24_HOST_SIM defined runs on top of it.
+ *
+ * The model covers the TXEN/RXEN ramp-up, START, END and DISABLE timing, the READY_START,
+ * END_DISABLE, DISABLED_TXEN/RXEN and ADDRESS_RSSISTART shortcuts, the packet format of
+ * PCNF0/PCNF1, address matching on the logical addresses, the CRC, and per link loss,
+ * latency and RSSI. Transmissions overlapping on the same channel corrupt each other.
+ * A receiver only gets a packet if it was listening when the preamble started.
+ *
+ * The radio_driver.h API acts on the node selected with RADIO_sim_select_node(). Interrupts
+ * and hpTimer handlers are called with their node selected, irq_latency_us after their event,
+ * and the interrupts of a node are not nested, as RADIO, TIMER4 and EGU1 share one priority on target.
+ *
+ * Every node runs its own nrf24 and Network stack. Their globals are RADIO_SIM_NODE_STATE:
+ * they are placed in one section, which is swapped with a per node copy whenever another
+ * node is selected. Applications put their per node globals there too.
+ * The softTimer of the link manager is not part of the node state.
+ */
+#ifndef __RADIO_SIM_H
+#define __RADIO_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RADIO_SIM_MAX_NODES 16 // Number of nodes on the medium
+
+// Attribute of globals holding the state of a node, e.g. RADIO_SIM_NODE_STATE static uint8_t buffer[32];
+#define RADIO_SIM_NODE_STATE __attribute__((section("radio_sim_node")))
+
+typedef struct
+{
+    uint8_t loss_percent;    // Share of the packets received with a CRC error, on every link unless set otherwise
+    uint32_t latency_us;     // Delay between a transmission and its reception, at least the RX chain delay (~10 us at 1 Mbps)
+    uint16_t ramp_up_us;     // TXEN/RXEN to READY: 40 in fast ramp-up mode, 130 otherwise
+    bool collisions;         // Overlapping transmissions on the same channel corrupt each other
+    int8_t rssi_dbm;         // RSSI of every link unless set otherwise
+    uint32_t seed;           // Seed of the loss model, runs with the same seed are identical
+    uint16_t irq_latency_us; // Time from an event to its interrupt handler acting on the RADIO, which carries on meanwhile
+} RADIO_sim_config_t;
+
+typedef struct
+{
+    uint32_t tx_packets;
+    uint64_t tx_airtime_us;
+    uint32_t rx_packets;    // Packets received with a valid CRC
+    uint32_t rx_crc_errors; // Packets received with a CRC error, lost or collided
+    uint32_t rx_lost;       // CRC errors caused by the loss model
+    uint32_t rx_collisions; // CRC errors caused by overlapping transmissions
+} RADIO_sim_stats_t;
+
+// Default configuration: lossless medium, RX chain delay, normal ramp-up, collisions enabled, 10 us for interrupt entry and handler work
+#define RADIO_SIM_DEFAULT_CONFIG \
+    {                            \
+        .loss_percent = 0,       \
+        .latency_us = 10,        \
+        .ramp_up_us = 130,       \
+        .collisions = true,      \
+        .rssi_dbm = -50,         \
+        .seed = 1,               \
+        .irq_latency_us = 10     \
+    }
+
+// Function to reset the medium with nodes nodes (up to RADIO_SIM_MAX_NODES), before any node has run. Node 0 is selected.
+void RADIO_sim_init(uint8_t nodes, const RADIO_sim_config_t *config);
+
+// Function to set the loss and RSSI of the link from one node to another
+void RADIO_sim_set_link(uint8_t from, uint8_t to, uint8_t loss_percent, int8_t rssi_dbm);
+
+// Function to select the node the radio_driver.h API acts on
+void RADIO_sim_select_node(uint8_t node);
+
+// Function to get the selected node
+uint8_t RADIO_sim_current_node();
+
+// Function to trigger the software interrupt (EGU) of the selected node. The handler runs as soon as the node is not in an interrupt.
+void RADIO_sim_trigger_swi(void (*handler)(void));
+
+// Function to advance the virtual time, delivering the events and interrupts which occur on the way
+void RADIO_sim_advance(uint64_t us);
+
+// Function to get the virtual time in microseconds
+uint64_t RADIO_sim_time_us();
+
+// Function to read the statistics of a node
+void RADIO_sim_get_stats(uint8_t node, RADIO_sim_stats_t *stats);
+
+#endif
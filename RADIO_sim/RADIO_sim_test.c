@@ -0,0 +1,291 @@
+/**
+ * @file RADIO_sim_test.c
+ * @author Surya Poudel
+ * @brief Throughput and latency tests of nrf24 and Network on the simulated medium
+ *
+ * Each test starts from RADIO_sim_init(), so the tests are independent of each other. Throughput is
+ * measured from the first send call to the last delivery. Latency is measured with one packet or
+ * message in flight, so that it does not include the time spent waiting in the TX FIFO.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "RADIO_sim.h"
+#include "nrf24.h"
+#include "Network.h"
+#include "RADIO_sim_test.h"
+
+#define TEST_STEP_US 50              // Virtual time the thread waits between its polls
+#define TEST_TIMEOUT_US 10000000ULL  // Virtual time after which a test phase is given up
+#define TEST_DRAIN_US 100000         // Virtual time for the packets in flight to be done at the end of a phase
+
+#define TEST_ESB_PTX 0
+#define TEST_ESB_PRX 1
+#define TEST_NW_DEST 0   // Node 00
+#define TEST_NW_RELAY 1  // Node 01
+#define TEST_NW_SOURCE 2 // Node 011
+
+static const uint8_t test_address[5] = {0xE7, 0xE7, 0xE7, 0xE7, 0xE7};
+
+static RADIO_sim_test_result_t *test_result;
+static uint32_t tx_done;          // TX events of the source, sent or failed
+static uint64_t send_time_us;     // Time of the send call of the packet or message in flight
+static uint64_t last_delivery_us; // Time of the last delivery
+static uint64_t latency_total_us;
+static uint32_t latency_cnt;
+static uint8_t test_message[RADIO_SIM_TEST_MSG_SIZE];
+
+/*Function to record the delivery of a packet or message sent at send_time_us.
+ */
+static void test_delivered()
+{
+    uint64_t latency = RADIO_sim_time_us() - send_time_us;
+
+    test_result->delivered++;
+    last_delivery_us = RADIO_sim_time_us();
+    latency_total_us += latency;
+    latency_cnt++;
+
+    if (latency > test_result->latency_max_us)
+        test_result->latency_max_us = latency;
+}
+
+/*Function to clear the result and the counters of a test.
+ */
+static void test_begin(RADIO_sim_test_result_t *result)
+{
+    memset(result, 0, sizeof(*result));
+    test_result = result;
+    tx_done = 0;
+    last_delivery_us = 0;
+    latency_total_us = 0;
+    latency_cnt = 0;
+
+    for (uint16_t i = 0; i < sizeof(test_message); i++)
+        test_message[i] = i * 7 + 3;
+}
+
+/*Function to let virtual time pass until the source has reported done TX events.
+ */
+static bool test_wait_tx_done(uint32_t done)
+{
+    uint64_t timeout = RADIO_sim_time_us() + TEST_TIMEOUT_US;
+
+    while (tx_done < done)
+    {
+        if (RADIO_sim_time_us() > timeout)
+            return false;
+
+        RADIO_sim_advance(TEST_STEP_US);
+    }
+
+    return true;
+}
+
+/*Event handler of both ESB nodes.
+ * The payload of the packets is test_message, so a delivery is only counted if the payload arrived intact.
+ */
+static void test_esb_evt_handler(nrf24_event_t *evt)
+{
+    switch (evt->event_type)
+    {
+    case NRF24_TX_SUCCESS:
+        test_result->sent++;
+        tx_done++;
+        break;
+    case NRF24_TX_FAILED:
+        test_result->failed++;
+        tx_done++;
+        break;
+    case NRF24_DATA_READY:
+        if (evt->length == NRF24_MAX_PAYLOAD_SIZE && !memcmp(evt->data, test_message, evt->length))
+            test_delivered();
+        break;
+    default:
+        break;
+    }
+}
+
+/* Function to test ESB between two nodes.
+ * The throughput phase keeps the TX FIFO of the PTX full, the latency phase sends the next packet
+ * when the previous one is done. Both send RADIO_SIM_TEST_PACKETS packets of NRF24_MAX_PAYLOAD_SIZE bytes.
+ */
+void RADIO_sim_test_esb(uint8_t loss_percent, RADIO_sim_test_result_t *result)
+{
+    RADIO_sim_config_t config = RADIO_SIM_DEFAULT_CONFIG;
+
+    config.loss_percent = loss_percent;
+    RADIO_sim_init(2, &config);
+    test_begin(result);
+
+    RADIO_sim_select_node(TEST_ESB_PRX);
+    nrf24_init();
+    nrf24_set_evt_handler(test_esb_evt_handler);
+    nrf24_set_rx_address(test_address, 0);
+    nrf24_set_mode(NRF24_MODE_RX);
+
+    RADIO_sim_select_node(TEST_ESB_PTX);
+    nrf24_init();
+    nrf24_set_evt_handler(test_esb_evt_handler);
+    nrf24_set_tx_address(test_address);
+    nrf24_set_mode(NRF24_MODE_TX);
+
+    // throughput with a full TX FIFO
+    uint64_t start_us = RADIO_sim_time_us();
+    uint32_t queued = 0;
+
+    while (queued < RADIO_SIM_TEST_PACKETS)
+    {
+        RADIO_sim_select_node(TEST_ESB_PTX);
+
+        if (nrf24_tx_reserve() != NULL)
+        {
+            nrf24_send(test_message, NRF24_MAX_PAYLOAD_SIZE);
+            queued++;
+        }
+        else
+        {
+            RADIO_sim_advance(TEST_STEP_US);
+        }
+    }
+
+    test_wait_tx_done(queued);
+    RADIO_sim_advance(TEST_DRAIN_US);
+
+    if (last_delivery_us > start_us)
+        result->throughput_kbps = (uint64_t)result->delivered * NRF24_MAX_PAYLOAD_SIZE * 8 * 1000 / (last_delivery_us - start_us);
+
+    // latency with one packet in flight
+    latency_total_us = 0;
+    latency_cnt = 0;
+    result->latency_max_us = 0;
+
+    for (uint32_t i = 0; i < RADIO_SIM_TEST_PACKETS; i++)
+    {
+        RADIO_sim_select_node(TEST_ESB_PTX);
+        send_time_us = RADIO_sim_time_us();
+        nrf24_send(test_message, NRF24_MAX_PAYLOAD_SIZE);
+
+        if (!test_wait_tx_done(queued + i + 1))
+            break;
+    }
+
+    RADIO_sim_advance(TEST_DRAIN_US);
+
+    if (latency_cnt)
+        result->latency_avg_us = latency_total_us / latency_cnt;
+}
+
+/*Handler of the messages received by the Network nodes. Only the destination gets messages.
+ */
+static void test_nw_evt_handler(uint8_t *data, uint16_t length)
+{
+    if (RADIO_sim_current_node() == TEST_NW_DEST && length == sizeof(test_message) && !memcmp(data, test_message, length))
+        test_delivered();
+}
+
+/*Handler of the outcome of the messages sent by the source.
+ */
+static void test_nw_tx_evt_handler(uint16_t dest_node, bool sent)
+{
+    if (sent)
+        test_result->sent++;
+    else
+        test_result->failed++;
+
+    tx_done++;
+}
+
+/* Function to test Network over a relay.
+ * Node 011 sends RADIO_SIM_TEST_MESSAGES messages to node 0, each after the previous one is done.
+ * The link between node 011 and node 0 is lost completely, so every fragment crosses node 01.
+ */
+void RADIO_sim_test_network(uint8_t loss_percent, RADIO_sim_test_result_t *result)
+{
+    RADIO_sim_config_t config = RADIO_SIM_DEFAULT_CONFIG;
+
+    config.loss_percent = loss_percent;
+    RADIO_sim_init(3, &config);
+    RADIO_sim_set_link(TEST_NW_SOURCE, TEST_NW_DEST, 100, config.rssi_dbm);
+    RADIO_sim_set_link(TEST_NW_DEST, TEST_NW_SOURCE, 100, config.rssi_dbm);
+    test_begin(result);
+
+    RADIO_sim_select_node(TEST_NW_DEST);
+    network_init(00, test_nw_evt_handler);
+    RADIO_sim_select_node(TEST_NW_RELAY);
+    network_init(01, test_nw_evt_handler);
+    RADIO_sim_select_node(TEST_NW_SOURCE);
+    network_init(011, test_nw_evt_handler);
+    nw_set_tx_evt_handler(test_nw_tx_evt_handler);
+
+    uint64_t start_us = RADIO_sim_time_us();
+
+    for (uint32_t i = 0; i < RADIO_SIM_TEST_MESSAGES; i++)
+    {
+        RADIO_sim_select_node(TEST_NW_SOURCE);
+        send_time_us = RADIO_sim_time_us();
+
+        if (!nw_send(00, test_message, sizeof(test_message), NW_MSG_DATA) || !test_wait_tx_done(i + 1))
+            break;
+
+        // the end-to-end ACK of the destination crosses the relay back to the source
+        RADIO_sim_advance(TEST_DRAIN_US / 20);
+    }
+
+    RADIO_sim_advance(TEST_DRAIN_US);
+
+    if (last_delivery_us > start_us)
+        result->throughput_kbps = (uint64_t)result->delivered * sizeof(test_message) * 8 * 1000 / (last_delivery_us - start_us);
+    if (latency_cnt)
+        result->latency_avg_us = latency_total_us / latency_cnt;
+}
+
+/*Function to print the result of a test.
+ */
+static void test_print(const char *name, uint8_t loss_percent, const RADIO_sim_test_result_t *result)
+{
+    printf("%s, %u%% loss: sent=%lu failed=%lu delivered=%lu throughput=%lukbit/s latency: avg=%luus max=%luus\n",
+           name, loss_percent, (unsigned long)result->sent, (unsigned long)result->failed, (unsigned long)result->delivered,
+           (unsigned long)result->throughput_kbps, (unsigned long)result->latency_avg_us, (unsigned long)result->latency_max_us);
+}
+
+/* Function to run both tests and print the results.
+ */
+bool RADIO_sim_test_run(uint8_t loss_percent)
+{
+    RADIO_sim_test_result_t result;
+    bool passed = true;
+
+    RADIO_sim_test_esb(loss_percent, &result);
+    test_print("ESB 2 nodes", loss_percent, &result);
+    passed &= result.delivered == 2 * RADIO_SIM_TEST_PACKETS;
+
+    RADIO_sim_test_network(loss_percent, &result);
+    test_print("Network 011->01->0", loss_percent, &result);
+    passed &= result.delivered == RADIO_SIM_TEST_MESSAGES;
+
+    return passed;
+}
+
+#if defined(RADIO_SIM_TEST_MAIN)
+#include <stdlib.h>
+
+// the host build has no debug_log.c, the logs of nrf24 and Network are dropped
+void debug_log_print(char *format, ...)
+{
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1)
+        return RADIO_sim_test_run(atoi(argv[1])) ? 0 : 1;
+
+    bool passed = RADIO_sim_test_run(0);
+
+    // on a lossy medium messages may be given up, the results are for comparison only
+    RADIO_sim_test_run(10);
+
+    return passed ? 0 : 1;
+}
+#endif
@@ -0,0 +1,46 @@
+/**
+ * @file RADIO_sim_test.h
+ * @author Surya Poudel
+ * @brief Throughput and latency tests of nrf24 and Network on the simulated medium
+ *
+ * The tests run in virtual time on RADIO_sim, so a run with the same loss gives the same result.
+ * Build on the host with NRF24_HOST_SIM defined, e.g.
+ *
+ *   gcc -std=gnu99 -DNRF24_HOST_SIM -DRADIO_SIM_TEST_MAIN -Iradio_driver -IhpTimer -Idebug_log
+ *       -Inrf24 -IRADIO_sim -INetwork RADIO_sim/RADIO_sim_test.c RADIO_sim/RADIO_sim.c
+ *       nrf24/nrf24.c Network/Network.c
+ *
+ * RADIO_SIM_TEST_MAIN adds a main() which runs the tests at 0 and 10 % packet loss, or at the loss
+ * given as first argument, and returns 0 if all messages were delivered on the lossless medium.
+ */
+#ifndef __RADIO_SIM_TEST_H
+#define __RADIO_SIM_TEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RADIO_SIM_TEST_PACKETS 1000  // Packets sent by the ESB test, in each of its phases
+#define RADIO_SIM_TEST_MESSAGES 20   // Messages sent by the Network test
+#define RADIO_SIM_TEST_MSG_SIZE 300 // Length of the Network test messages, sent in 14 fragments
+
+typedef struct
+{
+    uint32_t sent;            // Packets or messages reported as sent by the source
+    uint32_t failed;          // Packets or messages reported as failed by the source
+    uint32_t delivered;       // Packets or messages received intact by the destination
+    uint32_t throughput_kbps; // Payload bits delivered per virtual millisecond
+    uint32_t latency_avg_us;  // Average time from the send call to the delivery, one packet or message in flight
+    uint32_t latency_max_us;  // Longest time from the send call to the delivery
+} RADIO_sim_test_result_t;
+
+// Function to test ESB between two nodes: 32 byte packets with a full TX FIFO for the throughput, one at a time for the latency
+void RADIO_sim_test_esb(uint8_t loss_percent, RADIO_sim_test_result_t *result);
+
+// Function to test Network over three nodes: RADIO_SIM_TEST_MSG_SIZE byte messages from node 011 over the relay 01 to node 0.
+// Node 011 is out of range of node 0.
+void RADIO_sim_test_network(uint8_t loss_percent, RADIO_sim_test_result_t *result);
+
+// Function to run both tests at loss_percent and print the results. Returns true if every message was delivered.
+bool RADIO_sim_test_run(uint8_t loss_percent);
+
+#endif //__RADIO_SIM_TEST_H
@@ -0,0 +1,171 @@
+/**
+ * @file RTC_sim.c
+ * @author Surya Poudel
+ * @brief Host-side model of the RTC2 peripheral used by softTimer
+ *
+ * COUNTER is 24 bits wide. A COMPARE event is generated when COUNTER changes to the
+ * value of CC and an OVRFLW event when it wraps around to 0. Time is advanced from
+ * event to event, so long stretches of virtual time cost nothing.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "RTC_sim.h"
+
+#define RTC_SIM_MAX_CNT 0x00FFFFFF
+#define RTC_SIM_CNT_RANGE (RTC_SIM_MAX_CNT + 1ULL)
+
+void RTC2_IRQHandler(void);
+void softTimer_sim_reset(void);
+
+static struct
+{
+    uint32_t counter;
+    uint32_t cc;
+    bool started;
+    bool compare_event;
+    bool overflow_event;
+    bool irq_disabled;
+    bool in_isr;
+    uint64_t time;
+    RTC_sim_stats_t stats;
+} rtc;
+
+static uint64_t host_time_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*Function to call the interrupt handler as long as an event is pending and interrupts are enabled.
+ */
+static void deliver_irq()
+{
+    while ((rtc.compare_event || rtc.overflow_event) && !rtc.irq_disabled && !rtc.in_isr)
+    {
+        uint64_t start_ns = host_time_ns();
+
+        rtc.in_isr = true;
+        RTC2_IRQHandler();
+        rtc.in_isr = false;
+
+        uint64_t isr_ns = host_time_ns() - start_ns;
+
+        rtc.stats.irqs++;
+        rtc.stats.isr_ns += isr_ns;
+        if (isr_ns > rtc.stats.isr_max_ns)
+            rtc.stats.isr_max_ns = isr_ns;
+    }
+}
+
+void RTC_sim_reset(uint32_t counter)
+{
+    memset(&rtc, 0, sizeof(rtc));
+    rtc.counter = counter & RTC_SIM_MAX_CNT;
+
+    // the overflow count and the running timers of softTimer belong to the old COUNTER
+    softTimer_sim_reset();
+}
+
+void RTC_sim_advance(uint64_t ticks)
+{
+    while (ticks)
+    {
+        uint64_t step = ticks;
+
+        if (rtc.started)
+        {
+            uint64_t to_compare = (rtc.cc - rtc.counter) & RTC_SIM_MAX_CNT;
+            uint64_t to_overflow = RTC_SIM_CNT_RANGE - rtc.counter;
+
+            if (to_compare == 0)
+                to_compare = RTC_SIM_CNT_RANGE;
+            if (to_compare < step)
+                step = to_compare;
+            if (to_overflow < step)
+                step = to_overflow;
+
+            rtc.counter = (rtc.counter + step) & RTC_SIM_MAX_CNT;
+
+            if (rtc.counter == 0)
+            {
+                rtc.overflow_event = true;
+                rtc.stats.overflow_events++;
+            }
+            if (rtc.counter == rtc.cc)
+            {
+                rtc.compare_event = true;
+                rtc.stats.compare_events++;
+            }
+        }
+
+        rtc.time += step;
+        ticks -= step;
+
+        deliver_irq();
+    }
+}
+
+uint64_t RTC_sim_time()
+{
+    return rtc.time;
+}
+
+void RTC_sim_get_stats(RTC_sim_stats_t *stats)
+{
+    *stats = rtc.stats;
+}
+
+uint32_t RTC_sim_counter()
+{
+    return rtc.counter;
+}
+
+void RTC_sim_set_cc(uint32_t value)
+{
+    rtc.cc = value & RTC_SIM_MAX_CNT;
+}
+
+void RTC_sim_start()
+{
+    rtc.started = true;
+}
+
+bool RTC_sim_compare_event()
+{
+    return rtc.compare_event;
+}
+
+void RTC_sim_clear_compare_event()
+{
+    rtc.compare_event = false;
+}
+
+bool RTC_sim_overflow_event()
+{
+    return rtc.overflow_event;
+}
+
+void RTC_sim_clear_overflow_event()
+{
+    rtc.overflow_event = false;
+}
+
+uint32_t RTC_sim_irq_disable()
+{
+    uint32_t state = rtc.irq_disabled;
+
+    rtc.irq_disabled = true;
+    return state;
+}
+
+void RTC_sim_irq_restore(uint32_t state)
+{
+    rtc.irq_disabled = state;
+
+    // interrupts which occurred while disabled are taken now
+    deliver_irq();
+}
@@ -0,0 +1,53 @@
+/**
+ * @file RTC_sim.h
+ * @author Surya Poudel
+ * @brief Host-side model of the RTC2 peripheral used by softTimer
+ *
+ * The model sits beneath the RTC access functions of softTimer_rtc.h when softTimer is
+ * compiled with SOFT_TIMER_HOST_SIM defined, so that the timer module can run on a PC.
+ * Virtual time only advances through RTC_sim_advance(). COMPARE and OVRFLW interrupts
+ * are delivered by calling RTC2_IRQHandler() at the tick they occur, unless interrupts
+ * are disabled, in which case they are delivered when interrupts are enabled again.
+ */
+#ifndef __RTC_SIM_H
+#define __RTC_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct
+{
+    uint32_t irqs;            // Calls of RTC2_IRQHandler()
+    uint32_t compare_events;  // COMPARE[1] events
+    uint32_t overflow_events; // OVRFLW events
+    uint64_t isr_ns;          // Host time spent in RTC2_IRQHandler()
+    uint64_t isr_max_ns;      // Longest single call of RTC2_IRQHandler()
+} RTC_sim_stats_t;
+
+// Function to reset the simulated RTC. COUNTER starts at counter, e.g. just below the overflow to test wrap-around.
+// softTimer is reset with it: running timers are stopped and softTimer_init() starts the RTC again.
+void RTC_sim_reset(uint32_t counter);
+
+// Function to advance the virtual time, delivering the interrupts which occur on the way
+void RTC_sim_advance(uint64_t ticks);
+
+// Function to get the number of ticks the virtual time has advanced since the last reset
+uint64_t RTC_sim_time();
+
+// Function to read the interrupt statistics
+void RTC_sim_get_stats(RTC_sim_stats_t *stats);
+
+// Register level access used by softTimer_rtc.h
+uint32_t RTC_sim_counter();
+void RTC_sim_set_cc(uint32_t value);
+void RTC_sim_start();
+bool RTC_sim_compare_event();
+void RTC_sim_clear_compare_event();
+bool RTC_sim_overflow_event();
+void RTC_sim_clear_overflow_event();
+
+// Interrupt masking used by the softTimer critical sections
+uint32_t RTC_sim_irq_disable();
+void RTC_sim_irq_restore(uint32_t state);
+
+#endif
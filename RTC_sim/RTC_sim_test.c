@@ -0,0 +1,276 @@
+/**
+ * @file RTC_sim_test.c
+ * @author Surya Poudel
+ * @brief Deterministic tests of softTimer against the simulated RTC
+ *
+ * Every test starts from RTC_sim_reset(), which also resets softTimer, and checks the virtual
+ * time of each handler call. A timer must never expire early. It may expire late by up to
+ * RTC_CC_OFFSET_MIN ticks, the minimum distance of a COMPARE event from the COUNTER.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "softTimer.h"
+#include "RTC_sim.h"
+#include "RTC_sim_test.h"
+
+#define TEST_RTC_MAX_CNT 0x00FFFFFF // Maximum count of the 24 bit COUNTER
+#define TEST_MAX_LATENESS 3         // RTC_CC_OFFSET_MIN of softTimer.c
+#define TEST_TIMER_CNT 3
+
+#define TEST_CHECK(cond)                                                         \
+    do                                                                           \
+    {                                                                            \
+        if (!(cond))                                                             \
+        {                                                                        \
+            printf("\tline %d: check failed: %s\n", __LINE__, #cond);           \
+            passed = false;                                                      \
+        }                                                                        \
+    } while (0)
+
+static softTimer_node_t test_timers[TEST_TIMER_CNT];
+static uint32_t calls[TEST_TIMER_CNT];     // Handler calls of each timer
+static uint64_t call_time[TEST_TIMER_CNT]; // Virtual time of the last handler call of each timer
+static uint32_t call_irq[TEST_TIMER_CNT];  // Interrupt of the last handler call of each timer
+static bool stop_other;                    // Handler stops the other timers
+static uint32_t stop_self_after;           // Handler stops its own timer after this many calls, 0 to keep it running
+
+/*Timeout handler of the test timers. context is the index of the timer.
+ */
+static void test_handler(void *context)
+{
+    uint32_t id = (uint32_t)(uintptr_t)context;
+
+    calls[id]++;
+    call_time[id] = RTC_sim_time();
+
+    RTC_sim_stats_t stats;
+    RTC_sim_get_stats(&stats);
+    call_irq[id] = stats.irqs;
+
+    if (stop_other)
+    {
+        for (uint32_t i = 0; i < TEST_TIMER_CNT; i++)
+        {
+            if (i != id)
+                softTimer_stop(&test_timers[i]);
+        }
+    }
+
+    if (stop_self_after && calls[id] == stop_self_after)
+        softTimer_stop(&test_timers[id]);
+}
+
+/*Function to start a test from a fresh RTC with COUNTER at counter.
+ */
+static void test_begin(uint32_t counter, soft_timer_mode_t mode)
+{
+    RTC_sim_reset(counter);
+    softTimer_init();
+
+    for (uint32_t i = 0; i < TEST_TIMER_CNT; i++)
+    {
+        softTimer_create(&test_timers[i], test_handler, mode, (void *)(uintptr_t)i);
+        calls[i] = 0;
+        call_time[i] = 0;
+    }
+
+    stop_other = false;
+    stop_self_after = 0;
+}
+
+/*Function to check that a timer expired once within TEST_MAX_LATENESS after its deadline.
+ */
+static bool test_expired_at(uint32_t id, uint64_t deadline)
+{
+    return calls[id] == 1 && call_time[id] >= deadline && call_time[id] <= deadline + TEST_MAX_LATENESS;
+}
+
+/* Function to test timers expiring across the overflow of the COUNTER.
+ * The 64 bit tick count must keep counting and repeated timers must keep their period.
+ */
+bool RTC_sim_test_wrap_around()
+{
+    bool passed = true;
+
+    test_begin(TEST_RTC_MAX_CNT - 99, SOFT_TIMER_MODE_SINGLE_SHOT);
+    softTimer_create(&test_timers[1], test_handler, SOFT_TIMER_MODE_REPEATED, (void *)1);
+
+    uint32_t start_ticks = softTimer_get_ticks();
+
+    softTimer_start(&test_timers[0], 200);
+    softTimer_start(&test_timers[1], 30);
+
+    // the overflow is at tick 100, the single shot timer expires on the other side of it
+    RTC_sim_advance(199);
+    TEST_CHECK(calls[0] == 0);
+    TEST_CHECK(calls[1] == 6);
+
+    RTC_sim_advance(1);
+    TEST_CHECK(test_expired_at(0, 200));
+    TEST_CHECK(softTimer_now() == TEST_RTC_MAX_CNT + 1 + 100);
+    TEST_CHECK(softTimer_ticks_elapsed(start_ticks) == 200);
+
+    RTC_sim_advance(100);
+    TEST_CHECK(calls[1] == 10);
+    TEST_CHECK(call_time[1] == 300);
+
+    // a deadline just after the overflow, set while COUNTER is at its maximum
+    test_begin(TEST_RTC_MAX_CNT, SOFT_TIMER_MODE_SINGLE_SHOT);
+    softTimer_start(&test_timers[0], TEST_MAX_LATENESS + 1);
+    RTC_sim_advance(100);
+    TEST_CHECK(test_expired_at(0, TEST_MAX_LATENESS + 1));
+    TEST_CHECK(softTimer_now() == TEST_RTC_MAX_CNT + 100);
+
+    return passed;
+}
+
+/* Function to test the reset of the simulation with timers running.
+ * A timer running before the reset must not expire afterwards and can be started again.
+ */
+bool RTC_sim_test_reset()
+{
+    bool passed = true;
+
+    test_begin(TEST_RTC_MAX_CNT - 10, SOFT_TIMER_MODE_REPEATED);
+    softTimer_start(&test_timers[0], 5);
+    softTimer_start(&test_timers[1], 1000);
+    RTC_sim_advance(50);
+    TEST_CHECK(calls[0] == 10);
+    TEST_CHECK(softTimer_now() == TEST_RTC_MAX_CNT + 40);
+
+    RTC_sim_reset(0);
+    calls[0] = 0;
+    TEST_CHECK(softTimer_now() == 0);
+    TEST_CHECK(!softTimer_next_deadline(&(uint64_t){0}));
+
+    RTC_sim_advance(2000);
+    TEST_CHECK(calls[0] == 0);
+    TEST_CHECK(calls[1] == 0);
+    TEST_CHECK(softTimer_now() == 0); // the RTC is stopped until softTimer_init()
+
+    softTimer_init();
+    softTimer_start(&test_timers[0], 5);
+    RTC_sim_advance(50);
+    TEST_CHECK(calls[0] == 10);
+    TEST_CHECK(call_time[0] == 2050);
+    TEST_CHECK(softTimer_now() == 50);
+
+    return passed;
+}
+
+/* Function to test timers stopped from a timeout handler.
+ * Of two timers expiring in the same tick only the first one is called if its handler stops the other,
+ * both with the handler called from the interrupt and from softTimer_process().
+ */
+bool RTC_sim_test_stop_in_handler()
+{
+    bool passed = true;
+
+    test_begin(0, SOFT_TIMER_MODE_SINGLE_SHOT);
+    stop_other = true;
+    softTimer_start(&test_timers[0], 100);
+    softTimer_start(&test_timers[1], 100);
+    RTC_sim_advance(200);
+    TEST_CHECK(calls[0] + calls[1] == 1);
+
+    // deferred handlers are queued together, the second one is dropped when its timer is stopped
+    test_begin(0, SOFT_TIMER_MODE_REPEATED);
+    stop_other = true;
+    softTimer_set_dispatch(&test_timers[0], SOFT_TIMER_DISPATCH_DEFERRED);
+    softTimer_set_dispatch(&test_timers[1], SOFT_TIMER_DISPATCH_DEFERRED);
+    softTimer_start(&test_timers[0], 100);
+    softTimer_start(&test_timers[1], 100);
+    RTC_sim_advance(100);
+    TEST_CHECK(softTimer_work_pending());
+    softTimer_process();
+    TEST_CHECK(calls[0] + calls[1] == 1);
+    TEST_CHECK(!softTimer_work_pending());
+
+    // the other repeated timer keeps running
+    RTC_sim_advance(100);
+    softTimer_process();
+    TEST_CHECK(calls[0] + calls[1] == 2);
+    TEST_CHECK(calls[0] == 2 || calls[1] == 2);
+
+    // a repeated timer stopping itself
+    test_begin(0, SOFT_TIMER_MODE_REPEATED);
+    stop_self_after = 3;
+    softTimer_start(&test_timers[0], 10);
+    RTC_sim_advance(100);
+    TEST_CHECK(calls[0] == 3);
+    TEST_CHECK(call_time[0] == 30);
+    TEST_CHECK(!softTimer_next_deadline(&(uint64_t){0}));
+
+    return passed;
+}
+
+/* Function to test timers expiring back to back.
+ * Timers on consecutive ticks may be delayed by the minimum COMPARE distance but none is lost or early.
+ * Timers on the same tick are handled in one interrupt and a repeated timer at the minimum distance never slips.
+ */
+bool RTC_sim_test_back_to_back()
+{
+    bool passed = true;
+
+    test_begin(0, SOFT_TIMER_MODE_SINGLE_SHOT);
+    softTimer_start(&test_timers[0], 100);
+    softTimer_start(&test_timers[1], 101);
+    softTimer_start(&test_timers[2], 102);
+    RTC_sim_advance(200);
+    TEST_CHECK(test_expired_at(0, 100));
+    TEST_CHECK(test_expired_at(1, 101));
+    TEST_CHECK(test_expired_at(2, 102));
+
+    test_begin(0, SOFT_TIMER_MODE_SINGLE_SHOT);
+    softTimer_start(&test_timers[0], 100);
+    softTimer_start(&test_timers[1], 100);
+    softTimer_start(&test_timers[2], 100);
+    RTC_sim_advance(200);
+    TEST_CHECK(calls[0] == 1 && calls[1] == 1 && calls[2] == 1);
+    TEST_CHECK(call_time[0] == 100 && call_time[1] == 100 && call_time[2] == 100);
+    TEST_CHECK(call_irq[0] == call_irq[1] && call_irq[1] == call_irq[2]);
+
+    test_begin(0, SOFT_TIMER_MODE_REPEATED);
+    softTimer_start(&test_timers[0], TEST_MAX_LATENESS);
+    RTC_sim_advance(300 * TEST_MAX_LATENESS);
+    TEST_CHECK(calls[0] == 300);
+    TEST_CHECK(call_time[0] == 300 * TEST_MAX_LATENESS);
+    softTimer_stop(&test_timers[0]);
+
+    return passed;
+}
+
+/* Function to run all tests and print the results.
+ */
+bool RTC_sim_test_run()
+{
+    static const struct
+    {
+        const char *name;
+        bool (*run)();
+    } tests[] = {
+        {"wrap-around", RTC_sim_test_wrap_around},
+        {"reset", RTC_sim_test_reset},
+        {"stop in handler", RTC_sim_test_stop_in_handler},
+        {"back to back", RTC_sim_test_back_to_back},
+    };
+    bool passed = true;
+
+    for (uint32_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        bool test_passed = tests[i].run();
+
+        printf("RTC_sim test %s: %s\n", tests[i].name, test_passed ? "passed" : "FAILED");
+        passed &= test_passed;
+    }
+
+    return passed;
+}
+
+#if defined(RTC_SIM_TEST_MAIN)
+int main()
+{
+    return RTC_sim_test_run() ? 0 : 1;
+}
+#endif
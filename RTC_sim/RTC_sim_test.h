@@ -0,0 +1,34 @@
+/**
+ * @file RTC_sim_test.h
+ * @author Surya Poudel
+ * @brief Deterministic tests of softTimer against the simulated RTC
+ *
+ * The tests run in virtual time, so every run gives the same result. Build on the host with
+ * SOFT_TIMER_HOST_SIM defined, once with and once without SOFT_TIMER_WHEEL, e.g.
+ *
+ *   gcc -std=gnu99 -DSOFT_TIMER_HOST_SIM -DRTC_SIM_TEST_MAIN -IsoftTimer -IRTC_sim -Idebug_log
+ *       RTC_sim/RTC_sim_test.c RTC_sim/RTC_sim.c softTimer/softTimer.c
+ *
+ * RTC_SIM_TEST_MAIN adds a main() which runs all tests and returns 0 if they pass.
+ */
+#ifndef __RTC_SIM_TEST_H
+#define __RTC_SIM_TEST_H
+
+#include <stdbool.h>
+
+// Function to test timers expiring across the overflow of the 24 bit COUNTER
+bool RTC_sim_test_wrap_around();
+
+// Function to test that RTC_sim_reset() stops the running timers and restarts the tick count
+bool RTC_sim_test_reset();
+
+// Function to test timers stopped from a timeout handler, including a timer stopping itself
+bool RTC_sim_test_stop_in_handler();
+
+// Function to test timers expiring on consecutive ticks and in the same tick
+bool RTC_sim_test_back_to_back();
+
+// Function to run all tests and print the results. Returns true if all tests pass.
+bool RTC_sim_test_run();
+
+#endif //__RTC_SIM_TEST_H
@@ -1,3 +1,11 @@
+#include <string.h>
+#if defined(SD_HOST_SIM)
+// Host build: the SPI bus and chip select are routed to the simulated card in SD_sim.c
+#include "SD_sim.h"
+#include "SD_driver.h"
+#include "debug_log.h"
+#include "softTimer.h"
+#else
 #include "nrf_drv_spi.h"
 #include "app_util_platform.h"
 #include "nrf_gpio.h"
@@ -6,11 +14,13 @@
 #include "nrf.h"
 #include "debug_log.h"
 #include "task/task.h"
+#include "softTimer.h"
 
 #define CS_PIN NRF_GPIO_PIN_MAP(0, 2)
 #define MOSI_PIN NRF_GPIO_PIN_MAP(1, 13)
 #define MISO_PIN NRF_GPIO_PIN_MAP(1, 10)
 #define SCK_PIN NRF_GPIO_PIN_MAP(1, 15)
+#endif
 
 #define CMD0 0
 #define CMD0_ARG 0x00000000
@@ -26,6 +36,16 @@
 #define CMD9_ARG 0x00000000
 #define CMD9_CRC 0x00
 
+// SD_STATUS (R2 response followed by a 64-byte data block)
+#define ACMD13 13
+#define ACMD13_ARG 0x00000000
+#define ACMD13_CRC 0x00
+
+// SEND_SCR
+#define ACMD51 51
+#define ACMD51_ARG 0x00000000
+#define ACMD51_CRC 0x00
+
 // Read OCR
 #define CMD58 58
 #define CMD58_ARG 0x00000000
@@ -42,12 +62,12 @@
 // Read Single Block
 #define CMD17 17
 #define CMD17_CRC 0x95
-#define SD_MAX_READ_ATTEMPTS 4500
+#define SD_READ_TIMEOUT MS_TO_TICKS(100) // Maximum time to wait for the data start token
 
 // Write Single Block
 #define CMD24 24
 #define CMD24_CRC 0x00
-#define SD_MAX_WRITE_ATTEMPTS 3907
+#define SD_WRITE_TIMEOUT MS_TO_TICKS(250) // Maximum time to wait for the data response and for the card to leave busy state
 
 // Read Multiple Block
 #define CMD18 18
@@ -57,6 +77,7 @@
 #define CMD12 12
 #define CMD12_ARG 0x00000000
 #define CMD12_CRC 0x00
+#define SD_STOP_TIMEOUT MS_TO_TICKS(250) // Maximum time to wait for the card to leave busy state after CMD12
 
 // Write Multiple Block
 #define CMD25 25
@@ -98,6 +119,18 @@
 #define SD_START_TOKEN 0xFE
 #define SD_BLOCK_LEN 512
 
+#define SD_CSD_LEN 16
+#define SD_SCR_LEN 8
+#define SD_STATUS_LEN 64
+
+#define SD_INIT_CLOCK_HZ 250000  // Card identification must run at 400 kHz or less
+#define SD_MAX_CLOCK_HZ 8000000  // Fastest clock of the SPI master
+
+#if defined(SD_HOST_SIM)
+#define CS_DISABLE() SD_sim_cs(false)
+#define CS_ENABLE() SD_sim_cs(true)
+#define SPI_set_clock(hz) SD_sim_set_clock(hz)
+#else
 #define SPI_INSTANCE 1                                               /**< SPI instance index. */
 static const nrf_drv_spi_t spi = NRF_DRV_SPI_INSTANCE(SPI_INSTANCE); /**< SPI instance. */
 
@@ -105,7 +138,40 @@ static const nrf_drv_spi_t spi = NRF_DRV_SPI_INSTANCE(SPI_INSTANCE); /**< SPI in
 #define CS_ENABLE() nrf_gpio_pin_clear(CS_PIN)
 
 volatile bool spi_xfer_done = false;
+#endif
+
+static sd_stats_t sd_stats;
+static sd_card_info_t sd_card_info;
 
+// Timeouts are measured in RTC ticks so that they do not depend on the SPI clock frequency.
+static inline bool SD_timeout(uint32_t start_ticks, uint32_t timeout_ticks)
+{
+    return softTimer_ticks_elapsed(start_ticks) >= timeout_ticks;
+}
+
+static void SD_recordLatency(sd_latency_t type, uint32_t start_ticks)
+{
+    uint32_t ticks = softTimer_ticks_elapsed(start_ticks);
+    sd_latency_stats_t *p_lat = &sd_stats.latency[type];
+    uint8_t bin = 0;
+
+    // log2 histogram
+    while ((ticks >> (bin + 1)) && (bin < SD_STATS_HIST_BINS - 1))
+        bin++;
+
+    p_lat->hist[bin]++;
+    p_lat->count++;
+    p_lat->total_ticks += ticks;
+    if (ticks > p_lat->max_ticks)
+        p_lat->max_ticks = ticks;
+}
+
+#if defined(SD_HOST_SIM)
+uint8_t SPI_transfer(uint8_t tx_Byte)
+{
+    return SD_sim_transfer(tx_Byte);
+}
+#else
 void spi_event_handler(nrf_drv_spi_evt_t const *p_event,
                        void *p_context)
 {
@@ -124,6 +190,47 @@ uint8_t SPI_transfer(uint8_t tx_Byte)
     return rx_Byte;
 }
 
+/* Function to (re)initialize the SPI master with the given clock.
+ * Picks the fastest frequency supported by the SPI master that does not exceed clock_hz.
+ */
+static uint32_t SPI_set_clock(uint32_t clock_hz)
+{
+    static const struct
+    {
+        uint32_t hz;
+        nrf_drv_spi_frequency_t frequency;
+    } spi_clocks[] = {
+        {8000000, NRF_DRV_SPI_FREQ_8M}, {4000000, NRF_DRV_SPI_FREQ_4M}, {2000000, NRF_DRV_SPI_FREQ_2M},
+        {1000000, NRF_DRV_SPI_FREQ_1M}, {500000, NRF_DRV_SPI_FREQ_500K}, {250000, NRF_DRV_SPI_FREQ_250K},
+        {125000, NRF_DRV_SPI_FREQ_125K}};
+    static bool spi_initialized = false;
+    uint8_t index = 0;
+
+    while ((index < sizeof(spi_clocks) / sizeof(spi_clocks[0]) - 1) && (spi_clocks[index].hz > clock_hz))
+        index++;
+
+    nrf_drv_spi_config_t spi_config = NRF_DRV_SPI_DEFAULT_CONFIG;
+    spi_config.ss_pin = (uint8_t)NRF_SPI_PIN_NOT_CONNECTED;
+    spi_config.miso_pin = MISO_PIN;
+    spi_config.mosi_pin = MOSI_PIN;
+    spi_config.sck_pin = SCK_PIN;
+    spi_config.frequency = spi_clocks[index].frequency;
+
+    if (spi_initialized)
+        nrf_drv_spi_uninit(&spi);
+    APP_ERROR_CHECK(nrf_drv_spi_init(&spi, &spi_config, spi_event_handler, NULL));
+    spi_initialized = true;
+
+    return spi_clocks[index].hz;
+}
+#endif
+
+// Convert a sector number into the argument of a data command (SDSC cards are byte addressed)
+static inline uint32_t SD_cardAddress(uint32_t sector)
+{
+    return sd_card_info.block_addressing ? sector : sector * SD_BLOCK_LEN;
+}
+
 void SD_powerUpSeq()
 {
     // make sure card is deselected
@@ -429,10 +536,10 @@ void SD_printDataErrToken(uint8_t token)
     }
 }
 */
-uint8_t SD_read_start(uint8_t *buf, uint16_t read_len, uint8_t *token)
+uint8_t SD_read_start(uint8_t *buf, uint16_t read_len, uint8_t *token, bool r2_response)
 {
     uint8_t res1, read;
-    uint16_t readAttempts;
+    uint32_t start_ticks;
 
     // read R1
     res1 = SD_readRes1();
@@ -440,19 +547,21 @@ uint8_t SD_read_start(uint8_t *buf, uint16_t read_len, uint8_t *token)
     // if response received from card
     if (res1 == SD_READY)
     {
-        // wait for a response token (timeout = 100ms)
-        readAttempts = 0;
+        // the second byte of a R2 response is not a token
+        if (r2_response)
+            SPI_transfer(0xFF);
 
-        while ((read = SPI_transfer(0xFF)) != 0xFE)
-        {
+        // wait for a response token (timeout = 100ms), the start token or a data error token ends the wait
+        start_ticks = softTimer_get_ticks();
 
-            if (readAttempts == SD_MAX_READ_ATTEMPTS)
+        while ((read = SPI_transfer(0xFF)) == 0xFF)
+        {
+            if (SD_timeout(start_ticks, SD_READ_TIMEOUT))
                 break;
-            readAttempts++;
         }
 
         // if response token is 0xFE
-        if (read == 0xFE)
+        if (read == SD_START_TOKEN)
         {
             // read 512 byte block
             for (uint16_t i = 0; i < read_len; i++)
@@ -470,18 +579,25 @@ uint8_t SD_read_start(uint8_t *buf, uint16_t read_len, uint8_t *token)
     return res1;
 }
 
-uint8_t SD_readCSD(uint8_t *CSD)
+/* Function to read a register that is returned as a data block (CSD, SCR, SD Status).
+ * App commands are preceded by CMD55.
+ */
+static uint8_t SD_readRegister(uint8_t cmd, bool app_cmd, uint8_t *buf, uint16_t len)
 {
     uint8_t token, res1;
+
+    if (app_cmd && SD_sendApp() > 1)
+        return SD_READ_ERROR;
+
     // assert chip select
     SPI_transfer(0xFF);
     CS_ENABLE();
     SPI_transfer(0xFF);
 
-    // send CMD0
-    SD_command(CMD9, CMD9_ARG, CMD9_CRC);
+    // send command
+    SD_command(cmd, 0x00000000, 0x00);
 
-    res1 = SD_read_start(CSD, 16, &token);
+    res1 = SD_read_start(buf, len, &token, app_cmd && cmd == ACMD13);
 
     // deassert chip select
     SPI_transfer(0xFF);
@@ -490,15 +606,15 @@ uint8_t SD_readCSD(uint8_t *CSD)
 
     if (res1 == SD_READY)
     {
-        // if error token received
-        if (!(token & 0xF0))
+        if (token == 0xFF)
         {
-            // SD_printDataErrToken(token);
+            debug_log_print("Read Timeout\r\n");
             return SD_READ_ERROR;
         }
-        else if (token == 0xFF)
+        // any other token than the start token is a data error token
+        else if (token != SD_START_TOKEN)
         {
-            debug_log_print("Read Timeout\r\n");
+            // SD_printDataErrToken(token);
             return SD_READ_ERROR;
         }
         return SD_READ_SUCCESS;
@@ -510,17 +626,99 @@ uint8_t SD_readCSD(uint8_t *CSD)
     }
 }
 
+uint8_t SD_readCSD(uint8_t *CSD)
+{
+    return SD_readRegister(CMD9, false, CSD, SD_CSD_LEN);
+}
+
+// Decode the TRAN_SPEED field of the CSD into Hz
+static uint32_t SD_tranSpeedHz(uint8_t tran_speed)
+{
+    static const uint8_t time_value_x10[16] = {0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80};
+    uint32_t unit_hz = 100000;
+
+    for (uint8_t unit = 0; unit < (tran_speed & 0x07) && unit < 3; unit++)
+        unit_hz *= 10;
+
+    return unit_hz / 10 * time_value_x10[(tran_speed >> 3) & 0x0F];
+}
+
+static void SD_parseCSD(const uint8_t *csd)
+{
+    sd_card_info.max_clock_hz = SD_tranSpeedHz(csd[3]);
+
+    if ((csd[0] >> 6) == 1)
+    {
+        // CSD version 2.0: capacity = (C_SIZE + 1) * 512 KB
+        uint32_t c_size = ((uint32_t)(csd[7] & 0x3F) << 16) | ((uint32_t)csd[8] << 8) | csd[9];
+        sd_card_info.sector_cnt = (c_size + 1) * 1024;
+    }
+    else
+    {
+        // CSD version 1.0: capacity = (C_SIZE + 1) * 2^(C_SIZE_MULT + 2) * 2^READ_BL_LEN
+        uint32_t c_size = ((uint32_t)(csd[6] & 0x03) << 10) | ((uint32_t)csd[7] << 2) | (csd[8] >> 6);
+        uint8_t c_size_mult = ((csd[9] & 0x03) << 1) | (csd[10] >> 7);
+        uint8_t read_bl_len = csd[5] & 0x0F;
+        // computed in 64 bits, 4 GB SDSC cards (READ_BL_LEN = 11) overflow 32 bits
+        sd_card_info.sector_cnt = (uint32_t)(((uint64_t)(c_size + 1) << (c_size_mult + 2 + read_bl_len)) / SD_BLOCK_LEN);
+    }
+
+    // ERASE_BLK_EN = 1 allows erasing single blocks, otherwise SECTOR_SIZE + 1 blocks
+    if (csd[10] & 0x40)
+        sd_card_info.erase_sectors = 1;
+    else
+        sd_card_info.erase_sectors = (((csd[10] & 0x3F) << 1) | (csd[11] >> 7)) + 1;
+}
+
+// Decode the AU_SIZE field of the SD Status into sectors
+static uint32_t SD_auSectors(uint8_t au_size)
+{
+    static const uint32_t au_sectors_large[6] = {16384, 24576, 32768, 49152, 65536, 131072}; // 8, 12, 16, 24, 32, 64 MB
+
+    if (au_size == 0)
+        return 0;
+    if (au_size <= 9)
+        return 32UL << (au_size - 1); // 16 KB .. 4 MB
+    return au_sectors_large[au_size - 10];
+}
+
+/* Function to discover the card capabilities from CSD, SCR and SD Status
+ * and switch the SPI clock to the fastest rate supported by both sides.
+ */
+static void SD_discoverCard()
+{
+    uint8_t buf[SD_STATUS_LEN];
+
+    if (SD_readRegister(CMD9, false, buf, SD_CSD_LEN) == SD_READ_SUCCESS)
+        SD_parseCSD(buf);
+
+    if (SD_readRegister(ACMD51, true, buf, SD_SCR_LEN) == SD_READ_SUCCESS)
+        sd_card_info.sd_spec = buf[0] & 0x0F;
+
+    if (SD_readRegister(ACMD13, true, buf, SD_STATUS_LEN) == SD_READ_SUCCESS)
+        sd_card_info.au_sectors = SD_auSectors(buf[10] >> 4);
+
+    uint32_t clock_hz = SD_MAX_CLOCK_HZ;
+    if (sd_card_info.max_clock_hz && sd_card_info.max_clock_hz < clock_hz)
+        clock_hz = sd_card_info.max_clock_hz;
+    sd_card_info.spi_clock_hz = SPI_set_clock(clock_hz);
+}
+
+void SD_getCardInfo(sd_card_info_t *info)
+{
+    *info = sd_card_info;
+}
+
 uint8_t SD_init()
 {
-    // uint8_t csd_reg[16];
-    nrf_drv_spi_config_t spi_config = NRF_DRV_SPI_DEFAULT_CONFIG;
-    spi_config.ss_pin = (uint8_t)NRF_SPI_PIN_NOT_CONNECTED;
-    spi_config.miso_pin = MISO_PIN;
-    spi_config.mosi_pin = MOSI_PIN;
-    spi_config.sck_pin = SCK_PIN;
-    APP_ERROR_CHECK(nrf_drv_spi_init(&spi, &spi_config, spi_event_handler, NULL));
+    // the timeouts are measured on the RTC of softTimer, make sure it is counting
+    softTimer_init();
 
+    memset(&sd_card_info, 0, sizeof(sd_card_info));
+    sd_card_info.spi_clock_hz = SPI_set_clock(SD_INIT_CLOCK_HZ);
+#if !defined(SD_HOST_SIM)
     nrf_gpio_cfg_output(CS_PIN);
+#endif
 
     uint8_t res[5], cmdAttempts = 0;
 
@@ -530,15 +728,15 @@ uint8_t SD_init()
     while ((res[0] = SD_goIdleState()) != 0x01)
     {
         cmdAttempts++;
+        sd_stats.retries++;
         if (cmdAttempts > 50)
         {
             if (res[0] == 0)
             {
                 debug_log_print("Card Not Found!\r\n");
             }
-            else
-                // SD_printR1(res[0]);
-                return SD_INIT_ERROR;
+            // SD_printR1(res[0]);
+            return SD_INIT_ERROR;
         }
     }
 
@@ -577,6 +775,9 @@ uint8_t SD_init()
         taskSleepMS(10);
 
         cmdAttempts++;
+        // polling while the card is still initializing (idle) is not a retry, an error response is
+        if (res[0] > 0x01)
+            sd_stats.retries++;
     } while (res[0] != SD_READY);
 
     // read OCR
@@ -589,10 +790,24 @@ uint8_t SD_init()
     }
     else
     {
-        if (res[1] & 0x40)
-            ;
-        debug_log_print("Card Type: SDHC\r\n");
+        sd_card_info.ocr = ((uint32_t)res[1] << 24) | ((uint32_t)res[2] << 16) | ((uint32_t)res[3] << 8) | res[4];
+        if (CCS_VAL(res[1]))
+        {
+            sd_card_info.type = SD_CARD_TYPE_SDHC;
+            sd_card_info.block_addressing = true;
+            debug_log_print("Card Type: SDHC\r\n");
+        }
+        else
+        {
+            sd_card_info.type = SD_CARD_TYPE_SDSC;
+            sd_card_info.block_addressing = false;
+            debug_log_print("Card Type: SDSC\r\n");
+        }
     }
+
+    SD_discoverCard();
+    debug_log_print("Card clock: %d kHz, AU: %d sectors\r\n", sd_card_info.spi_clock_hz / 1000, sd_card_info.au_sectors);
+
     return SD_INIT_SUCCESS;
 }
 
@@ -607,9 +822,9 @@ uint8_t SD_readSingleBlock(uint32_t addr, uint8_t *buf, uint8_t *token)
     SPI_transfer(0xFF);
 
     // send CMD17
-    SD_command(CMD17, addr, CMD17_CRC);
+    SD_command(CMD17, SD_cardAddress(addr), CMD17_CRC);
 
-    uint8_t res1 = SD_read_start(buf, SD_BLOCK_LEN, token);
+    uint8_t res1 = SD_read_start(buf, SD_BLOCK_LEN, token, false);
 
     // deassert chip select
     SPI_transfer(0xFF);
@@ -622,33 +837,40 @@ uint8_t SD_readSingleBlock(uint32_t addr, uint8_t *buf, uint8_t *token)
 uint8_t SD_readSector(uint32_t addr, uint8_t *buf)
 {
     uint8_t res1, token;
+    uint32_t start_ticks = softTimer_get_ticks();
 
     res1 = SD_readSingleBlock(addr, buf, &token);
     if (res1 == SD_READY)
     {
-        // if error token received
-        if (!(token & 0xF0))
+        if (token == 0xFF)
         {
-           // SD_printDataErrToken(token);
+            debug_log_print("Read Timeout\r\n");
+            sd_stats.read_timeouts++;
             return SD_READ_ERROR;
         }
-        else if (token == 0xFF)
+        // any other token than the start token is a data error token
+        else if (token != SD_START_TOKEN)
         {
-            debug_log_print("Read Timeout\r\n");
+           // SD_printDataErrToken(token);
+            sd_stats.error_tokens++;
             return SD_READ_ERROR;
         }
+        sd_stats.reads++;
+        SD_recordLatency(SD_LAT_READ_SINGLE, start_ticks);
         return SD_READ_SUCCESS;
     }
     else
     {
         // SD_printR1(res1);
+        sd_stats.r1_errors++;
         return SD_READ_ERROR;
     }
 }
 
 uint8_t _writeSingleBlock(uint32_t addr, uint8_t *buf, uint8_t *token)
 {
-    uint8_t writeAttempts, read, res1;
+    uint8_t read = 0xFF, res1;
+    uint32_t start_ticks;
 
     // set token to none
     *token = 0xFF;
@@ -659,7 +881,7 @@ uint8_t _writeSingleBlock(uint32_t addr, uint8_t *buf, uint8_t *token)
     SPI_transfer(0xFF);
 
     // send CMD24
-    SD_command(CMD24, addr, CMD24_CRC);
+    SD_command(CMD24, SD_cardAddress(addr), CMD24_CRC);
 
     // read response
     res1 = SD_readRes1();
@@ -674,13 +896,12 @@ uint8_t _writeSingleBlock(uint32_t addr, uint8_t *buf, uint8_t *token)
         for (uint16_t i = 0; i < SD_BLOCK_LEN; i++)
             SPI_transfer(buf[i]);
         // wait for a response (timeout = 250ms)
-        writeAttempts = 0;
+        start_ticks = softTimer_get_ticks();
 
-        while (writeAttempts != SD_MAX_WRITE_ATTEMPTS)
+        while (!SD_timeout(start_ticks, SD_WRITE_TIMEOUT))
         {
             if ((read = SPI_transfer(0xFF)) != 0xFF)
                 break;
-            writeAttempts++;
         }
         // if data accepted
         if ((read & 0x1F) == 0x05)
@@ -689,18 +910,31 @@ uint8_t _writeSingleBlock(uint32_t addr, uint8_t *buf, uint8_t *token)
             *token = 0x05;
 
             // wait for write to finish (timeout = 250ms)
-            writeAttempts = 0;
+            start_ticks = softTimer_get_ticks();
             while (SPI_transfer(0xFF) == 0x00)
             {
-                if (writeAttempts == SD_MAX_WRITE_ATTEMPTS)
+                if (SD_timeout(start_ticks, SD_WRITE_TIMEOUT))
                 {
                     *token = 0x00;
                     break;
                 }
-                writeAttempts++;
             }
+
+            if (*token == 0x05)
+            {
+                sd_stats.writes++;
+                SD_recordLatency(SD_LAT_WRITE_BUSY, start_ticks);
+            }
+            else
+                sd_stats.write_timeouts++;
         }
+        else if (read == 0xFF)
+            sd_stats.write_timeouts++;
+        else
+            sd_stats.write_rejects++;
     }
+    else
+        sd_stats.r1_errors++;
     // deassert chip select
     SPI_transfer(0xFF);
     CS_DISABLE();
@@ -739,7 +973,7 @@ uint8_t SD_readMultipleSecStart(uint32_t start_addr)
     SPI_transfer(0xFF);
 
     // send CMD24
-    SD_command(CMD18, start_addr, CMD18_CRC);
+    SD_command(CMD18, SD_cardAddress(start_addr), CMD18_CRC);
 
     // read response
     res1 = SD_readRes1();
@@ -750,21 +984,20 @@ uint8_t SD_readMultipleSecStart(uint32_t start_addr)
 sd_ret_t SD_readMultipleSec(uint8_t *buff)
 {
     uint8_t read = 0xFF;
-    uint32_t readAttempts;
+    uint32_t start_ticks;
+    uint32_t block_start_ticks = softTimer_get_ticks();
 
-    // wait for a response token (timeout = 100ms)
-    readAttempts = 0;
+    // wait for a response token (timeout = 100ms), the start token or a data error token ends the wait
+    start_ticks = softTimer_get_ticks();
 
-    while ((read = SPI_transfer(0xFF)) != 0xFE)
+    while ((read = SPI_transfer(0xFF)) == 0xFF)
     {
-
-        if (readAttempts == SD_MAX_READ_ATTEMPTS)
+        if (SD_timeout(start_ticks, SD_READ_TIMEOUT))
             break;
-        readAttempts++;
     }
 
     // if response token is 0xFE
-    if (read == 0xFE)
+    if (read == SD_START_TOKEN)
     {
         // read 512 byte block
         for (uint16_t i = 0; i < 512; i++)
@@ -775,16 +1008,21 @@ sd_ret_t SD_readMultipleSec(uint8_t *buff)
         SPI_transfer(0xFF);
     }
 
-    if (!(read & 0xF0))
+    if (read == 0xFF)
     {
-       // SD_printDataErrToken(read);
+        debug_log_print("Read Timeout\r\n");
+        sd_stats.read_timeouts++;
         return SD_READ_ERROR;
     }
-    else if (read == 0xFF)
+    // any other token than the start token is a data error token
+    else if (read != SD_START_TOKEN)
     {
-        debug_log_print("Read Timeout\r\n");
+       // SD_printDataErrToken(read);
+        sd_stats.error_tokens++;
         return SD_READ_ERROR;
     }
+    sd_stats.multi_reads++;
+    SD_recordLatency(SD_LAT_READ_MULTI, block_start_ticks);
     return SD_READ_SUCCESS;
 }
 
@@ -792,8 +1030,21 @@ void SD_readMultipleSecStop()
 {
     SD_command(CMD12, CMD12_ARG, CMD12_CRC);
 
+    // skip the stuff byte and read the R1 part of the R1b response
+    SPI_transfer(0xFF);
+    SD_readRes1();
+
+    // wait for the card to leave busy state (timeout = 250ms)
+    uint32_t start_ticks = softTimer_get_ticks();
     while (SPI_transfer(0xFF) == 0x00)
-        ;
+    {
+        if (SD_timeout(start_ticks, SD_STOP_TIMEOUT))
+        {
+            debug_log_print("Stop Timeout\r\n");
+            sd_stats.stop_timeouts++;
+            break;
+        }
+    }
 
     // deassert chip select
     SPI_transfer(0xFF);
@@ -803,7 +1054,9 @@ void SD_readMultipleSecStop()
 
 uint8_t _writeMultipleBlock(uint32_t start_addr, uint8_t blockCnt, uint8_t *token)
 {
-    uint8_t writeAttempts, read, res1;
+    uint8_t read = 0xFF, res1;
+    uint32_t start_ticks;
+    bool write_timeout;
 
     // set token to none
     *token = 0xFF;
@@ -814,7 +1067,7 @@ uint8_t _writeMultipleBlock(uint32_t start_addr, uint8_t blockCnt, uint8_t *toke
     SPI_transfer(0xFF);
 
     // send CMD25
-    SD_command(CMD25, start_addr, CMD25_CRC);
+    SD_command(CMD25, SD_cardAddress(start_addr), CMD25_CRC);
 
     // read response
     res1 = SD_readRes1();
@@ -838,13 +1091,12 @@ uint8_t _writeMultipleBlock(uint32_t start_addr, uint8_t blockCnt, uint8_t *toke
             for (uint16_t i = 0; i < SD_BLOCK_LEN; i++)
                 SPI_transfer(write_buff[i]);
             // wait for a response (timeout = 250ms)
-            writeAttempts = 0;
+            start_ticks = softTimer_get_ticks();
 
-            while (writeAttempts != SD_MAX_WRITE_ATTEMPTS)
+            while (!SD_timeout(start_ticks, SD_WRITE_TIMEOUT))
             {
                 if ((read = SPI_transfer(0xFF)) != 0xFF)
                     break;
-                writeAttempts++;
             }
             // if data accepted
             if ((read & 0x1F) == 0x05)
@@ -853,25 +1105,36 @@ uint8_t _writeMultipleBlock(uint32_t start_addr, uint8_t blockCnt, uint8_t *toke
                 *token = 0x05;
 
                 // wait for write to finish (timeout = 250ms)
-                writeAttempts = 0;
+                write_timeout = false;
+                start_ticks = softTimer_get_ticks();
                 while (SPI_transfer(0xFF) == 0x00)
                 {
-                    if (writeAttempts == SD_MAX_WRITE_ATTEMPTS)
+                    if (SD_timeout(start_ticks, SD_WRITE_TIMEOUT))
                     {
                         *token = 0x00;
+                        write_timeout = true;
                         break;
                     }
-                    writeAttempts++;
                 }
-                if (writeAttempts < SD_MAX_WRITE_ATTEMPTS)
+                if (!write_timeout)
                 {
                     debug_log_print("Block write success!\r\n");
+                    sd_stats.writes++;
+                    SD_recordLatency(SD_LAT_WRITE_BUSY, start_ticks);
                 }
+                else
+                    sd_stats.write_timeouts++;
             }
+            else if (read == 0xFF)
+                sd_stats.write_timeouts++;
+            else
+                sd_stats.write_rejects++;
         }
         // stop writing
         SPI_transfer(0xFD);
     }
+    else
+        sd_stats.r1_errors++;
 
     // deassert chip select
     SPI_transfer(0xFF);
@@ -898,3 +1161,47 @@ uint8_t SD_writeMultipleBlock(uint32_t start_addr, uint8_t blockCnt)
    // SD_printR1(res1);
     return SD_WRITE_ERROR;
 }
+
+void SD_getStats(sd_stats_t *stats)
+{
+    *stats = sd_stats;
+}
+
+void SD_resetStats()
+{
+    memset(&sd_stats, 0, sizeof(sd_stats));
+}
+
+void SD_printStats()
+{
+    static const char *latency_names[SD_LAT_CNT] = {"Single read", "Multi read", "Write busy"};
+
+    debug_log_print("Reads: %lu, Multi reads: %lu, Writes: %lu, Retries: %lu\r\n",
+                    (unsigned long)sd_stats.reads, (unsigned long)sd_stats.multi_reads,
+                    (unsigned long)sd_stats.writes, (unsigned long)sd_stats.retries);
+    debug_log_print("R1 errors: %lu, Error tokens: %lu, Write rejects: %lu\r\n",
+                    (unsigned long)sd_stats.r1_errors, (unsigned long)sd_stats.error_tokens,
+                    (unsigned long)sd_stats.write_rejects);
+    debug_log_print("Timeouts: read %lu, write %lu, stop %lu\r\n",
+                    (unsigned long)sd_stats.read_timeouts, (unsigned long)sd_stats.write_timeouts,
+                    (unsigned long)sd_stats.stop_timeouts);
+
+    for (uint8_t type = 0; type < SD_LAT_CNT; type++)
+    {
+        sd_latency_stats_t *p_lat = &sd_stats.latency[type];
+
+        if (p_lat->count == 0)
+            continue;
+
+        // latencies are reported in microseconds (1 RTC tick = 30.5 us)
+        debug_log_print("%s: n=%lu avg=%luus max=%luus\r\n", latency_names[type], (unsigned long)p_lat->count,
+                        (unsigned long)((uint64_t)p_lat->total_ticks * 1000000 / 32768 / p_lat->count),
+                        (unsigned long)((uint64_t)p_lat->max_ticks * 1000000 / 32768));
+        for (uint8_t bin = 0; bin < SD_STATS_HIST_BINS; bin++)
+        {
+            if (p_lat->hist[bin])
+                debug_log_print("\t>=%luus: %lu\r\n", (unsigned long)((bin ? (1UL << bin) : 0) * 1000000 / 32768),
+                                (unsigned long)p_lat->hist[bin]);
+        }
+    }
+}
@@ -9,8 +9,26 @@ typedef enum{
    SD_READY, SD_INIT_SUCCESS, SD_INIT_ERROR, SD_READ_SUCCESS, SD_READ_ERROR,SD_WRITE_SUCCESS, SD_WRITE_ERROR
 }sd_ret_t;
 
+typedef enum{
+   SD_CARD_TYPE_UNKNOWN, SD_CARD_TYPE_SDSC, SD_CARD_TYPE_SDHC
+}sd_card_type_t;
+
+typedef struct{
+   sd_card_type_t type;
+   bool block_addressing;  // true: command arguments are sector numbers, false: byte addresses
+   uint32_t ocr;
+   uint32_t sector_cnt;    // Card capacity in 512-byte sectors
+   uint32_t max_clock_hz;  // Maximum transfer rate from CSD TRAN_SPEED
+   uint32_t erase_sectors; // Erase block size in sectors
+   uint32_t au_sectors;    // Allocation unit size in sectors from the SD Status, 0 if unknown
+   uint8_t sd_spec;        // SD_SPEC field of the SCR
+   uint32_t spi_clock_hz;  // SPI clock selected by the driver after initialization
+}sd_card_info_t;
+
 uint8_t SD_init();
 
+void SD_getCardInfo(sd_card_info_t *info);
+
 uint8_t SD_readSector(uint32_t SecAddr, uint8_t *buf);
 
 uint8_t SD_writeSector(uint32_t SecAddr, uint8_t* buf);
@@ -21,8 +39,42 @@ sd_ret_t SD_readMultipleSec(uint8_t *buff);
 
 void SD_readMultipleSecStop();
 
-void SD_readMultipleSecStop();
-
 uint8_t SD_writeMultipleBlock(uint32_t start_addr, uint8_t blockCnt);
 
+#define SD_STATS_HIST_BINS 12 // Bin 0 counts latencies of 0 and 1 RTC ticks, bin i [2^i, 2^(i+1)) ticks, the last bin everything above
+
+typedef enum{
+   SD_LAT_READ_SINGLE, // Complete single block read (command to CRC)
+   SD_LAT_READ_MULTI,  // One block within a multiple block read (token wait and data)
+   SD_LAT_WRITE_BUSY,  // Busy period after a block has been accepted by the card
+   SD_LAT_CNT
+}sd_latency_t;
+
+typedef struct{
+   uint32_t count;
+   uint32_t max_ticks;
+   uint32_t total_ticks;
+   uint32_t hist[SD_STATS_HIST_BINS];
+}sd_latency_stats_t;
+
+typedef struct{
+   uint32_t reads;          // Successful single block reads
+   uint32_t multi_reads;    // Successful blocks of multiple block reads
+   uint32_t writes;         // Successfully written blocks
+   uint32_t retries;        // Repeated CMD0 attempts and ACMD41 attempts answered with an error during initialization
+   uint32_t r1_errors;      // Commands answered with an error R1
+   uint32_t read_timeouts;  // No start token within SD_READ_TIMEOUT
+   uint32_t write_timeouts; // No data response or busy longer than SD_WRITE_TIMEOUT
+   uint32_t stop_timeouts;  // Busy longer than SD_STOP_TIMEOUT after CMD12
+   uint32_t error_tokens;   // Data error tokens received instead of the start token
+   uint32_t write_rejects;  // Data response other than "data accepted"
+   sd_latency_stats_t latency[SD_LAT_CNT];
+}sd_stats_t;
+
+void SD_getStats(sd_stats_t *stats);
+
+void SD_resetStats();
+
+void SD_printStats();
+
 #endif
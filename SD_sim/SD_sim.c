@@ -0,0 +1,624 @@
+/**
+ * @file SD_sim.c
+ * @author Surya Poudel
+ * @brief Host-side model of an SD card in SPI mode
+ *
+ * Implements the SPI command state machine used by SD_driver.c:
+ * CMD0/8/9/12/17/18/24/25/55/58 and ACMD13/41/51, data start/stop tokens, data response
+ * tokens and busy signalling. Sector data is backed by an image file.
+ *
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "SD_sim.h"
+#include "softTimer.h"
+#if defined(SOFT_TIMER_HOST_SIM)
+#include "RTC_sim.h"
+#endif
+
+#define SD_SIM_BLOCK_LEN 512
+#define SD_SIM_CSD_LEN 16
+#define SD_SIM_SCR_LEN 8
+#define SD_SIM_STATUS_LEN 64
+#define SD_SIM_STUCK_US 5000000 // Busy time used for SD_SIM_FAULT_WRITE_BUSY_STUCK
+
+#define R1_IDLE 0x01
+#define R1_ILLEGAL_CMD 0x04
+#define R1_ADDR_ERROR 0x20
+
+#define TOKEN_START_BLOCK 0xFE
+#define TOKEN_START_MULTI_WRITE 0xFC
+#define TOKEN_STOP_MULTI_WRITE 0xFD
+#define TOKEN_ERROR_CECC 0x04
+#define TOKEN_ERROR_OOR 0x08
+
+#define DATA_RESP_ACCEPTED 0x05
+#define DATA_RESP_CRC_ERROR 0x0B
+#define DATA_RESP_WRITE_ERROR 0x0D
+
+typedef enum
+{
+    SIM_PHASE_CMD,         // Waiting for / receiving a command frame
+    SIM_PHASE_RESPONSE,    // Clocking out Ncr and the response bytes
+    SIM_PHASE_READ_WAIT,   // Access time before the data token
+    SIM_PHASE_READ_DATA,   // Clocking out token, block and CRC
+    SIM_PHASE_WRITE_TOKEN, // Waiting for the host's start token
+    SIM_PHASE_WRITE_DATA,  // Receiving block and CRC
+    SIM_PHASE_WRITE_RESP   // Data response token
+} sim_phase_t;
+
+typedef struct
+{
+    FILE *image;
+    uint32_t sector_cnt;
+    SD_sim_config_t config;
+
+    bool selected;
+    bool idle;
+    bool app_cmd;
+    uint16_t init_polls;
+
+    sim_phase_t phase;
+    sim_phase_t next_phase; // Phase entered after the response has been clocked out
+    uint8_t cmd_frame[6];
+    uint8_t cmd_len;
+    uint8_t resp[5];
+    uint8_t resp_len;
+    uint8_t resp_index;
+    uint8_t ncr_remaining;
+
+    uint8_t block[SD_SIM_BLOCK_LEN];
+    uint16_t data_index;
+    uint16_t data_len; // SD_SIM_BLOCK_LEN for data blocks, register length for CMD9/ACMD13/ACMD51
+    uint32_t sector;
+    bool multi;
+    uint8_t error_token; // Error token sent instead of the start token, 0 if none
+
+    uint64_t now_ns;
+    uint64_t ready_ns; // Time at which the pending data token may be sent
+    uint64_t busy_until_ns;
+
+    SD_sim_fault_t fault;
+    uint32_t fault_cnt;
+
+    SD_sim_stats_t stats;
+} SD_sim_t;
+
+static SD_sim_t card;
+
+/* Function to convert virtual time into 32768 Hz RTC ticks
+ */
+static uint64_t sim_ticks(uint64_t ns)
+{
+    return ns * 32768 / 1000000000ULL;
+}
+
+/* Function to advance the virtual time. When softTimer runs on the simulated RTC (SOFT_TIMER_HOST_SIM),
+ * the RTC follows the card's virtual time, so that driver timeouts and timers share one clock.
+ */
+static void sim_advance_ns(uint64_t ns)
+{
+#if defined(SOFT_TIMER_HOST_SIM)
+    uint64_t ticks = sim_ticks(card.now_ns);
+
+    card.now_ns += ns;
+    RTC_sim_advance(sim_ticks(card.now_ns) - ticks);
+#else
+    card.now_ns += ns;
+#endif
+}
+
+static inline uint64_t byte_time_ns()
+{
+    return 8000000000ULL / card.config.spi_clock_hz;
+}
+
+static inline bool card_busy()
+{
+    return card.now_ns < card.busy_until_ns;
+}
+
+/* Function to check if the next operation of the given kind has to fail.
+ * Consumes one pending fault if it matches.
+ */
+static bool fault_hit(SD_sim_fault_t fault)
+{
+    if (card.fault != fault || card.fault_cnt == 0)
+        return false;
+
+    card.fault_cnt--;
+    if (card.fault_cnt == 0)
+        card.fault = SD_SIM_FAULT_NONE;
+
+    card.stats.faults_injected++;
+    return true;
+}
+
+static uint32_t arg_to_sector(uint32_t arg)
+{
+    // SDSC cards are byte addressed, SDHC/SDXC cards are block addressed
+    return card.config.sdhc ? arg : arg / SD_SIM_BLOCK_LEN;
+}
+
+static bool load_sector(uint32_t sector)
+{
+    if (sector >= card.sector_cnt)
+        return false;
+
+    fseek(card.image, (long)sector * SD_SIM_BLOCK_LEN, SEEK_SET);
+    return fread(card.block, 1, SD_SIM_BLOCK_LEN, card.image) == SD_SIM_BLOCK_LEN;
+}
+
+static bool store_sector(uint32_t sector)
+{
+    if (sector >= card.sector_cnt)
+        return false;
+
+    fseek(card.image, (long)sector * SD_SIM_BLOCK_LEN, SEEK_SET);
+    return fwrite(card.block, 1, SD_SIM_BLOCK_LEN, card.image) == SD_SIM_BLOCK_LEN;
+}
+
+/* Function to build the CSD register for the image capacity.
+ * SDHC cards use CSD version 2.0, SDSC cards use CSD version 1.0 with 512-byte blocks.
+ */
+static void build_csd(uint8_t *csd)
+{
+    memset(csd, 0, SD_SIM_CSD_LEN);
+
+    csd[1] = 0x0E; // TAAC: 1 ms
+    csd[3] = 0x32; // TRAN_SPEED: 25 MHz
+    csd[4] = 0x5B; // CCC
+    csd[5] = 0x59; // CCC, READ_BL_LEN = 9
+
+    if (card.config.sdhc)
+    {
+        uint32_t c_size = card.sector_cnt / 1024 - 1; // capacity = (C_SIZE + 1) * 512 KB
+
+        csd[0] = 0x40; // CSD_STRUCTURE = 1
+        csd[7] = (c_size >> 16) & 0x3F;
+        csd[8] = (c_size >> 8) & 0xFF;
+        csd[9] = c_size & 0xFF;
+    }
+    else
+    {
+        uint32_t c_size = card.sector_cnt / 512 - 1; // C_SIZE_MULT = 7 -> (C_SIZE + 1) * 512 blocks
+
+        csd[0] = 0x00; // CSD_STRUCTURE = 0
+        csd[6] = (c_size >> 10) & 0x03;
+        csd[7] = (c_size >> 2) & 0xFF;
+        csd[8] = (c_size & 0x03) << 6;
+        csd[9] = 0x03;  // C_SIZE_MULT[2:1]
+        csd[10] = 0x80; // C_SIZE_MULT[0]
+    }
+
+    csd[10] |= 0x7F; // ERASE_BLK_EN = 1, SECTOR_SIZE = 127 (64 KB)
+    csd[11] = 0x80;
+    csd[12] = 0x0A; // R2W_FACTOR, WRITE_BL_LEN = 9
+    csd[13] = 0x40;
+    csd[15] = 0x01;
+}
+
+static void respond(const uint8_t *resp, uint8_t len, sim_phase_t next_phase)
+{
+    memcpy(card.resp, resp, len);
+    card.resp_len = len;
+    card.resp_index = 0;
+    card.ncr_remaining = card.config.ncr_bytes;
+    card.next_phase = next_phase;
+    card.phase = SIM_PHASE_RESPONSE;
+}
+
+// Function to start sending a register (CSD, SCR, SD Status) as a data block
+static void start_register_read(uint16_t len)
+{
+    card.data_len = len;
+    card.data_index = 0;
+    card.error_token = 0;
+    card.multi = false;
+    card.ready_ns = card.now_ns;
+}
+
+static void start_read(uint32_t sector)
+{
+    card.sector = sector;
+    card.data_len = SD_SIM_BLOCK_LEN;
+    card.data_index = 0;
+    card.error_token = 0;
+
+    if (!load_sector(sector))
+        card.error_token = TOKEN_ERROR_OOR;
+    else if (fault_hit(SD_SIM_FAULT_READ_ERROR_TOKEN))
+        card.error_token = TOKEN_ERROR_CECC;
+
+    card.ready_ns = fault_hit(SD_SIM_FAULT_READ_TIMEOUT) ? UINT64_MAX
+                                                          : card.now_ns + (uint64_t)card.config.read_latency_us * 1000;
+}
+
+static void execute_command()
+{
+    uint8_t cmd = card.cmd_frame[0] & 0x3F;
+    uint32_t arg = ((uint32_t)card.cmd_frame[1] << 24) | ((uint32_t)card.cmd_frame[2] << 16) |
+                   ((uint32_t)card.cmd_frame[3] << 8) | card.cmd_frame[4];
+    bool app_cmd = card.app_cmd;
+    uint8_t r1;
+    uint8_t resp[5];
+
+    card.app_cmd = false;
+    card.stats.commands++;
+
+    if (fault_hit(SD_SIM_FAULT_CMD_TIMEOUT))
+    {
+        card.phase = SIM_PHASE_CMD;
+        return;
+    }
+
+    if (app_cmd && cmd == 13)
+    {
+        // ACMD13: R2 followed by the 64-byte SD Status
+        memset(card.block, 0, SD_SIM_STATUS_LEN);
+        card.block[10] = card.config.au_size << 4;
+        start_register_read(SD_SIM_STATUS_LEN);
+        resp[0] = card.idle ? R1_IDLE : 0x00;
+        resp[1] = 0x00;
+        respond(resp, 2, SIM_PHASE_READ_WAIT);
+        return;
+    }
+
+    if (app_cmd && cmd == 51)
+    {
+        // ACMD51: SCR of a physical layer 2.00 card supporting 1 and 4 bit bus widths
+        memset(card.block, 0, SD_SIM_SCR_LEN);
+        card.block[0] = 0x02;
+        card.block[1] = 0x05;
+        start_register_read(SD_SIM_SCR_LEN);
+        resp[0] = card.idle ? R1_IDLE : 0x00;
+        respond(resp, 1, SIM_PHASE_READ_WAIT);
+        return;
+    }
+
+    if (app_cmd && cmd == 41)
+    {
+        // ACMD41: report idle until the configured number of polls has elapsed
+        if (card.init_polls < card.config.init_busy_polls)
+            card.init_polls++;
+        else
+            card.idle = false;
+
+        resp[0] = card.idle ? R1_IDLE : 0x00;
+        respond(resp, 1, SIM_PHASE_CMD);
+        return;
+    }
+
+    r1 = card.idle ? R1_IDLE : 0x00;
+
+    switch (cmd)
+    {
+    case 0:
+        card.idle = true;
+        card.init_polls = 0;
+        card.multi = false;
+        resp[0] = R1_IDLE;
+        respond(resp, 1, SIM_PHASE_CMD);
+        break;
+
+    case 8:
+        resp[0] = r1;
+        resp[1] = 0x00;
+        resp[2] = 0x00;
+        resp[3] = (arg >> 8) & 0x0F; // voltage accepted
+        resp[4] = arg & 0xFF;        // check pattern echo
+        respond(resp, 5, SIM_PHASE_CMD);
+        break;
+
+    case 9:
+        build_csd(card.block);
+        start_register_read(SD_SIM_CSD_LEN);
+        resp[0] = r1;
+        respond(resp, 1, SIM_PHASE_READ_WAIT);
+        break;
+
+    case 12:
+        card.multi = false;
+        card.busy_until_ns = card.now_ns + (uint64_t)card.config.stop_busy_us * 1000;
+        resp[0] = r1;
+        respond(resp, 1, SIM_PHASE_CMD);
+        break;
+
+    case 17:
+    case 18:
+    case 24:
+    case 25:
+        if (card.idle)
+        {
+            resp[0] = r1 | R1_ILLEGAL_CMD;
+            respond(resp, 1, SIM_PHASE_CMD);
+            break;
+        }
+        if (arg_to_sector(arg) >= card.sector_cnt)
+        {
+            resp[0] = r1 | R1_ADDR_ERROR;
+            respond(resp, 1, SIM_PHASE_CMD);
+            break;
+        }
+        card.multi = (cmd == 18 || cmd == 25);
+        resp[0] = r1;
+        if (cmd == 17 || cmd == 18)
+        {
+            start_read(arg_to_sector(arg));
+            respond(resp, 1, SIM_PHASE_READ_WAIT);
+        }
+        else
+        {
+            card.sector = arg_to_sector(arg);
+            respond(resp, 1, SIM_PHASE_WRITE_TOKEN);
+        }
+        break;
+
+    case 55:
+        card.app_cmd = true;
+        resp[0] = r1;
+        respond(resp, 1, SIM_PHASE_CMD);
+        break;
+
+    case 58:
+        resp[0] = r1;
+        resp[1] = (card.idle ? 0x00 : 0x80) | (card.config.sdhc ? 0x40 : 0x00);
+        resp[2] = 0xFF; // 2.8-3.6V
+        resp[3] = 0x80; // 2.7-2.8V
+        resp[4] = 0x00;
+        respond(resp, 5, SIM_PHASE_CMD);
+        break;
+
+    default:
+        resp[0] = r1 | R1_ILLEGAL_CMD;
+        respond(resp, 1, SIM_PHASE_CMD);
+        break;
+    }
+}
+
+/* Function to feed a byte to the command receiver.
+ * Returns true if the byte was consumed as part of a command frame.
+ */
+static bool receive_command_byte(uint8_t tx_byte)
+{
+    if (card.cmd_len == 0 && (tx_byte & 0xC0) != 0x40)
+        return false;
+
+    card.cmd_frame[card.cmd_len++] = tx_byte;
+    if (card.cmd_len == sizeof(card.cmd_frame))
+    {
+        card.cmd_len = 0;
+        execute_command();
+    }
+    return true;
+}
+
+uint8_t SD_sim_transfer(uint8_t tx_byte)
+{
+    uint8_t rx_byte = 0xFF;
+
+    if (card.image == NULL)
+        return 0xFF;
+
+    sim_advance_ns(byte_time_ns());
+    card.stats.bytes_clocked++;
+
+    if (!card.selected)
+        return 0xFF;
+
+    switch (card.phase)
+    {
+    case SIM_PHASE_CMD:
+        // a busy card holds DO low and ignores commands
+        if (card_busy())
+            rx_byte = 0x00;
+        else
+            receive_command_byte(tx_byte);
+        break;
+
+    case SIM_PHASE_RESPONSE:
+        if (card.ncr_remaining)
+        {
+            card.ncr_remaining--;
+            break;
+        }
+        rx_byte = card.resp[card.resp_index++];
+        if (card.resp_index == card.resp_len)
+            card.phase = card.next_phase;
+        break;
+
+    case SIM_PHASE_READ_WAIT:
+        // CMD12 may be sent at any time during a multiple block read
+        if (card.multi && receive_command_byte(tx_byte))
+            break;
+
+        if (card.now_ns < card.ready_ns)
+            break;
+
+        if (card.error_token)
+        {
+            rx_byte = card.error_token;
+            if (card.multi)
+                start_read(card.sector + 1);
+            else
+                card.phase = SIM_PHASE_CMD;
+            break;
+        }
+        rx_byte = TOKEN_START_BLOCK;
+        card.phase = SIM_PHASE_READ_DATA;
+        break;
+
+    case SIM_PHASE_READ_DATA:
+        if (card.multi && receive_command_byte(tx_byte))
+            break;
+
+        // data followed by a 16-bit CRC, which the driver does not check
+        rx_byte = card.data_index < card.data_len ? card.block[card.data_index] : 0x00;
+        card.data_index++;
+
+        if (card.data_index == card.data_len + 2)
+        {
+            if (card.data_len == SD_SIM_BLOCK_LEN)
+                card.stats.blocks_read++;
+
+            if (card.multi)
+            {
+                start_read(card.sector + 1);
+                card.phase = SIM_PHASE_READ_WAIT;
+            }
+            else
+                card.phase = SIM_PHASE_CMD;
+        }
+        break;
+
+    case SIM_PHASE_WRITE_TOKEN:
+        if (card_busy())
+        {
+            rx_byte = 0x00;
+            break;
+        }
+        if (card.multi && tx_byte == TOKEN_STOP_MULTI_WRITE)
+        {
+            card.multi = false;
+            card.busy_until_ns = card.now_ns + (uint64_t)card.config.stop_busy_us * 1000;
+            card.phase = SIM_PHASE_CMD;
+        }
+        else if (tx_byte == (card.multi ? TOKEN_START_MULTI_WRITE : TOKEN_START_BLOCK))
+        {
+            card.data_index = 0;
+            card.phase = SIM_PHASE_WRITE_DATA;
+        }
+        break;
+
+    case SIM_PHASE_WRITE_DATA:
+        if (card.data_index < SD_SIM_BLOCK_LEN)
+            card.block[card.data_index] = tx_byte;
+        card.data_index++;
+
+        // block followed by a 16-bit CRC
+        if (card.data_index == SD_SIM_BLOCK_LEN + 2)
+            card.phase = SIM_PHASE_WRITE_RESP;
+        break;
+
+    case SIM_PHASE_WRITE_RESP:
+        if (fault_hit(SD_SIM_FAULT_WRITE_REJECT))
+            rx_byte = DATA_RESP_CRC_ERROR;
+        else if (!store_sector(card.sector))
+            rx_byte = DATA_RESP_WRITE_ERROR;
+        else
+        {
+            rx_byte = DATA_RESP_ACCEPTED;
+            card.stats.blocks_written++;
+            card.sector++;
+            card.busy_until_ns = card.now_ns + (fault_hit(SD_SIM_FAULT_WRITE_BUSY_STUCK) ? (uint64_t)SD_SIM_STUCK_US * 1000
+                                                                                          : (uint64_t)card.config.write_busy_us * 1000);
+        }
+        card.phase = card.multi ? SIM_PHASE_WRITE_TOKEN : SIM_PHASE_CMD;
+        break;
+
+    default:
+        break;
+    }
+
+    return rx_byte;
+}
+
+void SD_sim_cs(bool selected)
+{
+    // deselecting the card aborts any partially received command; a pending busy period continues
+    if (!selected)
+    {
+        card.cmd_len = 0;
+        card.multi = false;
+        card.phase = SIM_PHASE_CMD;
+    }
+    card.selected = selected;
+}
+
+uint32_t SD_sim_set_clock(uint32_t clock_hz)
+{
+    card.config.spi_clock_hz = clock_hz;
+    return clock_hz;
+}
+
+bool SD_sim_open(const char *image_path, const SD_sim_config_t *config)
+{
+    SD_sim_close();
+
+    card.image = fopen(image_path, "r+b");
+    if (card.image == NULL)
+        return false;
+
+    fseek(card.image, 0, SEEK_END);
+    card.sector_cnt = (uint32_t)(ftell(card.image) / SD_SIM_BLOCK_LEN);
+
+    card.config = *config;
+    card.idle = true;
+    card.phase = SIM_PHASE_CMD;
+    return true;
+}
+
+void SD_sim_close()
+{
+    uint64_t now_ns = card.now_ns;
+
+    if (card.image != NULL)
+        fclose(card.image);
+
+    // virtual time keeps running across image changes
+    memset(&card, 0, sizeof(card));
+    card.now_ns = now_ns;
+}
+
+void SD_sim_set_config(const SD_sim_config_t *config)
+{
+    card.config = *config;
+}
+
+void SD_sim_inject_fault(SD_sim_fault_t fault, uint32_t count)
+{
+    card.fault = fault;
+    card.fault_cnt = count;
+}
+
+uint64_t SD_sim_time_us()
+{
+    return card.now_ns / 1000;
+}
+
+void SD_sim_advance_us(uint64_t us)
+{
+    sim_advance_ns(us * 1000);
+}
+
+void SD_sim_get_stats(SD_sim_stats_t *stats)
+{
+    *stats = card.stats;
+}
+
+void taskSleepMS(uint32_t ms)
+{
+    SD_sim_advance_us((uint64_t)ms * 1000);
+}
+
+#if !defined(SOFT_TIMER_HOST_SIM)
+/* Host implementation of the softTimer tick API used by SD_driver timeouts, for builds without softTimer.
+ * Ticks are derived from the virtual time at the 32768 Hz RTC rate.
+ */
+void softTimer_init()
+{
+    // the virtual time is always counting
+}
+
+uint32_t softTimer_get_ticks()
+{
+    return (uint32_t)sim_ticks(card.now_ns);
+}
+
+uint32_t softTimer_ticks_elapsed(uint32_t start_ticks)
+{
+    return softTimer_get_ticks() - start_ticks;
+}
+#endif
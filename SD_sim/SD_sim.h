@@ -0,0 +1,95 @@
+/**
+ * @file SD_sim.h
+ * @author Surya Poudel
+ * @brief Host-side model of an SD card in SPI mode
+ *
+ * The model sits beneath SPI_transfer() of SD_driver.c when the driver is compiled
+ * with SD_HOST_SIM defined, so that SD_driver and mySdFat can run on a PC against an
+ * image file. Virtual time advances with every clocked byte according to the
+ * configured SPI clock, and access/busy latencies are taken from the configuration.
+ */
+#ifndef __SD_SIM_H
+#define __SD_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct
+{
+    uint32_t spi_clock_hz;    // SPI clock used to advance virtual time per transferred byte
+    uint8_t ncr_bytes;        // 0xFF bytes clocked before every R1 response (1..8)
+    uint16_t init_busy_polls; // Number of ACMD41 polls answered with the idle bit set
+    uint32_t read_latency_us; // Access time before each data start token
+    uint32_t write_busy_us;   // Busy time after each accepted data block
+    uint32_t stop_busy_us;    // Busy time after CMD12 / stop transmission token
+    uint8_t au_size;          // AU_SIZE code reported in the SD Status (9 = 4 MB)
+    bool sdhc;                // true: SDHC/SDXC (block addressing), false: SDSC (byte addressing)
+} SD_sim_config_t;
+
+typedef enum
+{
+    SD_SIM_FAULT_NONE,
+    SD_SIM_FAULT_CMD_TIMEOUT,      // No R1 response to the command
+    SD_SIM_FAULT_READ_ERROR_TOKEN, // Data error token (card ECC failed) instead of the start token
+    SD_SIM_FAULT_READ_TIMEOUT,     // Start token is never sent
+    SD_SIM_FAULT_WRITE_REJECT,     // Data response "rejected due to CRC error"
+    SD_SIM_FAULT_WRITE_BUSY_STUCK  // Card stays busy far beyond any sane write timeout
+} SD_sim_fault_t;
+
+typedef struct
+{
+    uint32_t bytes_clocked;
+    uint32_t commands;
+    uint32_t blocks_read;
+    uint32_t blocks_written;
+    uint32_t faults_injected;
+} SD_sim_stats_t;
+
+// Default configuration: 8 MHz SPI, SDHC card with typical latencies
+#define SD_SIM_DEFAULT_CONFIG      \
+    {                              \
+        .spi_clock_hz = 8000000,   \
+        .ncr_bytes = 1,            \
+        .init_busy_polls = 3,      \
+        .read_latency_us = 300,    \
+        .write_busy_us = 1000,     \
+        .stop_busy_us = 100,       \
+        .au_size = 9,              \
+        .sdhc = true               \
+    }
+
+// Function to attach the simulated card to an image file. The card capacity is the size of the image.
+bool SD_sim_open(const char *image_path, const SD_sim_config_t *config);
+
+// Function to detach the simulated card from its image file
+void SD_sim_close();
+
+// Function to change latencies/clock of an attached card at runtime
+void SD_sim_set_config(const SD_sim_config_t *config);
+
+// Function to make the next count operations affected by the fault fail
+void SD_sim_inject_fault(SD_sim_fault_t fault, uint32_t count);
+
+// Function to clock one byte through the simulated SPI bus
+uint8_t SD_sim_transfer(uint8_t tx_byte);
+
+// Function to drive the simulated chip select line
+void SD_sim_cs(bool selected);
+
+// Function to change the simulated SPI clock. Returns the clock in use.
+uint32_t SD_sim_set_clock(uint32_t clock_hz);
+
+// Function to get the virtual time in microseconds
+uint64_t SD_sim_time_us();
+
+// Function to advance the virtual time without clocking the bus
+void SD_sim_advance_us(uint64_t us);
+
+// Function to read the simulator statistics
+void SD_sim_get_stats(SD_sim_stats_t *stats);
+
+// Host implementation of the sleep used by SD_driver during card initialization
+void taskSleepMS(uint32_t ms);
+
+#endif
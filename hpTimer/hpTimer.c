@@ -0,0 +1,346 @@
+/**
+ * @file hpTimer.c
+ * @author Surya Poudel
+ * @brief High resolution (1 us) timer implementation for NRF52840 on TIMER4
+ *
+ * TIMER4 counts in 32 bit mode at 1 MHz while a timer or a one-shot PPI event is armed, and is
+ * stopped otherwise, so that it does not keep the high frequency clock running while idle.
+ * CC[0] is used to capture the current count, CC[1] holds the deadline of the next software
+ * timer and CC[2..5] provide one-shot COMPARE events for PPI.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "boards.h"
+#include "hpTimer.h"
+
+#define HP_TIMER NRF_TIMER4
+#define HP_TIMER_IRQn TIMER4_IRQn
+#define HP_TIMER_IRQ_PRIORITY 4 // Same priority as the RADIO interrupt, radio timeouts never preempt radio events
+#define TIMER_PRESCALER 4		// 16 MHz / 2^4 = 1 MHz
+#define TIMER_BITMODE_32 3
+#define CC_CAPTURE 0						   // CC register used to read the current count
+#define CC_TIMERS 1							   // CC register holding the deadline of the head node
+#define CC_PPI_FIRST 2						   // First CC register used for one-shot PPI events
+#define COMPARE_INT_MASK(cc) (1UL << (16 + (cc))) // INTENSET/INTENCLR bit of COMPARE[cc]
+#define CC_OFFSET_MIN 2						   // Minimum distance of a CC value from the current count for the COMPARE event to be generated
+
+#define HP_TIMER_CRITICAL_ENTER()         \
+	uint32_t primask = __get_PRIMASK(); \
+	__disable_irq()
+#define HP_TIMER_CRITICAL_EXIT() __set_PRIMASK(primask)
+
+static hpTimer_node_t *head_node = NULL; // head node in the list of running timers (earliest deadline)
+static uint8_t ppi_channels_used = 0;	 // Bit n set if CC[CC_PPI_FIRST + n] is in use
+static bool hp_timer_initialized = false;
+static bool hp_timer_running = false;	 // TIMER4 is counting
+
+/*Function to start TIMER4 before a timer or a one-shot event is armed. The count resumes where it stopped.
+ */
+static void timer_run()
+{
+	if (hp_timer_running)
+		return;
+
+	HP_TIMER->TASKS_START = 1;
+	hp_timer_running = true;
+}
+
+/*Function to stop TIMER4 once no timer and no one-shot event is armed, releasing the high frequency clock.
+ */
+static void timer_idle_check()
+{
+	if (!hp_timer_running || head_node != NULL || ppi_channels_used)
+		return;
+
+	HP_TIMER->TASKS_STOP = 1;
+	hp_timer_running = false;
+}
+
+/*Function to check if a deadline on the 32 bit microsecond count has been reached.
+ * Deadlines are never further than HP_TIMER_MAX_INTERVAL from now, so the signed difference is unambiguous.
+ */
+static bool deadline_reached(uint32_t deadline, uint32_t now)
+{
+	return (int32_t)(deadline - now) <= 0;
+}
+
+/*Function to add the timer instance in the list of running timers, sorted by deadline.
+ */
+static void timer_list_node_add(hpTimer_node_t *instance)
+{
+	hpTimer_node_t *prev_node = NULL;
+	hpTimer_node_t *current_node = head_node;
+
+	while (current_node != NULL && deadline_reached(current_node->deadline, instance->deadline))
+	{
+		prev_node = current_node;
+		current_node = current_node->next_node;
+	}
+
+	instance->next_node = current_node;
+
+	if (prev_node == NULL)
+		head_node = instance;
+	else
+		prev_node->next_node = instance;
+}
+
+/*Function to delete the timer from the list
+ */
+static void timer_list_node_delete(hpTimer_node_t *instance)
+{
+	hpTimer_node_t *prev_node = NULL;
+	hpTimer_node_t *current_node = head_node;
+
+	while (current_node != NULL && current_node != instance)
+	{
+		prev_node = current_node;
+		current_node = current_node->next_node;
+	}
+
+	if (current_node == NULL)
+		return;
+
+	if (prev_node == NULL)
+		head_node = instance->next_node;
+	else
+		prev_node->next_node = instance->next_node;
+
+	instance->next_node = NULL;
+}
+
+/*Function to load CC[CC_TIMERS] with the deadline of the head node.
+ * A deadline too close to be caught by the COMPARE event is handled by pending the interrupt.
+ */
+static void update_cc_register()
+{
+	if (head_node == NULL)
+	{
+		HP_TIMER->INTENCLR = COMPARE_INT_MASK(CC_TIMERS);
+		return;
+	}
+
+	uint32_t now = hpTimer_now();
+
+	if ((int32_t)(head_node->deadline - now) < CC_OFFSET_MIN)
+	{
+		NVIC_SetPendingIRQ(HP_TIMER_IRQn);
+		return;
+	}
+
+	HP_TIMER->CC[CC_TIMERS] = head_node->deadline;
+	HP_TIMER->INTENSET = COMPARE_INT_MASK(CC_TIMERS);
+}
+
+/*Function to handle the expired timers. Handlers are called outside the critical section,
+ * so they are free to start or stop any timer.
+ */
+static void handle_timers()
+{
+	while (1)
+	{
+		HP_TIMER_CRITICAL_ENTER();
+
+		uint32_t now = hpTimer_now();
+
+		if (head_node == NULL || !deadline_reached(head_node->deadline, now))
+		{
+			update_cc_register();
+			timer_idle_check();
+			HP_TIMER_CRITICAL_EXIT();
+			break;
+		}
+
+		hpTimer_node_t *current_node = head_node;
+		head_node = current_node->next_node;
+		current_node->next_node = NULL;
+
+		// Check if the timer mode is SINGLE_SHOT. If true, stop the correponding timer
+		// Otherwise, schedule the next period. Periods which have passed completely are skipped.
+		if (current_node->mode == HP_TIMER_MODE_SINGLE_SHOT)
+			current_node->is_running = false;
+		else
+		{
+			current_node->deadline += current_node->interval;
+			if (deadline_reached(current_node->deadline, now))
+				current_node->deadline = now + current_node->interval;
+			timer_list_node_add(current_node);
+		}
+
+		HP_TIMER_CRITICAL_EXIT();
+
+		current_node->timeout_handler(current_node->context);
+	}
+}
+
+/*Function to create a timer by initizing the timer instance with corresponding timer parameters.
+ */
+void hpTimer_create(hpTimer_node_t *instance, hp_timeout_handler_t timeout_handler, hp_timer_mode_t mode, void *context)
+{
+	instance->mode = mode;
+	instance->is_running = false;
+	instance->timeout_handler = timeout_handler;
+	instance->context = context;
+	instance->next_node = NULL;
+}
+
+/* Function to start the timer instance, interval_us microseconds from now.
+ */
+void hpTimer_start(hpTimer_node_t *instance, uint32_t interval_us)
+{
+	HP_TIMER_CRITICAL_ENTER();
+
+	// check if the timer is already in running state. If true, abort.
+	if (instance->is_running)
+	{
+		HP_TIMER_CRITICAL_EXIT();
+		return;
+	}
+
+	if (interval_us == 0)
+		interval_us = 1;
+	if (interval_us > HP_TIMER_MAX_INTERVAL)
+		interval_us = HP_TIMER_MAX_INTERVAL;
+
+	timer_run();
+
+	uint32_t now = hpTimer_now();
+
+	instance->interval = interval_us;
+	instance->deadline = now + interval_us;
+	instance->is_running = true;
+
+	timer_list_node_add(instance);
+
+	// update cc register if the timer is the next one to expire
+	if (head_node == instance)
+		update_cc_register();
+
+	HP_TIMER_CRITICAL_EXIT();
+}
+
+/* Function to stop the corresponding timer instance.
+ */
+void hpTimer_stop(hpTimer_node_t *instance)
+{
+	HP_TIMER_CRITICAL_ENTER();
+
+	if (instance->is_running)
+	{
+		instance->is_running = false;
+		timer_list_node_delete(instance);
+		timer_idle_check();
+	}
+
+	HP_TIMER_CRITICAL_EXIT();
+}
+
+/* Function to get the current microsecond count by capturing the TIMER4 counter.
+ */
+uint32_t hpTimer_now()
+{
+	HP_TIMER_CRITICAL_ENTER();
+
+	HP_TIMER->TASKS_CAPTURE[CC_CAPTURE] = 1;
+	uint32_t now = HP_TIMER->CC[CC_CAPTURE];
+
+	HP_TIMER_CRITICAL_EXIT();
+
+	return now;
+}
+
+/* Function to generate a one-shot COMPARE event on a free CC register for use as PPI event end point.
+ * The COMPARE interrupt of the channel is only used to release the channel after the event has fired.
+ */
+uint32_t hpTimer_ppi_event_start(uint32_t delay_us, uint8_t *p_channel)
+{
+	HP_TIMER_CRITICAL_ENTER();
+
+	for (uint8_t channel = 0; channel < HP_TIMER_PPI_CHANNELS; channel++)
+	{
+		if (ppi_channels_used & (1 << channel))
+			continue;
+
+		uint8_t cc = CC_PPI_FIRST + channel;
+
+		if (delay_us < CC_OFFSET_MIN)
+			delay_us = CC_OFFSET_MIN;
+		if (delay_us > HP_TIMER_MAX_INTERVAL)
+			delay_us = HP_TIMER_MAX_INTERVAL;
+
+		timer_run();
+		ppi_channels_used |= 1 << channel;
+		HP_TIMER->EVENTS_COMPARE[cc] = 0;
+		HP_TIMER->CC[cc] = hpTimer_now() + delay_us;
+		HP_TIMER->INTENSET = COMPARE_INT_MASK(cc);
+
+		HP_TIMER_CRITICAL_EXIT();
+
+		*p_channel = channel;
+		return (uint32_t)(uintptr_t)&HP_TIMER->EVENTS_COMPARE[cc];
+	}
+
+	HP_TIMER_CRITICAL_EXIT();
+
+	return 0;
+}
+
+/* Function to cancel a one-shot COMPARE event. The CC register is moved half a wrap-around away
+ * so that it cannot match before it is used again.
+ */
+void hpTimer_ppi_event_stop(uint8_t channel)
+{
+	if (channel >= HP_TIMER_PPI_CHANNELS)
+		return;
+
+	HP_TIMER_CRITICAL_ENTER();
+
+	uint8_t cc = CC_PPI_FIRST + channel;
+
+	HP_TIMER->INTENCLR = COMPARE_INT_MASK(cc);
+	HP_TIMER->CC[cc] = hpTimer_now() + HP_TIMER_MAX_INTERVAL;
+	HP_TIMER->EVENTS_COMPARE[cc] = 0;
+	ppi_channels_used &= ~(1 << channel);
+	timer_idle_check();
+
+	HP_TIMER_CRITICAL_EXIT();
+}
+
+/* Function to initialize the timer module.
+ * TIMER4 is set up in 32 bit timer mode at 1 MHz, it is started when the first timer is armed.
+ * Calling it again has no effect, so every module using hpTimer can initialize it.
+ */
+void hpTimer_init()
+{
+	if (hp_timer_initialized)
+		return;
+
+	HP_TIMER->TASKS_STOP = 1;
+	HP_TIMER->MODE = 0; // Timer mode
+	HP_TIMER->BITMODE = TIMER_BITMODE_32;
+	HP_TIMER->PRESCALER = TIMER_PRESCALER;
+	HP_TIMER->TASKS_CLEAR = 1;
+
+	NVIC_SetPriority(HP_TIMER_IRQn, HP_TIMER_IRQ_PRIORITY);
+	NVIC_EnableIRQ(HP_TIMER_IRQn);
+
+	hp_timer_running = false;
+	hp_timer_initialized = true;
+}
+
+/*Interrupt handler for TIMER4 peripheral */
+void TIMER4_IRQHandler(void)
+{
+	for (uint8_t channel = 0; channel < HP_TIMER_PPI_CHANNELS; channel++)
+	{
+		uint8_t cc = CC_PPI_FIRST + channel;
+
+		// release one-shot channels whose event has fired
+		if ((ppi_channels_used & (1 << channel)) && HP_TIMER->EVENTS_COMPARE[cc])
+			hpTimer_ppi_event_stop(channel);
+	}
+
+	HP_TIMER->EVENTS_COMPARE[CC_TIMERS] = 0;
+	handle_timers();
+}
@@ -0,0 +1,63 @@
+#ifndef __HP_TIMER_H
+#define __HP_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* High resolution timers with 1 us resolution on TIMER4, for radio timing that the 30.5 us RTC ticks of softTimer can't express.
+ * The API follows softTimer. Intervals are in microseconds and limited to HP_TIMER_MAX_INTERVAL.
+ * TIMER4 runs from the high frequency clock, so hpTimer should only be used for short timeouts.
+ * TIMER4 only counts while a timer or a one-shot PPI event is armed, so it does not keep the
+ * high frequency clock running while the system is idle.
+ */
+
+/* Macro to define  timer instance */
+#define HP_TIMER_DEF(name) \
+	static hpTimer_node_t name;
+#define HP_TIMER_MAX_INTERVAL 0x7FFFFFFF // Maximum interval in microseconds (35 minutes)
+#define HP_TIMER_PPI_CHANNELS 4			 // Number of one-shot COMPARE events available for PPI
+
+typedef enum
+{
+	HP_TIMER_MODE_SINGLE_SHOT,
+	HP_TIMER_MODE_REPEATED
+} hp_timer_mode_t;
+
+typedef void (*hp_timeout_handler_t)(void *context); // Timeout handler function, called with the context given to hpTimer_create()
+
+typedef struct hp_timer_node
+{
+	bool is_running;
+	hp_timer_mode_t mode;
+	hp_timeout_handler_t timeout_handler;
+	void *context;
+	uint32_t interval; // Interval in microseconds
+	uint32_t deadline; // Expiry time on the 32 bit microsecond count of TIMER4
+	struct hp_timer_node *next_node;
+} hpTimer_node_t; // Timer instance structure
+
+// Function to create a timer by initializing the timer instance. context is passed to timeout_handler on every expiry.
+void hpTimer_create(hpTimer_node_t *instance, hp_timeout_handler_t timeout_handler, hp_timer_mode_t mode, void *context);
+
+// Function to start the timer instance, interval_us microseconds from now
+void hpTimer_start(hpTimer_node_t *instance, uint32_t interval_us);
+
+// Function to stop the timer instance
+void hpTimer_stop(hpTimer_node_t *instance);
+
+// Function to get the 32 bit microsecond count. The count wraps around every 71 minutes and pauses while nothing is armed.
+uint32_t hpTimer_now();
+
+/* Function to generate a one-shot COMPARE event delay_us microseconds from now, without CPU involvement when it fires.
+ * Returns the address of the EVENTS_COMPARE register to be used as PPI event end point, or 0 if all
+ * HP_TIMER_PPI_CHANNELS are in use. The channel is released when the event has fired or by hpTimer_ppi_event_stop().
+ */
+uint32_t hpTimer_ppi_event_start(uint32_t delay_us, uint8_t *p_channel);
+
+// Function to cancel a one-shot COMPARE event which has not fired yet
+void hpTimer_ppi_event_stop(uint8_t channel);
+
+// Function to initialize the timer module. TIMER4 is started on demand. Calling it again has no effect.
+void hpTimer_init();
+
+#endif //__HP_TIMER_H
@@ -27,6 +27,8 @@ uint32_t RootDirSectors;
 uint32_t DataStartSector;
 uint32_t DataSectorsCnt;
 
+uint32_t AllocAlignSectors = 1; // Sector alignment of preallocated clusters (card allocation unit)
+
 char fileName[128] = "";
 uint8_t fileNameIndex;
 /**
@@ -143,6 +145,80 @@ static inline uint32_t startSecOfClus(uint32_t cluster_index)
 	return (DataStartSector + (cluster_index - 2) * params.BPB_SecPerClus);
 }
 
+/**
+ * @brief  Function to find a run of free clusters whose first sector is aligned to alignSectors
+ *
+ * @param[in] clusCnt  number of contiguous free clusters required
+ * @param[in] alignSectors  required alignment of the first sector of the run
+ * @return first cluster of the run, 0 if no such run exists
+ */
+static uint32_t fatFindFreeRun(uint32_t clusCnt, uint32_t alignSectors)
+{
+	uint32_t lastClus = DataSectorsCnt / params.BPB_SecPerClus + 2;
+	uint32_t cachedSec = 0;
+	uint32_t runStart = 0;
+	uint32_t runLen = 0;
+
+	for (uint32_t clus = 2; clus < lastClus; clus++)
+	{
+		fatEntLoc_t fatEntLoc = fatEntLocation(clus);
+
+		// read each FAT sector only once while scanning
+		if (fatEntLoc.fatSecNum != cachedSec)
+		{
+			if (SD_readSector(fatEntLoc.fatSecNum, SD_buff) != SD_READ_SUCCESS)
+				return 0;
+			cachedSec = fatEntLoc.fatSecNum;
+		}
+
+		if ((*((uint32_t *)&SD_buff[fatEntLoc.fatEntOffset]) & 0x0FFFFFFF) != 0)
+		{
+			runLen = 0;
+			continue;
+		}
+
+		if (runLen == 0)
+		{
+			if (startSecOfClus(clus) % alignSectors)
+				continue;
+			runStart = clus;
+		}
+
+		if (++runLen == clusCnt)
+			return runStart;
+	}
+	return 0;
+}
+
+/**
+ * @brief  Function to link clusCnt consecutive clusters into a chain terminated with FAT_EOC
+ *
+ * @param[in] firstClus  first cluster of the chain
+ * @param[in] clusCnt  number of clusters in the chain
+ */
+static bool fatSetChain(uint32_t firstClus, uint32_t clusCnt)
+{
+	uint32_t cachedSec = 0;
+
+	for (uint32_t i = 0; i < clusCnt; i++)
+	{
+		fatEntLoc_t fatEntLoc = fatEntLocation(firstClus + i);
+		uint32_t nextClus = (i == clusCnt - 1) ? FAT_EOC : firstClus + i + 1;
+
+		// update all entries of a FAT sector with one read and one write
+		if (fatEntLoc.fatSecNum != cachedSec)
+		{
+			if (cachedSec && SD_writeSector(cachedSec, SD_buff) != SD_WRITE_SUCCESS)
+				return false;
+			if (SD_readSector(fatEntLoc.fatSecNum, SD_buff) != SD_READ_SUCCESS)
+				return false;
+			cachedSec = fatEntLoc.fatSecNum;
+		}
+		memcpy(&SD_buff[fatEntLoc.fatEntOffset], &nextClus, 4);
+	}
+	return SD_writeSector(cachedSec, SD_buff) == SD_WRITE_SUCCESS;
+}
+
 static void displayTime(uint16_t time)
 {
 	uint8_t hours = (time & 0xF800) >> 11;
@@ -1093,24 +1169,24 @@ bool fileWrite(myFile *pFile, const char *data)
 	uint32_t startClus = startCluster(pFile);
 	uint16_t byteIndex = pFile->DIR_FileSize % params.BPB_BytesPerSec;
 	uint32_t sectorIndex = pFile->DIR_FileSize / params.BPB_BytesPerSec;
-	uint32_t clusterCnt = (sectorIndex / params.BPB_SecPerClus) + 1;
+	uint32_t clusterIndex = sectorIndex / params.BPB_SecPerClus;
 	uint32_t byteCnt = 0;
 	bool moreData = true;
 
 	sectorIndex = sectorIndex % params.BPB_SecPerClus;
-	uint32_t tempClus;
 
-	if (clusterCnt > 1)
+	// Walk the chain to the cluster holding the end of file and extend the chain only where it ends,
+	// so that clusters reserved by filePreallocate() are used.
+	while (clusterIndex--)
 	{
-		while (clusterCnt)
+		uint32_t nextClus = fatNextClus(startClus);
+		if (nextClus >= FAT_EOC)
 		{
-			tempClus = startClus;
-			startClus = fatNextClus(startClus);
-			clusterCnt--;
+			nextClus = getNxtFreeClus();
+			fatSetNextClus(startClus, nextClus);
+			fatSetNextClus(nextClus, FAT_EOC);
 		}
-		uint32_t nextClus = getNxtFreeClus();
-		fatSetNextClus(tempClus, nextClus);
-		fatSetNextClus(nextClus, FAT_EOC);
+		startClus = nextClus;
 	}
 
 	if (byteIndex != 0)
@@ -1151,6 +1227,49 @@ bool fileWrite(myFile *pFile, const char *data)
 	return true;
 }
 
+/**
+ * @brief Function to reserve contiguous clusters for an empty file, starting on an allocation unit
+ * boundary of the card. Writing a log into whole allocation units avoids the internal
+ * read-modify-write the card performs when an allocation unit is shared with other data.
+ *
+ * @param[in] pFile  empty file returned by fileOpen()
+ * @param[in] size  number of bytes to reserve
+ * @return true/false returns true if the clusters have been reserved
+ */
+bool filePreallocate(myFile *pFile, uint32_t size)
+{
+	uint32_t clusBytes = params.BPB_SecPerClus * params.BPB_BytesPerSec;
+	uint32_t clusCnt = (size + clusBytes - 1) / clusBytes;
+	uint32_t oldClus = startCluster(pFile);
+
+	if (oldClus == 0 || pFile->DIR_FileSize != 0 || clusCnt == 0)
+		return false;
+
+	// release the cluster allocated at file creation, it may be part of the run found below
+	fatSetNextClus(oldClus, 0x00000000);
+
+	uint32_t firstClus = fatFindFreeRun(clusCnt, AllocAlignSectors);
+	if (firstClus == 0 || !fatSetChain(firstClus, clusCnt))
+	{
+		debug_log_print("Preallocation failed!\n");
+		fatSetNextClus(oldClus, FAT_EOC);
+		return false;
+	}
+
+	fileSetStartClus(pFile, firstClus);
+
+	if (SD_readSector(
+			startSecOfClus(pFile->fileEntInf.Cluster) + pFile->fileEntInf.sectorIndex, SD_buff) == SD_READ_SUCCESS)
+	{
+		myFile *p_temp = (myFile *)(SD_buff + pFile->fileEntInf.entryIndex * 32);
+		memcpy(p_temp, pFile, 32);
+		if (SD_writeSector(
+				startSecOfClus(pFile->fileEntInf.Cluster) + pFile->fileEntInf.sectorIndex, SD_buff) == SD_WRITE_SUCCESS)
+			return true;
+	}
+	return false;
+}
+
 bool fileDelete(const char *path, const char *filename)
 {
 	myFile pathDir;
@@ -1233,6 +1352,15 @@ bool mySdFat_init()
 
 		DataSectorsCnt = params.BPB_TotSec32 - DataStartSector;
 
+		// Preallocated clusters start on an allocation unit boundary of the card, if the
+		// cluster layout of the volume makes such a boundary reachable.
+		sd_card_info_t cardInfo;
+		SD_getCardInfo(&cardInfo);
+		uint32_t alignGranule = (cardInfo.au_sectors < params.BPB_SecPerClus) ? cardInfo.au_sectors : params.BPB_SecPerClus;
+		AllocAlignSectors = 1;
+		if (cardInfo.au_sectors && (DataStartSector % alignGranule) == 0)
+			AllocAlignSectors = cardInfo.au_sectors;
+
 		float size = (params.BPB_TotSec32 * 512.0) / (1024.0 * 1024.0 * 1024.0);
 		uint16_t sizeInt = size;
 		float tmpFrac = size - sizeInt;
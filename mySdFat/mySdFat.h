@@ -131,6 +131,8 @@ myFile createDirectory(const char *path, const char *dirName);
 
 bool fileWrite(myFile *pFile, const char *data);
 
+bool filePreallocate(myFile *pFile, uint32_t size);
+
 bool fileDelete(const char *path, const char *filename);
 
 myFile nextFile(myFile *pFile);
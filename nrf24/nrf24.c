@@ -1,69 +1,314 @@
 #include <stdint.h>
 #include <string.h>
 
+#if defined(NRF24_HOST_SIM)
+#include <stdbool.h>
+#include <stdlib.h>
+#include "RADIO_sim.h"
+#else
 #include "boards.h"
+#endif
 #include "nrf24.h"
 #include "radio_driver.h"
 #include "debug_log.h"
+#include "hpTimer.h"
+#if defined(NRF24_LINK_MANAGER)
 #include "softTimer.h"
+#endif
 
 #if defined(NRF24_ESB)
-#define AUTO_RETRANSMIT_DELAY US_TO_TICKS(1000)
+#define AUTO_RETRANSMIT_DELAY 1000 // Auto retransmit delay in microseconds
 #define MAX_RETRIES 15
-SOFT_TIMER_DEF(auto_retransmit_timer);
-volatile uint8_t auto_retransmit_count = 0;
+#define ACK_TIMEOUT 500		// ACK timeout from the end of the TX in microseconds: RX ramp-up and an ACK with 32 byte payload at 1 Mbps
+#define AUTO_RETRANSMIT_DELAY_CODED 4000 // Auto retransmit delay on the BLE Coded PHY
+#define ACK_TIMEOUT_CODED 3000			 // ACK timeout on the BLE Coded PHY, where a bit takes 8 us
+#define NRF24_PPI_CHANNEL 0 // PPI channel connecting the ACK timeout to the DISABLE task of the RADIO
+#if defined(NRF24_DPL)
+#define PCF_ACK_REQUEST 0x01  // S1 bit requesting an ACK from the receiver
+#define PCF_LINK_CONTROL 0x08 // S1 bit of a link control packet, only sent with NRF24_LINK_MANAGER
+#define PCF_STREAM 0x10		  // S1 bit of a stream packet, only sent with NRF24_STREAM
+#define PCF_SET_PID(packet, pid) ((packet).PID = ((pid) << 1) | PCF_ACK_REQUEST)
+#define PCF_GET_PID(packet) (((packet).PID >> 1) & 0x03)
+#else
+#define PCF_STATIC_S0 0x84 // S0 field of static payload packets, the PID is in bits 1..0
+#define PCF_SET_PID(packet, pid) ((packet).PID = PCF_STATIC_S0 | (pid), (packet).No_ack = 0)
+#define PCF_GET_PID(packet) ((packet).PID & 0x03)
 #endif
+#define SHORTS_TX_ACK (RADIO_SHORT_READY_START | RADIO_SHORT_END_DISABLE | RADIO_SHORT_DISABLED_RXEN)	// TX followed by the reception of the ACK
+#define SHORTS_TX_NO_ACK (RADIO_SHORT_READY_START | RADIO_SHORT_END_DISABLE | RADIO_SHORT_DISABLED_TXEN) // TX followed by the next TX of a burst
+NRF24_STATE HP_TIMER_DEF(auto_retransmit_timer);
+NRF24_STATE volatile uint8_t auto_retransmit_count = 0;
+NRF24_STATE uint32_t auto_retransmit_delay = AUTO_RETRANSMIT_DELAY; // Auto retransmit delay of the current data rate
+NRF24_STATE uint32_t ack_timeout = ACK_TIMEOUT;					   // ACK timeout of the current data rate
+NRF24_STATE uint16_t air_bit_time_ns = 1000;					   // Duration of a bit on air at the current data rate
 
-nrf24_evt_handler_t nrf24_event_handler;
-nrf24_packet_t recv_ack_packet;
+typedef enum
+{
+	ESB_IDLE,
+	ESB_TX,		   // Packet is being sent, the DISABLED_RXEN shortcut starts the reception of the ACK
+	ESB_WAIT_ACK,  // Waiting for the ACK until it is received or the timeout disables the RADIO
+	ESB_STREAM_TX // NO_ACK stream packet is being sent, the DISABLED_TXEN shortcut starts the next packet of the burst
+} esb_state_t;
 
-nrf24_packet_t tx_packet = {
-#if defined(NRF24_ESB)
-	.PID = 0x84, .No_ack = 0
+NRF24_STATE volatile esb_state_t esb_state = ESB_IDLE;
+NRF24_STATE uint8_t ack_timeout_channel = HP_TIMER_PPI_CHANNELS; // hpTimer one-shot channel of the ACK timeout
+#endif
+
+#define EGU1_IRQ_PRIORITY 4
+
+void egu1_handler(); // Forward declaration
+
+#if defined(NRF24_HOST_SIM)
+// the interrupts of a simulated node never preempt each other, and the thread only runs between them
+#define NRF24_CRITICAL_ENTER() uint32_t primask = 0
+#define NRF24_CRITICAL_EXIT() (void)primask
+#define NRF24_TX_KICK() RADIO_sim_trigger_swi(egu1_handler)
+#define __DMB()
+#else
+#define NRF24_CRITICAL_ENTER()            \
+	uint32_t primask = __get_PRIMASK(); \
+	__disable_irq()
+#define NRF24_CRITICAL_EXIT() __set_PRIMASK(primask)
+#define NRF24_TX_KICK() (NRF_EGU1->TASKS_TRIGGER[0] = 1) // The EGU1 interrupt starts the next packet
+#endif
+
+#if defined(NRF24_STREAM)
+#define STREAM_SEQ 0  // Payload byte holding the sequence number of a stream packet
+#define STREAM_BASE 1 // Payload byte holding the oldest sequence number the sender still sends
+#define STREAM_DATA 2 // First data byte of a stream packet
+#define STREAM_MASK(count) ((count) >= 32 ? 0xFFFFFFFFUL : (1UL << (count)) - 1) // Bitmap of the first count packets of a window
+
+#if NRF24_STREAM_WINDOW > 32
+#error "NRF24_STREAM_WINDOW must not exceed the 32 bits of the acknowledgement bitmap"
+#endif
+
+/* Window of the stream transmitter. Packet seq is kept in packets[seq % NRF24_STREAM_WINDOW] until it is acknowledged.
+ * Bit i of the bitmaps refers to the packet base + i.
+ */
+typedef struct
+{
+	nrf24_packet_t packets[NRF24_STREAM_WINDOW];
+	uint8_t base;	  // Oldest packet not acknowledged yet
+	uint8_t next_seq; // Sequence number of the next packet written
+	uint32_t pending; // Packets to be sent with the next burst
+	uint32_t burst;	  // Packets of the current burst not sent yet
+	bool poll;		  // The packet being sent is the last one of its burst and requests the bitmap
+} stream_tx_t;
+
+/* Window of the stream receiver. Packets received out of order wait in packets[seq % NRF24_STREAM_WINDOW].
+ */
+typedef struct
+{
+	nrf24_packet_t packets[NRF24_STREAM_WINDOW];
+	uint8_t pipe;	   // Pipe of the stream, NRF24_PIPES if no stream is received
+	uint8_t base;	   // Next packet to be delivered
+	uint32_t received; // Bit i: packet base + i has been received
+} stream_rx_t;
+
+NRF24_STATE stream_tx_t stream_tx;
+NRF24_STATE stream_rx_t stream_rx = {.pipe = NRF24_PIPES};
+#endif
+
+#if defined(NRF24_LINK_MANAGER)
+#define LINK_UPGRADE_WINDOWS 4 // Consecutive clean windows before the data rate is stepped up
+#define LINK_LOSS_FAILURES 2   // Consecutive failed packets after which the transmitter returns to the home settings
+#define LINK_CONTROL_CHANNEL 0 // Payload byte of a link control packet holding the new channel
+#define LINK_CONTROL_RATE 1	   // Payload byte of a link control packet holding the new data rate
+#define LINK_CONTROL_LENGTH 2
+#define LINK_MAX_CHANNEL 100 // Highest RF channel of the RADIO
+#define LINK_IDLE_TIMEOUT_DEFAULT_MS 1000 // Idle timeout used when the configuration gives none
+
+typedef enum
+{
+	LINK_STEP_NONE,
+	LINK_STEP_CHANNEL,
+	LINK_STEP_RATE
+} link_step_t;
+
+/* State of the link manager. It is only changed by the RADIO and EGU1 interrupts, which have the same priority.
+ */
+typedef struct
+{
+	nrf24_link_config_t config;
+	bool enabled;
+	uint8_t channel;
+	nrf24_data_rate_t data_rate;
+	uint8_t per;		   // Packet error rate of the last window in percent
+	uint16_t attempts;	   // TX attempts in the current window
+	uint8_t packets;	   // Packets sent in the current window
+	uint8_t delivered;	   // Packets acknowledged in the current window
+	uint8_t failures;	   // Consecutive failed packets
+	uint8_t clean_windows; // Consecutive windows with a packet error rate up to per_high
+	link_step_t last_step; // A channel move that did not help is followed by a lower data rate
+	volatile bool home_pending;
+	bool control_pending; // control_packet is waiting to be sent
+	bool control_tx;	  // control_packet is being sent
+	uint8_t control_pid;
+	nrf24_packet_t control_packet;
+} link_manager_t;
+
+NRF24_STATE link_manager_t link;
+SOFT_TIMER_DEF(link_idle_timer);
+#endif
+
+#if defined(NRF24_STATS)
+#define AIR_FRAME_BITS (8 + 5 * 8 + 9 + 2 * 8) // Preamble, address, packet control field and CRC of every packet
+
+NRF24_STATE nrf24_stats_t stats[NRF24_PIPES];
+NRF24_STATE nrf24_tx_stats_t tx_stats[NRF24_STATS_TX_LINKS];
+NRF24_STATE uint32_t tx_stats_selected[NRF24_STATS_TX_LINKS]; // Selection count when each link was last selected, 0 if unused
+NRF24_STATE uint32_t tx_stats_selections;
+NRF24_STATE nrf24_tx_stats_t *p_tx_stats = &tx_stats[0]; // Statistics of the current TX address
+
+// Function to estimate the time on air of a packet with length bytes of payload
+static uint32_t stats_airtime_us(uint8_t length)
+{
+	return (AIR_FRAME_BITS + length * 8UL) * air_bit_time_ns / 1000;
+}
+
+// Function to find the TX statistics of an address, NULL if none are kept for it
+static nrf24_tx_stats_t *tx_stats_find(const uint8_t *tx_address)
+{
+	for (uint8_t link = 0; link < NRF24_STATS_TX_LINKS; link++)
+	{
+		if (tx_stats_selected[link] && memcmp(tx_stats[link].address, tx_address, 5) == 0)
+			return &tx_stats[link];
+	}
+
+	return NULL;
+}
+
+/* Function to select the TX statistics of the address for the following transmissions.
+ * A new address takes an unused entry, or the least recently selected one.
+ */
+static void tx_stats_select(const uint8_t *tx_address)
+{
+	nrf24_tx_stats_t *p_link = tx_stats_find(tx_address);
+
+	NRF24_CRITICAL_ENTER();
+	if (p_link == NULL)
+	{
+		uint8_t oldest = 0;
+
+		for (uint8_t link = 1; link < NRF24_STATS_TX_LINKS; link++)
+		{
+			if (tx_stats_selected[link] < tx_stats_selected[oldest])
+				oldest = link;
+		}
+
+		p_link = &tx_stats[oldest];
+		*p_link = (nrf24_tx_stats_t){0};
+		memcpy(p_link->address, tx_address, 5);
+	}
+
+	tx_stats_selected[p_link - tx_stats] = ++tx_stats_selections;
+	p_tx_stats = p_link;
+	NRF24_CRITICAL_EXIT();
+}
+#endif
+
+NRF24_STATE nrf24_evt_handler_t nrf24_event_handler;
+NRF24_STATE nrf24_packet_t recv_ack_packet;
+
+#if defined(NRF24_DPL)
+NRF24_STATE nrf24_packet_t ack_packets[NRF24_PIPES];		  // Last ACK sent on each pipe, echoing the PID of the received packet
+NRF24_STATE nrf24_packet_t ack_payloads[NRF24_PIPES];		  // ACK payload queued for each pipe
+NRF24_STATE volatile bool ack_payload_queued[NRF24_PIPES]; // ack_payloads[pipe] is waiting for the next new packet of the pipe
 #endif
-};
 
-nrf24_packet_t *p_current_packet;
+NRF24_STATE nrf24_packet_t *p_current_packet;
+
+NRF24_STATE nrf24_tx_fifo_t tx_fifo;
+NRF24_STATE volatile bool tx_busy = false; // The packet at the read index of tx_fifo is being sent
+NRF24_STATE volatile bool rx_pending = false; // RX mode was set while a packet was being sent, the reception starts after it
 
-nrf24_tx_fifo_t tx_fifo;
+#if defined(NRF24_ESB)
+NRF24_STATE nrf24_tx_policy_t tx_policy = {.retransmit_delay_us = 0, .max_retries = MAX_RETRIES, .backoff_us = 0}; // Default retransmit policy
+NRF24_STATE const nrf24_tx_policy_t *p_current_policy = &tx_policy;											   // Retransmit policy of the packet being sent
+#else
+NRF24_STATE nrf24_tx_policy_t tx_policy; // Packets are sent once without ESB, the policy is not used
+#endif
 
-nrf24_event_t nrf24_event;
+NRF24_STATE nrf24_event_t nrf24_event;
 
-nrf24_mode_t nrf24_mode;
-uint8_t pid = 0;
+NRF24_STATE nrf24_mode_t nrf24_mode;
+NRF24_STATE uint8_t pid = 0;
 
-nrf24_packet_t recv_packet;
-uint8_t prev_pid = 4;
+NRF24_STATE nrf24_packet_t recv_packet;
+NRF24_STATE uint8_t rx_pipes = 0; // Pipes enabled by nrf24_set_rx_address()
+#if defined(NRF24_ESB)
+NRF24_STATE uint8_t prev_pid[NRF24_PIPES];	// PID of the last packet received on each pipe, 4 if none
+NRF24_STATE uint32_t prev_crc[NRF24_PIPES]; // CRC of the last packet received on each pipe
+#endif
 
 void nrf24_tx_fifo_execute(); // Forward declaration
 
+#if defined(NRF24_DPL)
+/* Function to queue the ACK payload of a pipe.
+ * The payload is written while ack_payload_queued[pipe] is false and only read by the RADIO interrupt
+ * while it is true, so no critical section is needed.
+ */
+bool nrf24_write_ack_payload(uint8_t pipe, const uint8_t *data, uint8_t length)
+{
+	if (pipe >= NRF24_PIPES || ack_payload_queued[pipe])
+		return false;
+
+	if (length > NRF24_MAX_PAYLOAD_SIZE)
+		length = NRF24_MAX_PAYLOAD_SIZE;
+
+	memcpy(ack_payloads[pipe].payload, data, length);
+	ack_payloads[pipe].length = length;
+	ack_payload_queued[pipe] = true;
+
+	return true;
+}
+
+/* Function to build the ACK of the packet received on the pipe.
+ * A new packet is acknowledged with the payload queued for the pipe, if any. A retransmitted packet gets
+ * the previous ACK again, so the payload is not lost when that ACK did not reach the transmitter.
+ * Returns true if the queued payload is sent with this ACK.
+ */
+static bool nrf24_prepare_ack(uint8_t pipe, bool new_packet)
+{
+	nrf24_packet_t *p_ack = &ack_packets[pipe];
+	bool payload_sent = false;
+
+	if (new_packet)
+	{
+		if (ack_payload_queued[pipe])
+		{
+			p_ack->length = ack_payloads[pipe].length;
+			memcpy(p_ack->payload, ack_payloads[pipe].payload, p_ack->length);
+			ack_payload_queued[pipe] = false;
+			payload_sent = true;
+		}
+		else
+			p_ack->length = 0;
+	}
+
+	p_ack->PID = recv_packet.PID;
+	return payload_sent;
+}
+#endif
+
 // Function to check if the Queue is full
-bool tx_fifo_full()
+static bool tx_fifo_full()
 {
-	if (tx_fifo.count == NRF24_TX_FIFO_MAX_SIZE)
-		return 1;
-	return 0;
+	return (uint16_t)(tx_fifo.write_index - tx_fifo.read_index) == NRF24_TX_FIFO_SIZE;
 }
 
 // Function to check if the Queue is empty
-bool tx_fifo_empty()
+static bool tx_fifo_empty()
 {
-	if (tx_fifo.count == 0)
-		return 1;
-	return 0;
+	return tx_fifo.write_index == tx_fifo.read_index;
 }
 
-// Function to insert element into the Queue
-void tx_fifo_push(nrf24_packet_t packet)
+// Function to remove the packet that has been sent from the Queue and start the next one
+static void tx_fifo_release()
 {
-	if (!tx_fifo_full())
-	{
-		tx_fifo.tx_fifo_buffer[tx_fifo.write_index] = packet;
-		tx_fifo.write_index = (tx_fifo.write_index + 1) % NRF24_TX_FIFO_MAX_SIZE;
-		tx_fifo.count++;
-	}
-	else
-		debug_log_print("TX fifo is full\n");
+	tx_fifo.read_index++;
+	tx_busy = false;
+	NRF24_TX_KICK();
 }
 
 void nrf24_set_evt_handler(nrf24_evt_handler_t evt_handler)
@@ -85,7 +330,20 @@ static uint8_t reverse_bit_order(uint8_t byte)
 
 static void nrf24_set_pl_size(uint8_t pl_size)
 {
-#if defined(NRF24_ESB)
+#if defined(NRF24_DPL)
+	// pl_size is the maximum length of received packets, the length of each packet is in its LENGTH field
+	radio_set_len_field_size(6);			// 6bits len
+	radio_set_s0_field_size(0);
+#if defined(NRF24_STREAM)
+	radio_set_s1_field_size(5);				// 5bits->stream flag+link control flag+2bits pid+1bit no_ack flag
+#elif defined(NRF24_LINK_MANAGER)
+	radio_set_s1_field_size(4);				// 4bits->link control flag+2bits pid+1bit no_ack flag
+#else
+	radio_set_s1_field_size(3);				// 3bits->2bits pid+1bit no_ack flag
+#endif
+	radio_set_static_payload_size(0);
+	radio_set_max_payload_size(pl_size);
+#elif defined(NRF24_ESB)
 	radio_set_s0_field_size(1);				// 1byte->6bits len+2bits pid
 	radio_set_s1_field_size(1);				// 1bit->no_ack flag
 	radio_set_static_payload_size(pl_size); // static payload len
@@ -103,6 +361,10 @@ void nrf24_set_tx_address(const uint8_t *tx_address)
 		tx_addr_rev[i] = reverse_bit_order(tx_address[i]);
 
 	radio_set_tx_address(tx_addr_rev, 0);
+
+#if defined(NRF24_STATS)
+	tx_stats_select(tx_address);
+#endif
 }
 
 void nrf24_set_rx_address(const uint8_t *rx_address, uint8_t pipe)
@@ -112,7 +374,23 @@ void nrf24_set_rx_address(const uint8_t *rx_address, uint8_t pipe)
 	for (uint8_t i = 0; i < 5; i++)
 		rx_addr_rev[i] = reverse_bit_order(rx_address[i]);
 
+	if (pipe >= NRF24_PIPES)
+		return;
+
 	radio_set_rx_address(rx_addr_rev, pipe);
+	rx_pipes |= 1 << pipe;
+}
+
+// Function to start the reception on all enabled pipes
+static void rx_start()
+{
+#if defined(NRF24_STATS)
+	radio_set_shorts(RADIO_SHORT_ADDRESS_RSSISTART);
+#endif
+	radio_set_rx_logical_addresses(rx_pipes);
+	radio_set_packet_ptr((uint8_t *)&recv_packet);
+	radio_set_mode(MODE_RX);
+	radio_start_rx();
 }
 
 void nrf24_set_mode(nrf24_mode_t mode)
@@ -121,17 +399,33 @@ void nrf24_set_mode(nrf24_mode_t mode)
 	switch (mode)
 	{
 	case NRF24_MODE_RX:
-		radio_set_packet_ptr((uint8_t *)&recv_packet);
-		radio_set_mode(MODE_RX);
-		radio_start_rx();
+	{
+		// the busy-waiting mode change must not run into the sequence of a packet being sent,
+		// so the reception is started by the EGU1 interrupt once the packet is done
+		NRF24_CRITICAL_ENTER();
+		rx_pending = tx_busy;
+		if (!rx_pending)
+			rx_start();
+		NRF24_CRITICAL_EXIT();
 		break;
+	}
 	case NRF24_MODE_TX:
+	{
+		rx_pending = false;
 #if defined(NRF24_ESB)
-		radio_set_rx_logical_address(0); // for receiving ack packets
+		radio_set_rx_logical_addresses(1 << 0); // only pipe 0, for receiving ack packets
+
+		// packets are sent by a hardware sequence starting from DISABLED. A packet already being sent
+		// keeps the RADIO, disabling it would swallow the DISABLED event its sequence waits for
+		NRF24_CRITICAL_ENTER();
+		if (!tx_busy)
+			radio_disable();
+		NRF24_CRITICAL_EXIT();
 #else
 		radio_set_mode(MODE_TX);
 #endif
 		break;
+	}
 	default:
 		break;
 	}
@@ -139,200 +433,1147 @@ void nrf24_set_mode(nrf24_mode_t mode)
 
 #if defined(NRF24_ESB)
 
-void nrf24_tx_and_wait_for_ack()
-{
-
-	nrf24_set_pl_size(32);
-	radio_set_packet_ptr((uint8_t *)p_current_packet);
-	radio_set_mode(MODE_TX);
-	radio_start_tx();
-
-	nrf24_set_pl_size(0);
-	radio_set_packet_ptr((uint8_t *)&recv_ack_packet);
-	radio_set_mode(MODE_RX);
-	radio_start_rx();
-}
-
-void auto_retransmit_handler()
+/* Function to start the ACK timeout. The COMPARE event of hpTimer disables the RADIO through PPI,
+ * which ends the reception like a received ACK does. If no one-shot channel is free, the
+ * retransmit timer disables the RADIO in software instead.
+ */
+static void ack_timeout_start()
 {
+#if !defined(NRF24_HOST_SIM)
+	uint32_t event_address = hpTimer_ppi_event_start(ack_timeout, &ack_timeout_channel);
 
-	if (auto_retransmit_count >= MAX_RETRIES)
+	if (event_address != 0)
 	{
-		softTimer_stop(&auto_retransmit_timer);
-		auto_retransmit_count = 0;
-		nrf24_event.event_type = NRF24_TX_FAILED;
-		nrf24_event.data = NULL;
-		nrf24_event_handler(&nrf24_event);
-		tx_fifo.count--;
-		NRF_EGU1->TASKS_TRIGGER[0] = 1;
+		NRF_PPI->CH[NRF24_PPI_CHANNEL].EEP = event_address;
+		NRF_PPI->CH[NRF24_PPI_CHANNEL].TEP = radio_disable_task_address();
+		NRF_PPI->CHENSET = 1UL << NRF24_PPI_CHANNEL;
 		return;
 	}
-	nrf24_tx_and_wait_for_ack();
-	auto_retransmit_count++;
+#endif
+
+	// the host simulation has no PPI either
+	ack_timeout_channel = HP_TIMER_PPI_CHANNELS;
+	hpTimer_start(&auto_retransmit_timer, ack_timeout);
 }
 
+/* Function to stop the ACK timeout after the reception has ended.
+ */
+static void ack_timeout_stop(bool ack_received)
+{
+#if !defined(NRF24_HOST_SIM)
+	NRF_PPI->CHENCLR = 1UL << NRF24_PPI_CHANNEL;
 #endif
 
-void nrf24_tx_fifo_execute()
-{
-	p_current_packet = &tx_fifo.tx_fifo_buffer[tx_fifo.read_index];
-	tx_fifo.read_index = (tx_fifo.read_index + 1) % NRF24_TX_FIFO_MAX_SIZE;
+	// the channel of a timeout which has fired is released by hpTimer
+	if (ack_received && ack_timeout_channel < HP_TIMER_PPI_CHANNELS)
+		hpTimer_ppi_event_stop(ack_timeout_channel);
+	ack_timeout_channel = HP_TIMER_PPI_CHANNELS;
 
-#if defined(NRF24_ESB)
-	nrf24_tx_and_wait_for_ack();
-	softTimer_start(&auto_retransmit_timer, AUTO_RETRANSMIT_DELAY);
+	hpTimer_stop(&auto_retransmit_timer);
+}
 
+/* Function to send the current packet and receive its ACK.
+ * The RADIO shortcuts run TX ramp-up, TX, disable and RX ramp-up without CPU involvement.
+ * The DISABLED interrupt after the TX only switches the packet pointer to the ACK buffer and starts the timeout.
+ */
+static void esb_tx_start(uint32_t shorts, esb_state_t state, bool ramp_up_started)
+{
+#if defined(NRF24_STATS)
+	p_tx_stats->tx_attempts++;
+	if (auto_retransmit_count)
+		p_tx_stats->tx_retransmits++;
+#if defined(NRF24_DPL)
+	p_tx_stats->tx_airtime_us += stats_airtime_us(p_current_packet->length);
 #else
+	p_tx_stats->tx_airtime_us += stats_airtime_us(NRF24_MAX_PAYLOAD_SIZE);
+#endif
+#endif
+	// TXEN is ignored unless the RADIO is disabled, it may have been left in RX by the receive path
+	if (!ramp_up_started && radio_get_state() != DISABLED)
+		radio_disable();
 
+	esb_state = state;
 	radio_set_packet_ptr((uint8_t *)p_current_packet);
-	radio_start_tx();
+	radio_set_shorts(shorts);
+	radio_enable_disabled_interrupt(true);
 
-	nrf24_event.event_type = NRF24_TX_SUCCESS;
-	nrf24_event.data = NULL;
-	nrf24_event_handler(&nrf24_event);
-	tx_fifo.count--;
-	NRF_EGU1->TASKS_TRIGGER[0] = 1;
-#endif
+	// a DISABLED_TXEN shortcut has already started the TX ramp-up
+	if (!ramp_up_started)
+		radio_enable_mode(MODE_TX);
 }
 
-void nrf24_send(uint8_t *nrf24_tx_msg, uint8_t length)
+void nrf24_tx_and_wait_for_ack()
 {
 
-	if (nrf24_mode == NRF24_MODE_TX)
-	{
-		memset(tx_packet.payload, 0, sizeof(tx_packet.payload));
-#if defined(NRF24_ESB)
-		tx_packet.PID &= 0xFC;
-		tx_packet.PID |= pid;
-		pid++;
-		if (pid > 3)
-			pid = 0;
+#if !defined(NRF24_DPL)
+	nrf24_set_pl_size(32);
 #endif
-		memcpy(tx_packet.payload, nrf24_tx_msg, length);
+	esb_tx_start(SHORTS_TX_ACK, ESB_TX, false);
+}
 
-		if (tx_fifo_empty())
-		{
-			tx_fifo_push(tx_packet);
-			NRF_EGU1->TASKS_TRIGGER[0] = 1;
-		}
-		else
-			tx_fifo_push(tx_packet);
-		if (tx_fifo_full())
-			NRF_EGU1->TASKS_TRIGGER[0] = 1;
+#if defined(NRF24_STREAM)
+/* Function to send the next packet of the burst. The packets are sent back to back through the
+ * DISABLED_TXEN shortcut without ACK, only the last one requests the ACK carrying the bitmap of the receiver.
+ */
+static void stream_send_next(bool ramp_up_started)
+{
+	uint8_t offset = __builtin_ctz(stream_tx.burst);
+
+	stream_tx.burst &= ~(1UL << offset);
+	stream_tx.poll = stream_tx.burst == 0;
+
+	p_current_packet = &stream_tx.packets[(uint8_t)(stream_tx.base + offset) % NRF24_STREAM_WINDOW];
+	p_current_packet->payload[STREAM_BASE] = stream_tx.base;
+
+	if (stream_tx.poll)
+	{
+		p_current_packet->PID |= PCF_ACK_REQUEST;
+		esb_tx_start(SHORTS_TX_ACK, ESB_TX, ramp_up_started);
 	}
 	else
 	{
-		nrf24_event.event_type = NRF24_INVALID_OPERATION;
+		p_current_packet->PID &= ~PCF_ACK_REQUEST;
+		esb_tx_start(SHORTS_TX_NO_ACK, ESB_STREAM_TX, ramp_up_started);
+	}
+}
+
+/* Function to start a burst with all packets of the window which have not been sent or have been lost.
+ */
+static void stream_burst_start()
+{
+	NRF24_CRITICAL_ENTER();
+	stream_tx.burst = stream_tx.pending;
+	stream_tx.pending = 0;
+	NRF24_CRITICAL_EXIT();
+
+	tx_busy = true;
+	p_current_policy = &tx_policy;
+	stream_send_next(false);
+}
+
+/* Function to handle the bitmap ACK of a burst. Packets before the base of the receiver are acknowledged,
+ * the other packets of the window which the receiver has not reported are sent again with the next burst.
+ */
+static void stream_ack_received()
+{
+	uint8_t rx_base = recv_ack_packet.payload[0];
+	uint32_t received;
+	memcpy(&received, &recv_ack_packet.payload[1], sizeof(received));
+
+	NRF24_CRITICAL_ENTER();
+	uint8_t acked = rx_base - stream_tx.base;
+	uint8_t outstanding = stream_tx.next_seq - stream_tx.base;
+
+	// ignore a bitmap which does not match the window
+	if (recv_ack_packet.length < 1 + sizeof(received) || acked > outstanding)
+		acked = 0;
+	else
+	{
+		stream_tx.base = rx_base;
+		stream_tx.pending = STREAM_MASK(outstanding - acked) & ~received;
+	}
+	NRF24_CRITICAL_EXIT();
+
+	stream_tx.poll = false;
+
+	if (acked)
+	{
+		nrf24_event.event_type = NRF24_STREAM_ACK;
 		nrf24_event.data = NULL;
+		nrf24_event.length = acked;
 		nrf24_event_handler(&nrf24_event);
 	}
+
+	tx_busy = false;
+	NRF24_TX_KICK();
 }
 
-void nrf24_handle_packet()
+/* Function to give up the packets of the window when the bitmap ACK could not be received.
+ * The base sent in every packet tells the receiver to skip them.
+ */
+static void stream_failed()
 {
-	switch (nrf24_mode)
-	{
-	case NRF24_MODE_RX:
-#if defined(NRF24_ESB)
-		if (radio_get_received_address() == 1)
-		{
-			radio_set_tx_logical_address(1);
-			nrf24_set_pl_size(0);
-			radio_set_mode(MODE_TX);
-			radio_start_tx();
-			if ((recv_packet.PID & 0x03) != prev_pid)
-			{
-				prev_pid = recv_packet.PID & 0x03;
-				nrf24_event.event_type = NRF24_DATA_READY;
-				nrf24_event.data = recv_packet.payload;
-				nrf24_event_handler(&nrf24_event);
-			}
+	NRF24_CRITICAL_ENTER();
+	stream_tx.base = stream_tx.next_seq;
+	stream_tx.pending = 0;
+	NRF24_CRITICAL_EXIT();
 
-			memset(&recv_packet, 0, sizeof(recv_packet));
-			nrf24_set_pl_size(32);
-			radio_set_mode(MODE_RX);
-			radio_start_rx();
-		}
-#else
-		if (radio_get_received_address() == 1)
-		{
-			nrf24_event.event_type = NRF24_DATA_READY;
-			nrf24_event.data = recv_packet.payload;
-			nrf24_event_handler(&nrf24_event);
-			memset(&recv_packet, 0, sizeof(recv_packet));
-			radio_start_rx();
-		}
+	stream_tx.poll = false;
+	tx_busy = false;
+	NRF24_TX_KICK();
+}
 #endif
 
-		break;
+#if defined(NRF24_LINK_MANAGER)
+/* Function to switch the RADIO to the channel and data rate. The RADIO must not be sending,
+ * the new settings take effect with its next ramp-up.
+ */
+static void link_apply(uint8_t channel, nrf24_data_rate_t data_rate)
+{
+	static const radio_data_rate_t radio_data_rates[] = {RADIO_2MBPS, RADIO_1MBPS, RADIO_LR125KBPS};
 
-	case NRF24_MODE_TX:
+	link.channel = channel;
+	link.data_rate = data_rate;
+	link.attempts = 0;
+	link.packets = 0;
+	link.delivered = 0;
+	link.clean_windows = 0;
 
-#if defined(NRF24_ESB)
-		if (radio_get_received_address() == 0)
-		{
-			softTimer_stop(&auto_retransmit_timer);
-			auto_retransmit_count = 0;
-			nrf24_event.event_type = NRF24_TX_SUCCESS;
-			nrf24_event.data = NULL;
-			nrf24_event_handler(&nrf24_event);
-			tx_fifo.count--; // decrement the count value after the TX has completed
-			NRF_EGU1->TASKS_TRIGGER[0] = 1;
-		}
-#endif
+	air_bit_time_ns = data_rate == NRF24_2MBPS ? 500 : data_rate == NRF24_1MBPS ? 1000 : 8000;
+	radio_set_frequency(channel);
+	radio_set_data_rate(radio_data_rates[data_rate]);
 
-		break;
-	default:
-		break;
-	}
+	// the Coded PHY only supports addresses of 4 bytes, like the BLE access address
+	radio_set_address_width(data_rate == NRF24_125KBPS ? 4 : 5);
+	ack_timeout = data_rate == NRF24_125KBPS ? ACK_TIMEOUT_CODED : ACK_TIMEOUT;
+	auto_retransmit_delay = data_rate == NRF24_125KBPS ? AUTO_RETRANSMIT_DELAY_CODED : AUTO_RETRANSMIT_DELAY;
+
+	nrf24_event.event_type = NRF24_LINK_CHANGED;
+	nrf24_event.data = NULL;
+	nrf24_event_handler(&nrf24_event);
 }
 
-void radio_evnt_handler()
+// Function to restart the reception, so that a receiver listens with the new settings
+static void link_restart_rx()
 {
+	memset(&recv_packet, 0, sizeof(recv_packet));
+	radio_set_packet_ptr((uint8_t *)&recv_packet);
+	radio_set_mode(MODE_RX);
+	radio_start_rx();
+}
 
-	nrf24_handle_packet();
+/* Function to return to channels[0] at 1 Mbps, where both nodes meet again after a link loss.
+ */
+static void link_go_home()
+{
+	link.control_pending = false;
+	link.failures = 0;
+	link.last_step = LINK_STEP_NONE;
+
+	if (link.channel == link.config.channels[0] && link.data_rate == NRF24_1MBPS)
+		return;
+
+	link_apply(link.config.channels[0], NRF24_1MBPS);
+
+	if (nrf24_mode == NRF24_MODE_RX)
+		link_restart_rx();
 }
 
-void egu1_init()
+// Function to restart the idle timeout after traffic on the link
+static void link_activity()
 {
-	NRF_EGU1->INTENSET = 1UL;
-	NVIC_EnableIRQ(SWI1_EGU1_IRQn);
+	softTimer_start(&link_idle_timer, MS_TO_TICKS(link.config.idle_timeout_ms));
 }
 
-void nrf24_init()
+static void link_idle_handler(void *context)
 {
-	egu1_init();
-	uint32_t nrf24_crc_poly = 0x11021UL;
-	radio_set_payload_endian(RADIO_BIG_ENDIAN);
-	radio_configure_crc(2, 0, nrf24_crc_poly, 0xFFFF);
-	radio_enable_whitening(0);
-#if defined(NRF24_ESB)
-	softTimer_create(&auto_retransmit_timer, auto_retransmit_handler, SOFT_TIMER_MODE_REPEATED);
-#else
-	nrf24_set_pl_size(32);
-#endif
-	radio_set_data_rate(RADIO_1MBPS);
-	radio_set_frequency(76);
-	radio_set_address_width(5);
-	radio_set_tx_power(0x00);
-	radio_set_evt_handler(radio_evnt_handler);
-	radio_enable_interrupts();
+	// the settings are changed by egu1_handler(), between two transmissions
+	link.home_pending = true;
+	NRF24_TX_KICK();
 }
 
-void egu1_handler()
+/* Function to queue the link control packet announcing the new settings. It is sent before the next packet of the FIFO.
+ */
+static void link_control_queue(uint8_t channel, nrf24_data_rate_t data_rate)
 {
-	if (!tx_fifo_empty())
+	nrf24_packet_t *p_packet = &link.control_packet;
+
+	PCF_SET_PID(*p_packet, link.control_pid);
+	link.control_pid = (link.control_pid + 1) & 0x03;
+	p_packet->PID |= PCF_LINK_CONTROL;
+	p_packet->length = LINK_CONTROL_LENGTH;
+	p_packet->payload[LINK_CONTROL_CHANNEL] = channel;
+	p_packet->payload[LINK_CONTROL_RATE] = data_rate;
+	link.control_pending = true;
+}
+
+static void link_control_send()
+{
+	link.control_pending = false;
+	link.control_tx = true;
+	p_current_packet = &link.control_packet;
+	p_current_policy = &tx_policy;
+	tx_busy = true;
+	nrf24_tx_and_wait_for_ack();
+}
+
+/* Function to complete the transmission of the link control packet. The transmitter switches once the
+ * receiver has acknowledged it. Without the ACK it is not known whether the receiver has switched, so
+ * both nodes meet at the home settings again.
+ */
+static void link_control_done(bool acked)
+{
+	auto_retransmit_count = 0;
+	link.control_tx = false;
+
+	if (acked)
 	{
-		nrf24_tx_fifo_execute();
+		link_apply(link.control_packet.payload[LINK_CONTROL_CHANNEL], link.control_packet.payload[LINK_CONTROL_RATE]);
+		link_activity();
 	}
+	else
+		link_go_home();
+
+	tx_busy = false;
+	NRF24_TX_KICK();
 }
 
-void SWI1_EGU1_IRQHandler()
+/* Function to decide on the link at the end of a window. The packet error rate is the share of TX attempts
+ * that have not been acknowledged. A bad channel is left first; if the next channel is bad too, the range
+ * is the problem and the data rate is stepped down.
+ */
+static void link_evaluate()
 {
+	bool can_step_down = link.data_rate == NRF24_2MBPS || (link.data_rate == NRF24_1MBPS && link.config.coded_phy);
 
-	if (NRF_EGU1->EVENTS_TRIGGERED[0])
+	if (link.per > link.config.per_high)
 	{
-		NRF_EGU1->EVENTS_TRIGGERED[0] = 0;
-		egu1_handler();
+		link.clean_windows = 0;
+
+		if (can_step_down && (link.last_step == LINK_STEP_CHANNEL || link.config.channel_count < 2))
+		{
+			link.last_step = LINK_STEP_RATE;
+			link_control_queue(link.channel, link.data_rate + 1);
+		}
+		else if (link.config.channel_count > 1)
+		{
+			uint8_t index = 0;
+			while (index < link.config.channel_count - 1 && link.config.channels[index] != link.channel)
+				index++;
+
+			link.last_step = LINK_STEP_CHANNEL;
+			link_control_queue(link.config.channels[(index + 1) % link.config.channel_count], link.data_rate);
+		}
+	}
+	else if (link.per > link.config.per_low)
+		link.clean_windows = 0;
+	else if (link.data_rate != NRF24_2MBPS && ++link.clean_windows >= LINK_UPGRADE_WINDOWS)
+	{
+		link.last_step = LINK_STEP_NONE;
+		link_control_queue(link.channel, link.data_rate - 1);
 	}
 }
+
+/* Function to account the TX attempts of a packet, when it has been acknowledged or has failed.
+ */
+static void link_tx_done(bool delivered)
+{
+	if (!link.enabled)
+		return;
+
+	link.attempts += auto_retransmit_count + 1;
+	link.packets++;
+
+	if (delivered)
+	{
+		link.delivered++;
+		link.failures = 0;
+		link_activity();
+	}
+	else if (++link.failures >= LINK_LOSS_FAILURES)
+	{
+		link.home_pending = true;
+		return;
+	}
+
+	if (link.packets < link.config.window)
+		return;
+
+	link.per = (uint32_t)(link.attempts - link.delivered) * 100 / link.attempts;
+	link.attempts = 0;
+	link.packets = 0;
+	link.delivered = 0;
+
+	if (!link.control_pending)
+		link_evaluate();
+}
+
+/* Function to handle a link control packet. It is acknowledged with the current settings,
+ * then the receiver switches to the settings it announces. If the ACK is lost, the transmitter
+ * returns home and the receiver follows it there after the idle timeout.
+ */
+static void link_control_received(uint8_t pipe)
+{
+	uint8_t channel = recv_packet.payload[LINK_CONTROL_CHANNEL];
+	nrf24_data_rate_t data_rate = recv_packet.payload[LINK_CONTROL_RATE];
+
+	// settings the receiver can't follow are not acknowledged, the transmitter returns home after the retries
+	bool valid = link.enabled && recv_packet.length == LINK_CONTROL_LENGTH && channel <= LINK_MAX_CHANNEL &&
+				 (data_rate < NRF24_125KBPS || (data_rate == NRF24_125KBPS && link.config.coded_phy));
+
+	if (valid)
+	{
+		ack_packets[pipe].PID = recv_packet.PID;
+		ack_packets[pipe].length = 0;
+
+		radio_set_tx_logical_address(pipe);
+		radio_set_packet_ptr((uint8_t *)&ack_packets[pipe]);
+		radio_set_mode(MODE_TX);
+		radio_start_tx();
+
+		link_apply(channel, data_rate);
+	}
+
+	link_restart_rx();
+}
+#endif
+
+/* Function to start the RNG, which generates one random byte in the background and stops.
+ */
+static void rng_init()
+{
+#if !defined(NRF24_HOST_SIM)
+	NRF_RNG->SHORTS = 1; // VALRDY_STOP
+	NRF_RNG->EVENTS_VALRDY = 0;
+	NRF_RNG->TASKS_START = 1;
+#endif
+}
+
+/* Function to get a random backoff of up to backoff_us microseconds.
+ * The byte generated since the previous call is used and the next one is started, so there is no wait for the RNG.
+ */
+static uint32_t retransmit_backoff(uint16_t backoff_us)
+{
+#if defined(NRF24_HOST_SIM)
+	uint8_t random = rand() & 0xFF;
+#else
+	uint8_t random = NRF_RNG->VALUE;
+
+	NRF_RNG->EVENTS_VALRDY = 0;
+	NRF_RNG->TASKS_START = 1;
+#endif
+
+	return (uint32_t)random * backoff_us / 255;
+}
+
+static void nrf24_ack_received()
+{
+#if defined(NRF24_STATS)
+	p_tx_stats->tx_delivered++;
+	p_tx_stats->ack_rssi = radio_get_rssi();
+#endif
+#if defined(NRF24_LINK_MANAGER)
+	if (link.control_tx)
+	{
+		link_control_done(true);
+		return;
+	}
+	link_tx_done(true);
+#endif
+	auto_retransmit_count = 0;
+#if defined(NRF24_STREAM)
+	if (stream_tx.poll)
+	{
+		stream_ack_received();
+		return;
+	}
+#endif
+#if defined(NRF24_DPL)
+	if (recv_ack_packet.length)
+	{
+		nrf24_event.event_type = NRF24_ACK_PAYLOAD_RECEIVED;
+		nrf24_event.data = recv_ack_packet.payload;
+		nrf24_event.length = recv_ack_packet.length;
+		nrf24_event_handler(&nrf24_event);
+	}
+#endif
+	nrf24_event.event_type = NRF24_TX_SUCCESS;
+	nrf24_event.data = NULL;
+	nrf24_event_handler(&nrf24_event);
+	tx_fifo_release(); // release the packet after the TX has completed
+}
+
+static void nrf24_ack_timeout()
+{
+	if (auto_retransmit_count >= p_current_policy->max_retries)
+	{
+#if defined(NRF24_STATS)
+		p_tx_stats->tx_failures++;
+#endif
+#if defined(NRF24_LINK_MANAGER)
+		if (link.control_tx)
+		{
+			link_control_done(false);
+			return;
+		}
+		link_tx_done(false);
+#endif
+		auto_retransmit_count = 0;
+		nrf24_event.event_type = NRF24_TX_FAILED;
+		nrf24_event.data = NULL;
+		nrf24_event_handler(&nrf24_event);
+#if defined(NRF24_STREAM)
+		if (stream_tx.poll)
+		{
+			stream_failed();
+			return;
+		}
+#endif
+		tx_fifo_release();
+		return;
+	}
+
+	// retransmit the delay of the policy after the previous transmission, the ACK timeout has already passed
+	uint32_t delay = p_current_policy->retransmit_delay_us ? p_current_policy->retransmit_delay_us : auto_retransmit_delay;
+
+	if (p_current_policy->backoff_us)
+		delay += retransmit_backoff(p_current_policy->backoff_us);
+
+	auto_retransmit_count++;
+	hpTimer_start(&auto_retransmit_timer, delay > ack_timeout ? delay - ack_timeout : 0);
+}
+
+/* Function to handle the DISABLED event of the RADIO, at the end of the TX and at the end of the ACK reception.
+ */
+void nrf24_radio_disabled_handler()
+{
+	switch (esb_state)
+	{
+	case ESB_TX:
+		// the DISABLED_RXEN shortcut has started the RX ramp-up, which leaves time to set up the reception
+		radio_end_event();
+#if !defined(NRF24_DPL)
+		nrf24_set_pl_size(0);
+#endif
+		radio_set_packet_ptr((uint8_t *)&recv_ack_packet);
+#if defined(NRF24_STATS)
+		radio_set_shorts(RADIO_SHORT_READY_START | RADIO_SHORT_END_DISABLE | RADIO_SHORT_ADDRESS_RSSISTART);
+#else
+		radio_set_shorts(RADIO_SHORT_READY_START | RADIO_SHORT_END_DISABLE);
+#endif
+		esb_state = ESB_WAIT_ACK;
+		ack_timeout_start();
+		break;
+
+	case ESB_WAIT_ACK:
+	{
+		// the END event is only set if a packet has been received before the timeout
+		bool ack_received = radio_end_event() && radio_get_crc_status() && radio_get_received_address() == 0;
+
+		ack_timeout_stop(ack_received);
+		radio_set_shorts(0);
+		radio_enable_disabled_interrupt(false);
+		esb_state = ESB_IDLE;
+
+		if (ack_received)
+			nrf24_ack_received();
+		else
+			nrf24_ack_timeout();
+		break;
+	}
+
+#if defined(NRF24_STREAM)
+	case ESB_STREAM_TX:
+		// the DISABLED_TXEN shortcut has started the ramp-up of the next packet
+		radio_end_event();
+		stream_send_next(true);
+		break;
+#endif
+
+	default:
+		break;
+	}
+}
+
+void auto_retransmit_handler(void *context)
+{
+	// without a free PPI channel the ACK timeout is handled in software
+	if (esb_state == ESB_WAIT_ACK)
+	{
+		radio_trigger_disable();
+		return;
+	}
+
+	nrf24_tx_and_wait_for_ack();
+}
+
+#endif
+
+void nrf24_tx_fifo_execute()
+{
+	p_current_packet = &tx_fifo.tx_fifo_buffer[tx_fifo.read_index % NRF24_TX_FIFO_SIZE];
+	tx_busy = true;
+
+#if defined(NRF24_ESB)
+	p_current_policy = &tx_fifo.tx_policy[tx_fifo.read_index % NRF24_TX_FIFO_SIZE];
+	nrf24_tx_and_wait_for_ack();
+
+#else
+
+	radio_set_packet_ptr((uint8_t *)p_current_packet);
+	radio_start_tx();
+
+	nrf24_event.event_type = NRF24_TX_SUCCESS;
+	nrf24_event.data = NULL;
+	nrf24_event_handler(&nrf24_event);
+	tx_fifo_release();
+#endif
+}
+
+/* Function to get the slot of the next packet. The caller writes the payload into the slot
+ * and queues it with nrf24_tx_commit(), so the message is not copied again.
+ */
+nrf24_packet_t *nrf24_tx_reserve()
+{
+	if (tx_fifo_full())
+		return NULL;
+
+	return &tx_fifo.tx_fifo_buffer[tx_fifo.write_index % NRF24_TX_FIFO_SIZE];
+}
+
+/* Function to queue the reserved packet. The packet control field is filled in here.
+ * The EGU1 interrupt starts the packet if no other packet is being sent.
+ */
+void nrf24_tx_commit(uint8_t length)
+{
+	nrf24_tx_commit_with_policy(length, &tx_policy);
+}
+
+void nrf24_tx_commit_with_policy(uint8_t length, const nrf24_tx_policy_t *policy)
+{
+	if (nrf24_mode != NRF24_MODE_TX)
+	{
+		nrf24_event.event_type = NRF24_INVALID_OPERATION;
+		nrf24_event.data = NULL;
+		nrf24_event_handler(&nrf24_event);
+		return;
+	}
+
+	if (tx_fifo_full())
+		return;
+
+	nrf24_packet_t *p_packet = &tx_fifo.tx_fifo_buffer[tx_fifo.write_index % NRF24_TX_FIFO_SIZE];
+
+	if (length > NRF24_MAX_PAYLOAD_SIZE)
+		length = NRF24_MAX_PAYLOAD_SIZE;
+
+#if defined(NRF24_ESB)
+	PCF_SET_PID(*p_packet, pid);
+	pid++;
+	if (pid > 3)
+		pid = 0;
+#endif
+#if defined(NRF24_DPL)
+	p_packet->length = length;
+#else
+	memset(p_packet->payload + length, 0, NRF24_MAX_PAYLOAD_SIZE - length); // static payloads are padded with zeros
+#endif
+	tx_fifo.tx_policy[tx_fifo.write_index % NRF24_TX_FIFO_SIZE] = *policy;
+
+	// the packet must be complete in RAM before the interrupt can see it
+	__DMB();
+	tx_fifo.write_index++;
+
+	NRF24_TX_KICK();
+}
+
+void nrf24_set_tx_policy(const nrf24_tx_policy_t *policy)
+{
+	tx_policy = *policy;
+}
+
+void nrf24_send(uint8_t *nrf24_tx_msg, uint8_t length)
+{
+	nrf24_send_with_policy(nrf24_tx_msg, length, &tx_policy);
+}
+
+void nrf24_send_with_policy(uint8_t *nrf24_tx_msg, uint8_t length, const nrf24_tx_policy_t *policy)
+{
+	if (nrf24_mode != NRF24_MODE_TX)
+	{
+		nrf24_event.event_type = NRF24_INVALID_OPERATION;
+		nrf24_event.data = NULL;
+		nrf24_event_handler(&nrf24_event);
+		return;
+	}
+
+	nrf24_packet_t *p_packet = nrf24_tx_reserve();
+
+	if (p_packet == NULL)
+	{
+		debug_log_print("TX fifo is full\n");
+		return;
+	}
+
+	if (length > NRF24_MAX_PAYLOAD_SIZE)
+		length = NRF24_MAX_PAYLOAD_SIZE;
+
+	memcpy(p_packet->payload, nrf24_tx_msg, length);
+	nrf24_tx_commit_with_policy(length, policy);
+}
+
+#if defined(NRF24_STREAM)
+/* Function to add a packet to the window of the stream transmitter.
+ * Packets of the FIFO are sent first, stream packets are sent in bursts when the FIFO is empty.
+ */
+bool nrf24_stream_write(const uint8_t *data, uint8_t length)
+{
+	if (nrf24_mode != NRF24_MODE_TX)
+		return false;
+
+	if ((uint8_t)(stream_tx.next_seq - stream_tx.base) >= NRF24_STREAM_WINDOW)
+		return false;
+
+	if (length > NRF24_STREAM_PAYLOAD_SIZE)
+		length = NRF24_STREAM_PAYLOAD_SIZE;
+
+	uint8_t seq = stream_tx.next_seq;
+	nrf24_packet_t *p_packet = &stream_tx.packets[seq % NRF24_STREAM_WINDOW];
+
+	PCF_SET_PID(*p_packet, pid);
+	pid = (pid + 1) & 0x03;
+	p_packet->PID |= PCF_STREAM;
+	p_packet->length = STREAM_DATA + length;
+	p_packet->payload[STREAM_SEQ] = seq;
+	memcpy(&p_packet->payload[STREAM_DATA], data, length);
+
+	NRF24_CRITICAL_ENTER();
+	stream_tx.pending |= 1UL << (uint8_t)(seq - stream_tx.base);
+	stream_tx.next_seq = seq + 1;
+	NRF24_CRITICAL_EXIT();
+
+	NRF24_TX_KICK();
+	return true;
+}
+
+void nrf24_stream_listen(uint8_t pipe)
+{
+	stream_rx.base = 0;
+	stream_rx.received = 0;
+	stream_rx.pipe = pipe;
+}
+
+/* Function to store a received stream packet in the window.
+ * The window first moves up to the base of the sender, the packets before it have been given up.
+ */
+static void stream_rx_store()
+{
+	uint8_t seq = recv_packet.payload[STREAM_SEQ];
+	uint8_t tx_base = recv_packet.payload[STREAM_BASE];
+	uint8_t skip = tx_base - stream_rx.base;
+
+	if (recv_packet.length < STREAM_DATA)
+		return;
+
+	// a base up to half the sequence space ahead is new, older ones come from retransmitted packets
+	if (skip && skip < 0x80)
+	{
+		stream_rx.received = skip >= 32 ? 0 : stream_rx.received >> skip;
+		stream_rx.base = tx_base;
+	}
+
+	uint8_t offset = seq - stream_rx.base;
+
+	if (offset < NRF24_STREAM_WINDOW && !(stream_rx.received & (1UL << offset)))
+	{
+		stream_rx.packets[seq % NRF24_STREAM_WINDOW] = recv_packet;
+		stream_rx.received |= 1UL << offset;
+	}
+}
+
+/* Function to deliver the packets at the base of the window in order.
+ */
+static void stream_rx_deliver(uint8_t pipe)
+{
+	while (stream_rx.received & 1)
+	{
+		nrf24_packet_t *p_packet = &stream_rx.packets[stream_rx.base % NRF24_STREAM_WINDOW];
+
+		stream_rx.received >>= 1;
+		stream_rx.base++;
+
+		nrf24_event.event_type = NRF24_DATA_READY;
+		nrf24_event.data = &p_packet->payload[STREAM_DATA];
+		nrf24_event.length = p_packet->length - STREAM_DATA;
+		nrf24_event.pipe = pipe;
+		nrf24_event_handler(&nrf24_event);
+	}
+}
+
+/* Function to handle a packet of the stream. The ACK requested by the last packet of a burst
+ * carries the base of the window and the bitmap of the packets received after it.
+ */
+static void stream_rx_packet(uint8_t pipe)
+{
+	stream_rx_store();
+
+	if (recv_packet.PID & PCF_ACK_REQUEST)
+	{
+		// packets received in order are acknowledged before they are delivered
+		uint8_t base = stream_rx.base;
+		uint32_t received = stream_rx.received;
+
+		while (received & 1)
+		{
+			received >>= 1;
+			base++;
+		}
+
+		ack_packets[pipe].PID = recv_packet.PID;
+		ack_packets[pipe].length = 1 + sizeof(received);
+		ack_packets[pipe].payload[0] = base;
+		memcpy(&ack_packets[pipe].payload[1], &received, sizeof(received));
+
+		radio_set_tx_logical_address(pipe);
+		radio_set_packet_ptr((uint8_t *)&ack_packets[pipe]);
+		radio_set_mode(MODE_TX);
+		radio_start_tx();
+
+		memset(&recv_packet, 0, sizeof(recv_packet));
+		radio_set_packet_ptr((uint8_t *)&recv_packet);
+		radio_set_mode(MODE_RX);
+	}
+
+	/* The packet is in the window, so listen again before the handlers run. Without a TX/RX switch
+	 * the RADIO is in RX_IDLE and starts at once, the next packet of the burst follows ~136 us after END.
+	 */
+	radio_start_rx();
+
+	stream_rx_deliver(pipe);
+}
+#endif
+
+void nrf24_handle_packet()
+{
+	switch (nrf24_mode)
+	{
+	case NRF24_MODE_RX:
+	{
+		uint8_t pipe = radio_get_received_address();
+
+		// packets with CRC errors are not acknowledged, the transmitter sends them again
+		if (!radio_get_crc_status() || !(rx_pipes & (1 << pipe)))
+		{
+#if defined(NRF24_STATS)
+			if (rx_pipes & (1 << pipe))
+				stats[pipe].rx_crc_errors++;
+#endif
+			memset(&recv_packet, 0, sizeof(recv_packet));
+			radio_start_rx();
+			break;
+		}
+
+#if defined(NRF24_STATS)
+		stats[pipe].rx_packets++;
+		stats[pipe].rx_rssi = radio_get_rssi();
+#endif
+
+#if defined(NRF24_LINK_MANAGER)
+		link_activity();
+
+		if (recv_packet.PID & PCF_LINK_CONTROL)
+		{
+			link_control_received(pipe);
+			break;
+		}
+#endif
+
+#if defined(NRF24_STREAM)
+		if (recv_packet.PID & PCF_STREAM)
+		{
+			if (pipe == stream_rx.pipe)
+				stream_rx_packet(pipe);
+			else
+			{
+				// without a listening receiver the bitmap is not acknowledged, the sender gives the window up
+				memset(&recv_packet, 0, sizeof(recv_packet));
+				radio_start_rx();
+			}
+			break;
+		}
+#endif
+
+#if defined(NRF24_ESB)
+		// a packet with the PID and CRC of the previous packet of the pipe is a retransmission whose ACK was lost
+		uint32_t crc = radio_get_rx_crc();
+		bool new_packet = PCF_GET_PID(recv_packet) != prev_pid[pipe] || crc != prev_crc[pipe];
+
+		radio_set_tx_logical_address(pipe);
+#if defined(NRF24_DPL)
+		bool ack_payload_sent = nrf24_prepare_ack(pipe, new_packet);
+		radio_set_packet_ptr((uint8_t *)&ack_packets[pipe]);
+#else
+		nrf24_set_pl_size(0);
+#endif
+		radio_set_mode(MODE_TX);
+		radio_start_tx();
+#if defined(NRF24_STATS)
+		if (!new_packet)
+			stats[pipe].rx_duplicates++;
+#endif
+		if (new_packet)
+		{
+			prev_pid[pipe] = PCF_GET_PID(recv_packet);
+			prev_crc[pipe] = crc;
+			nrf24_event.event_type = NRF24_DATA_READY;
+			nrf24_event.data = recv_packet.payload;
+#if defined(NRF24_DPL)
+			nrf24_event.length = recv_packet.length;
+#else
+			nrf24_event.length = NRF24_MAX_PAYLOAD_SIZE;
+#endif
+			nrf24_event.pipe = pipe;
+			nrf24_event_handler(&nrf24_event);
+		}
+
+#if defined(NRF24_DPL)
+		if (ack_payload_sent)
+		{
+			nrf24_event.event_type = NRF24_ACK_SENT;
+			nrf24_event.data = NULL;
+			nrf24_event.pipe = pipe;
+			nrf24_event_handler(&nrf24_event);
+		}
+#endif
+
+		memset(&recv_packet, 0, sizeof(recv_packet));
+#if defined(NRF24_DPL)
+		radio_set_packet_ptr((uint8_t *)&recv_packet);
+#else
+		nrf24_set_pl_size(32);
+#endif
+		// the handler may have switched to TX mode to answer or forward the packet
+		if (nrf24_mode == NRF24_MODE_RX)
+		{
+			radio_set_mode(MODE_RX);
+			radio_start_rx();
+		}
+#else
+		nrf24_event.event_type = NRF24_DATA_READY;
+		nrf24_event.data = recv_packet.payload;
+		nrf24_event.length = NRF24_MAX_PAYLOAD_SIZE;
+		nrf24_event.pipe = pipe;
+		nrf24_event_handler(&nrf24_event);
+		memset(&recv_packet, 0, sizeof(recv_packet));
+		// the handler may have switched to TX mode to answer or forward the packet
+		if (nrf24_mode == NRF24_MODE_RX)
+			radio_start_rx();
+#endif
+
+		break;
+	}
+
+	case NRF24_MODE_TX:
+		// ACKs are handled by nrf24_radio_disabled_handler()
+		break;
+	default:
+		break;
+	}
+}
+
+void radio_evnt_handler()
+{
+
+	nrf24_handle_packet();
+}
+
+void egu1_init()
+{
+#if !defined(NRF24_HOST_SIM)
+	NRF_EGU1->INTENSET = 1UL;
+	// same priority as the RADIO and TIMER4 interrupts, so read_index and tx_busy have a single writer context
+	NVIC_SetPriority(SWI1_EGU1_IRQn, EGU1_IRQ_PRIORITY);
+	NVIC_EnableIRQ(SWI1_EGU1_IRQn);
+#endif
+}
+
+void nrf24_init()
+{
+	egu1_init();
+#if defined(NRF24_ESB)
+	memset(prev_pid, 4, sizeof(prev_pid));
+#endif
+	uint32_t nrf24_crc_poly = 0x11021UL;
+	radio_set_payload_endian(RADIO_BIG_ENDIAN);
+	radio_configure_crc(2, 0, nrf24_crc_poly, 0xFFFF);
+	radio_enable_whitening(0);
+#if defined(NRF24_ESB)
+	hpTimer_init();
+	hpTimer_create(&auto_retransmit_timer, auto_retransmit_handler, HP_TIMER_MODE_SINGLE_SHOT, NULL);
+	rng_init();
+	radio_set_disabled_evt_handler(nrf24_radio_disabled_handler);
+#if defined(NRF24_DPL)
+	nrf24_set_pl_size(NRF24_MAX_PAYLOAD_SIZE);
+#endif
+#else
+	nrf24_set_pl_size(32);
+#endif
+	radio_set_data_rate(RADIO_1MBPS);
+	radio_set_frequency(76);
+	radio_set_address_width(5);
+	radio_set_tx_power(0x00);
+	radio_set_evt_handler(radio_evnt_handler);
+	radio_enable_interrupts();
+}
+
+#if defined(NRF24_LINK_MANAGER)
+void nrf24_link_manager_init(const nrf24_link_config_t *config)
+{
+	link.config = *config;
+
+	if (link.config.channel_count == 0)
+	{
+		link.config.channels[0] = 76;
+		link.config.channel_count = 1;
+	}
+	if (link.config.channel_count > NRF24_LINK_CHANNELS)
+		link.config.channel_count = NRF24_LINK_CHANNELS;
+	if (link.config.window == 0)
+		link.config.window = 1;
+	// a receiver whose ACK of a link control packet was lost only finds the transmitter again at home
+	if (link.config.idle_timeout_ms == 0)
+		link.config.idle_timeout_ms = LINK_IDLE_TIMEOUT_DEFAULT_MS;
+
+	softTimer_create(&link_idle_timer, link_idle_handler, SOFT_TIMER_MODE_SINGLE_SHOT, NULL);
+
+	link.enabled = true;
+	link_apply(link.config.channels[0], NRF24_1MBPS);
+	link_activity();
+}
+
+void nrf24_link_get_status(nrf24_link_status_t *status)
+{
+	status->channel = link.channel;
+	status->data_rate = link.data_rate;
+	status->per = link.per;
+}
+#endif
+
+#if defined(NRF24_STATS)
+/* Function to read the statistics of a pipe.
+ * The counters are updated by the RADIO interrupt, so they are copied within the critical section.
+ */
+void nrf24_get_stats(uint8_t pipe, nrf24_stats_t *p_stats)
+{
+	if (pipe >= NRF24_PIPES)
+		return;
+
+	NRF24_CRITICAL_ENTER();
+	*p_stats = stats[pipe];
+	NRF24_CRITICAL_EXIT();
+}
+
+void nrf24_reset_stats(uint8_t pipe)
+{
+	if (pipe >= NRF24_PIPES)
+		return;
+
+	NRF24_CRITICAL_ENTER();
+	stats[pipe] = (nrf24_stats_t){0};
+	NRF24_CRITICAL_EXIT();
+}
+
+bool nrf24_get_tx_stats(const uint8_t *tx_address, nrf24_tx_stats_t *p_stats)
+{
+	nrf24_tx_stats_t *p_link = tx_stats_find(tx_address);
+
+	if (p_link == NULL)
+		return false;
+
+	NRF24_CRITICAL_ENTER();
+	*p_stats = *p_link;
+	NRF24_CRITICAL_EXIT();
+
+	return true;
+}
+
+/* Function to clear the TX statistics of all links. The counters of the current TX address start again from zero.
+ */
+void nrf24_reset_tx_stats()
+{
+	NRF24_CRITICAL_ENTER();
+	for (uint8_t link = 0; link < NRF24_STATS_TX_LINKS; link++)
+	{
+		uint8_t address[5];
+
+		memcpy(address, tx_stats[link].address, 5);
+		tx_stats[link] = (nrf24_tx_stats_t){0};
+		memcpy(tx_stats[link].address, address, 5);
+	}
+	NRF24_CRITICAL_EXIT();
+}
+
+/* Function to print the statistics of all TX links and pipes with traffic.
+ * PER is the share of TX attempts that were not acknowledged, in percent.
+ */
+void nrf24_print_stats()
+{
+	for (uint8_t link = 0; link < NRF24_STATS_TX_LINKS; link++)
+	{
+		nrf24_tx_stats_t link_stats;
+
+		NRF24_CRITICAL_ENTER();
+		link_stats = tx_stats[link];
+		NRF24_CRITICAL_EXIT();
+
+		if (link_stats.tx_attempts)
+			debug_log_print("tx %X:%X:%X:%X:%X: attempts=%lu retransmits=%lu failures=%lu PER=%lu%% airtime=%luus ack_rssi=%ddBm\r\n",
+							link_stats.address[0], link_stats.address[1], link_stats.address[2], link_stats.address[3], link_stats.address[4],
+							(unsigned long)link_stats.tx_attempts, (unsigned long)link_stats.tx_retransmits, (unsigned long)link_stats.tx_failures,
+							(unsigned long)((link_stats.tx_attempts - link_stats.tx_delivered) * 100 / link_stats.tx_attempts),
+							(unsigned long)link_stats.tx_airtime_us, link_stats.ack_rssi);
+	}
+
+	for (uint8_t pipe = 0; pipe < NRF24_PIPES; pipe++)
+	{
+		nrf24_stats_t pipe_stats;
+		nrf24_get_stats(pipe, &pipe_stats);
+
+		if (pipe_stats.rx_packets || pipe_stats.rx_crc_errors)
+			debug_log_print("pipe %d rx: packets=%lu duplicates=%lu crc_errors=%lu rssi=%ddBm\r\n", pipe,
+							(unsigned long)pipe_stats.rx_packets, (unsigned long)pipe_stats.rx_duplicates,
+							(unsigned long)pipe_stats.rx_crc_errors, pipe_stats.rx_rssi);
+	}
+}
+#endif
+
+void egu1_handler()
+{
+	if (tx_busy)
+		return;
+
+#if defined(NRF24_LINK_MANAGER)
+	if (link.home_pending)
+	{
+		link.home_pending = false;
+		link_go_home();
+	}
+
+	if (link.control_pending)
+	{
+		link_control_send();
+		return;
+	}
+#endif
+
+	if (!tx_fifo_empty())
+	{
+		nrf24_tx_fifo_execute();
+		return;
+	}
+#if defined(NRF24_STREAM)
+	if (stream_tx.pending)
+	{
+		stream_burst_start();
+		return;
+	}
+#endif
+
+	if (rx_pending)
+	{
+		rx_pending = false;
+		rx_start();
+	}
+}
+
+#if !defined(NRF24_HOST_SIM)
+void SWI1_EGU1_IRQHandler()
+{
+
+	if (NRF_EGU1->EVENTS_TRIGGERED[0])
+	{
+		NRF_EGU1->EVENTS_TRIGGERED[0] = 0;
+		egu1_handler();
+	}
+}
+#endif
@@ -1,15 +1,45 @@
 #ifndef NRF24_H
 #define NRF24_H
-#define NRF24_TX_FIFO_MAX_SIZE 1024
+#ifndef NRF24_TX_FIFO_SIZE
+#define NRF24_TX_FIFO_SIZE 8 // Number of packets in the TX FIFO, a power of two
+#endif
+#if (NRF24_TX_FIFO_SIZE & (NRF24_TX_FIFO_SIZE - 1)) || NRF24_TX_FIFO_SIZE > 0x8000
+#error "NRF24_TX_FIFO_SIZE must be a power of two up to 0x8000"
+#endif
+#if defined(NRF24_HOST_SIM)
+#include "RADIO_sim.h"
+#define NRF24_STATE RADIO_SIM_NODE_STATE // Globals holding the state of a node, swapped by RADIO_sim between the simulated nodes
+#else
+#define NRF24_STATE
+#endif
 #define NRF24_ESB
+#define NRF24_DPL				  // Dynamic payload length: the payload length is sent in the packet control field of every packet
+#define NRF24_MAX_PAYLOAD_SIZE 32 // Maximum payload length in bytes
+#define NRF24_PIPES 8			  // Number of receive pipes (logical addresses of the RADIO)
+#if defined(NRF24_ESB)
+#define NRF24_STATS // Per pipe RX and per TX address link statistics, see nrf24_get_stats() and nrf24_get_tx_stats()
+#endif
+#define NRF24_STATS_TX_LINKS 8 // Number of TX addresses with their own TX statistics
+#if defined(NRF24_DPL)
+// #define NRF24_STREAM // Streaming mode: bursts of NO_ACK packets acknowledged by a bitmap in the ACK payload of the last one. Adds a S1 bit, so both nodes must be nRF52 with streaming
+// #define NRF24_LINK_MANAGER // Adaptive data rate and channel selection. Adds a S1 bit, so both nodes must be nRF52 with the link manager
+#endif
+#define NRF24_LINK_CHANNELS 8 // Maximum number of channels the link manager moves between
+#define NRF24_STREAM_WINDOW 16										 // Number of stream packets sent before they are acknowledged, up to 32
+#define NRF24_STREAM_PAYLOAD_SIZE (NRF24_MAX_PAYLOAD_SIZE - 2) // Data bytes of a stream packet, after the sequence number and the window base
 typedef struct
 {
 #if defined(NRF24_ESB)
+#if defined(NRF24_DPL)
+	uint8_t length; // LENGTH field: payload length in bytes
+	uint8_t PID;	// S1 field: 2 bit PID in bits 2..1, ACK request flag in bit 0
+#else
 	uint8_t PID;
 	uint8_t No_ack;
+#endif
 
 #endif
-	uint8_t payload[32];
+	uint8_t payload[NRF24_MAX_PAYLOAD_SIZE];
 } nrf24_packet_t;
 
 typedef enum
@@ -17,14 +47,19 @@ typedef enum
 	NRF24_TX_SUCCESS,
 	NRF24_TX_FAILED,
 	NRF24_DATA_READY,
-	NRF24_ACK_SENT,
-	NRF24_INVALID_OPERATION
+	NRF24_ACK_SENT, // Receiver: the queued ACK payload of a pipe has been sent, the next one can be written
+	NRF24_INVALID_OPERATION,
+	NRF24_ACK_PAYLOAD_RECEIVED, // Transmitter: the ACK carried a payload, given in data and length
+	NRF24_STREAM_ACK,			// Transmitter: length stream packets have been acknowledged, their window slots are free again
+	NRF24_LINK_CHANGED			// Both nodes: the link manager has changed the channel or the data rate, see nrf24_link_get_status()
 } nrf24_evt_type_t;
 
 typedef struct
 {
 	nrf24_evt_type_t event_type;
 	uint8_t *data;
+	uint8_t length; // Length of data in bytes
+	uint8_t pipe;	// Pipe the packet was received on (NRF24_DATA_READY, NRF24_ACK_SENT)
 } nrf24_event_t;
 
 typedef enum
@@ -33,26 +68,154 @@ typedef enum
 	NRF24_MODE_RX
 } nrf24_mode_t;
 
+typedef enum
+{
+	NRF24_2MBPS,
+	NRF24_1MBPS,
+	NRF24_125KBPS // BLE Coded PHY of the nRF52840, with 4 byte addresses
+} nrf24_data_rate_t; // Data rates of the link manager, from the highest throughput to the longest range
+
+typedef struct
+{
+	uint8_t channels[NRF24_LINK_CHANNELS]; // RF channels (2400 + n MHz). channels[0] is used at start and after a link loss
+	uint8_t channel_count;
+	bool coded_phy;			  // Both nodes are nRF52840, so the link may step down to the BLE Coded PHY
+	uint8_t per_high;		  // Packet error rate in percent of the TX attempts above which the link is degraded
+	uint8_t per_low;		  // Packet error rate in percent up to which the data rate is stepped up
+	uint8_t window;			  // Number of packets sent per evaluation of the packet error rate
+	uint16_t idle_timeout_ms; // Time without traffic after which both nodes return to channels[0] at 1 Mbps, 0 for 1000 ms
+} nrf24_link_config_t;
+
+typedef struct
+{
+	uint8_t channel;
+	nrf24_data_rate_t data_rate;
+	uint8_t per; // Packet error rate of the last evaluation window in percent
+} nrf24_link_status_t;
+
+/* RX statistics of a pipe.
+ */
+typedef struct
+{
+	uint32_t rx_packets;	// Packets received with a valid CRC, including duplicates
+	uint32_t rx_duplicates; // Retransmitted packets dropped because their ACK had been lost
+	uint32_t rx_crc_errors; // Packets dropped because of a CRC error
+	int8_t rx_rssi;			// RSSI of the last packet received in dBm
+} nrf24_stats_t;
+
+/* TX statistics of the link to one TX address. nrf24_set_tx_address() selects the statistics the
+ * following transmissions count in, so every next hop of a multi-hop network has its own counters.
+ * If NRF24_STATS_TX_LINKS addresses are in use, the least recently selected one is reused for a new address.
+ */
+typedef struct
+{
+	uint8_t address[5];		 // TX address, as given to nrf24_set_tx_address()
+	uint32_t tx_attempts;	 // Transmissions, including retransmissions
+	uint32_t tx_retransmits; // Retransmissions after a missing ACK
+	uint32_t tx_delivered;	 // Packets acknowledged by the receiver
+	uint32_t tx_failures;	 // Packets dropped after the retries of their policy
+	uint32_t tx_airtime_us;	 // Time on air of all transmissions, estimated from the packet lengths and the data rate
+	int8_t ack_rssi;		 // RSSI of the last ACK in dBm
+} nrf24_tx_stats_t;
+
+/* Retransmit policy of a packet. Time-critical messages use few, quick retries; bulk data can afford more
+ * and slower ones. The random backoff keeps nodes which collided from retransmitting in lock-step.
+ */
 typedef struct
 {
-	nrf24_packet_t tx_fifo_buffer[NRF24_TX_FIFO_MAX_SIZE];
-	uint8_t write_index;
-	uint8_t read_index;
-	uint8_t count;
+	uint16_t retransmit_delay_us; // Delay from a transmission to its retransmission, 0 for the default of the data rate
+	uint8_t max_retries;		  // Retransmissions before the packet is dropped with NRF24_TX_FAILED
+	uint16_t backoff_us;		  // Random delay of up to backoff_us added to every retransmission, 0 to disable
+} nrf24_tx_policy_t;
+
+/* Single producer/single consumer ring of packets to be sent.
+ * The indices run freely and are reduced modulo NRF24_TX_FIFO_SIZE on access, so the number of
+ * packets is write_index - read_index. Only the thread writes write_index and only the interrupts
+ * of the driver write read_index, so no critical section is needed.
+ */
+typedef struct
+{
+	nrf24_packet_t tx_fifo_buffer[NRF24_TX_FIFO_SIZE];
+	nrf24_tx_policy_t tx_policy[NRF24_TX_FIFO_SIZE]; // Retransmit policy of each packet
+	volatile uint16_t write_index; // Next slot to be reserved
+	volatile uint16_t read_index;  // Packet being sent, released when its transmission has completed
 } nrf24_tx_fifo_t;
 
 typedef void (*nrf24_evt_handler_t)(nrf24_event_t *nrf24_evt);
 
 void nrf24_set_tx_address(const uint8_t *tx_address);
 
+// Function to set the address of a receive pipe (0 to NRF24_PIPES - 1) and enable it.
+// Pipes 1 to 7 share the last four address bytes and differ in the first byte only. Pipe 0 shares its address with the TX address.
 void nrf24_set_rx_address(const uint8_t *rx_address, uint8_t pipe);
 
 void nrf24_send(uint8_t *message, uint8_t length);
 
+// Function to send a message with its own retransmit policy instead of the default one
+void nrf24_send_with_policy(uint8_t *message, uint8_t length, const nrf24_tx_policy_t *policy);
+
+// Function to set the default retransmit policy of the packets queued afterwards, e.g. along with the TX address of a destination
+void nrf24_set_tx_policy(const nrf24_tx_policy_t *policy);
+
+#if defined(NRF24_STREAM)
+// Function to queue length bytes (up to NRF24_STREAM_PAYLOAD_SIZE) as the next stream packet. Returns false if the window is full.
+// Stream data is delivered in order by the receiver with NRF24_DATA_READY events.
+bool nrf24_stream_write(const uint8_t *data, uint8_t length);
+
+// Function to receive the stream sent to the pipe. NRF24_PIPES stops the reception of the stream.
+// Other packets sent to the pipe are received as usual, stream packets are told apart by their S1 flag.
+void nrf24_stream_listen(uint8_t pipe);
+#endif
+
+// Function to get the next free TX FIFO slot to build a packet in place. Returns NULL if the FIFO is full.
+nrf24_packet_t *nrf24_tx_reserve();
+
+// Function to queue the packet built in the slot returned by nrf24_tx_reserve(), with length bytes of payload
+void nrf24_tx_commit(uint8_t length);
+
+// Function to queue the reserved packet with its own retransmit policy
+void nrf24_tx_commit_with_policy(uint8_t length, const nrf24_tx_policy_t *policy);
+
 void nrf24_set_evt_handler(nrf24_evt_handler_t evt_handler);
 
+// Function to switch between TX and RX. A packet being sent is completed first, the reception starts after it.
 void nrf24_set_mode(nrf24_mode_t mode);
 
+#if defined(NRF24_DPL)
+// Function to queue a payload sent with the ACK of the next new packet received on the pipe.
+// Returns false if the previous payload of the pipe has not been sent yet.
+bool nrf24_write_ack_payload(uint8_t pipe, const uint8_t *data, uint8_t length);
+#endif
+
 void nrf24_init();
 
+#if defined(NRF24_STATS)
+// Function to read the RX statistics of a pipe
+void nrf24_get_stats(uint8_t pipe, nrf24_stats_t *stats);
+
+// Function to clear the RX statistics of a pipe
+void nrf24_reset_stats(uint8_t pipe);
+
+// Function to read the TX statistics of the link to tx_address. Returns false if none are kept for the address.
+bool nrf24_get_tx_stats(const uint8_t *tx_address, nrf24_tx_stats_t *stats);
+
+// Function to clear the TX statistics of all links
+void nrf24_reset_tx_stats();
+
+// Function to print the statistics of all pipes and TX links with traffic over debug_log
+void nrf24_print_stats();
+#endif
+
+#if defined(NRF24_LINK_MANAGER)
+/* Function to start the link manager, after nrf24_init() and with the same channels on both nodes.
+ * The transmitter evaluates the packet error rate of every window of packets. Above per_high it moves
+ * to the next channel, or steps the data rate down if moving did not help; after clean windows it steps
+ * the data rate up again. Each change is announced with a link control packet and made once it is acknowledged.
+ */
+void nrf24_link_manager_init(const nrf24_link_config_t *config);
+
+// Function to get the current channel, data rate and packet error rate of the link
+void nrf24_link_get_status(nrf24_link_status_t *status);
+#endif
+
 #endif
@@ -119,7 +119,7 @@ void ble_advertise()
 	__enable_irq();
 }
 
-void adv_timer_handler()
+void adv_timer_handler(void *context)
 {
 	ble_advertise();
 }
@@ -143,10 +143,10 @@ void ble_begin(ble_config_t *config_data, scan_event_handler_t evt_handler)
 	radio_set_payload_endian(RADIO_LITTLE_ENDIAN);
 	radio_enable_interrupts();
 	softTimer_create(&adv_timer, adv_timer_handler,
-					 SOFT_TIMER_MODE_REPEATED);
+					 SOFT_TIMER_MODE_REPEATED, NULL);
 }
 
-void scan_timer_handler()
+void scan_timer_handler(void *context)
 {
 
 	radio_start_rx();
@@ -171,6 +171,6 @@ void ble_stop_advertising()
 void ble_start_scanning()
 {
 	softTimer_create(&scan_timer, scan_timer_handler,
-					 SOFT_TIMER_MODE_REPEATED);
+					 SOFT_TIMER_MODE_REPEATED, NULL);
 	softTimer_start(&scan_timer, SCAN_INTERVAL);
 }
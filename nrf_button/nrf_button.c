@@ -15,7 +15,7 @@ SOFT_TIMER_DEF(button_debounce_timer);
 
 button_evt_handler_t evt_handler_queue[8] = {NULL};
 
-void button_detection_evt_handler()
+void button_detection_evt_handler(void *context)
 {
   for (uint8_t i = NRF_BUTTON_0; i <= NRF_BUTTON_7; i++)
   {
@@ -29,7 +29,7 @@ void button_detection_evt_handler()
 
 void nrf_button_init()
 {
-  softTimer_create(&button_debounce_timer, button_detection_evt_handler, SOFT_TIMER_MODE_SINGLE_SHOT);
+  softTimer_create(&button_debounce_timer, button_detection_evt_handler, SOFT_TIMER_MODE_SINGLE_SHOT, NULL);
   NVIC_EnableIRQ(GPIOTE_IRQn);
   NVIC_SetPriority(GPIOTE_IRQn, GPIOTE_CONFIG_IRQ_PRIORITY);
 }
@@ -12,6 +12,7 @@
 #include "nrf_delay.h"
 #include "stdbool.h"
 #include "nrf_gpio.h"
+#include "sleep_manager.h"
 
 bool tx_started = false;
 
@@ -110,6 +111,11 @@ bool i2c_tx(i2c_instance_t *p_instance, uint8_t i2c_address, uint8_t *tx_data,
   p_instance->i2c_reg->ADDRESS = i2c_address;
   p_instance->i2c_reg->TXD.PTR = (uint32_t)tx_data;
   p_instance->i2c_reg->TXD.MAXCNT = tx_len;
+
+  // longer transfers complete in the LASTTX interrupt; keep the HFXO running until then
+  if (tx_len > 2)
+    sleep_manager_veto(SLEEP_VETO_TWI);
+
   p_instance->i2c_reg->TASKS_STARTTX = 1UL;
 
   if (tx_len <= 2)
@@ -134,6 +140,9 @@ bool i2c_tx(i2c_instance_t *p_instance, uint8_t i2c_address, uint8_t *tx_data,
 // isr handler
 void SPI0_TWI0_IRQHandler()
 {
+#if NRF_TWIM_ENABLED
+  sleep_manager_release(SLEEP_VETO_TWI);
+#endif
 
   p_instance_core->i2c_evt_hanlder();
 }
@@ -155,7 +155,7 @@ void language_select()
   }
 }
 
-void led_blink_evt_handler()
+void led_blink_evt_handler(void *context)
 {
   if (!led_blink_flag)
     led_blink_flag = true;
@@ -485,7 +485,7 @@ void oled_menu_init()
   nrf_button_register(NRF_BUTTON_3, ROT_ENC_BUTTON,
                       rot_enc_button_evt_handler);
 
-  softTimer_create(&led_timer, led_blink_evt_handler, SOFT_TIMER_MODE_REPEATED);
+  softTimer_create(&led_timer, led_blink_evt_handler, SOFT_TIMER_MODE_REPEATED, NULL);
 
   pwm_led_init();
 
@@ -13,18 +13,30 @@
 #include <string.h>
 #include "boards.h"
 #include "radio_driver.h"
+#include "sleep_manager.h"
 
 #define RADIO_IRQ_PRIORITY 4
+#define END_INT_MASK (1UL << 3)
+#define DISABLED_INT_MASK (1UL << 4)
 
 radio_event_handler_t radio_event_handler;
+radio_event_handler_t radio_disabled_handler;
 
 void radio_set_evt_handler(radio_event_handler_t evt_handler)
 {
     radio_event_handler = evt_handler;
 }
 
+void radio_set_disabled_evt_handler(radio_event_handler_t evt_handler)
+{
+    radio_disabled_handler = evt_handler;
+}
+
 void radio_enable_mode(radio_mode_t mode)
 {
+    // the radio needs the HFXO until it is disabled again
+    sleep_manager_veto(SLEEP_VETO_RADIO);
+
     switch (mode)
     {
     case MODE_TX:
@@ -52,6 +64,8 @@ inline void radio_disable()
         ;
 
     NRF_RADIO->EVENTS_DISABLED = 0;
+
+    sleep_manager_release(SLEEP_VETO_RADIO);
 }
 void radio_set_mode(radio_mode_t mode)
 {
@@ -76,6 +90,7 @@ void radio_tx()
 {
     if (radio_get_state() == DISABLED)
     {
+        sleep_manager_veto(SLEEP_VETO_RADIO);
         NRF_RADIO->TASKS_TXEN = 1U;
 
         while (NRF_RADIO->EVENTS_READY == 0U)
@@ -96,6 +111,8 @@ void radio_tx()
         ;
 
     NRF_RADIO->EVENTS_DISABLED = 0U;
+
+    sleep_manager_release(SLEEP_VETO_RADIO);
 }
 
 uint8_t radio_get_crc_status()
@@ -137,36 +154,42 @@ void radio_set_tx_power(uint32_t tx_power)
 void radio_set_data_rate(radio_data_rate_t data_rate)
 {
     NRF_RADIO->MODE = (uint32_t)data_rate;
+
+    // the Coded PHY sends a long range preamble, the coding indicator (CILEN) and the TERM field
+    NRF_RADIO->PCNF0 &= ~((0x3UL << 22) | (0x3UL << 24) | (0x3UL << 29));
+    if (data_rate == RADIO_LR125KBPS)
+        NRF_RADIO->PCNF0 |= (2UL << 22) | (3UL << 24) | (3UL << 29);
 }
 
+// The packet format setters clear their field first, so that the format can be changed at runtime.
 void radio_set_len_field_size(uint8_t bits)
 {
-    NRF_RADIO->PCNF0 |= (uint32_t)bits << 0;
+    NRF_RADIO->PCNF0 = (NRF_RADIO->PCNF0 & ~(0xFUL << 0)) | (uint32_t)bits << 0;
 }
 
 void radio_set_s0_field_size(uint8_t bytes)
 {
-    NRF_RADIO->PCNF0 |= (uint32_t)bytes << 8;
+    NRF_RADIO->PCNF0 = (NRF_RADIO->PCNF0 & ~(0x1UL << 8)) | (uint32_t)bytes << 8;
 }
 
 void radio_set_s1_field_size(uint8_t bits)
 {
-    NRF_RADIO->PCNF0 |= (uint32_t)bits << 16;
+    NRF_RADIO->PCNF0 = (NRF_RADIO->PCNF0 & ~(0xFUL << 16)) | (uint32_t)bits << 16;
 }
 
 void radio_set_static_payload_size(uint32_t static_pl_size)
 {
-    NRF_RADIO->PCNF1 |= (uint32_t)static_pl_size << 8; // static  payload length
+    NRF_RADIO->PCNF1 = (NRF_RADIO->PCNF1 & ~(0xFFUL << 8)) | (uint32_t)static_pl_size << 8; // static  payload length
 }
 
 void radio_set_max_payload_size(uint32_t max_pl_size)
 {
-    NRF_RADIO->PCNF1 |= (uint32_t)max_pl_size << 0; // max payload length
+    NRF_RADIO->PCNF1 = (NRF_RADIO->PCNF1 & ~(0xFFUL << 0)) | (uint32_t)max_pl_size << 0; // max payload length
 }
 
 void radio_set_address_width(uint8_t add_width)
 {
-    NRF_RADIO->PCNF1 |= ((uint32_t)(add_width - 1)) << 16;
+    NRF_RADIO->PCNF1 = (NRF_RADIO->PCNF1 & ~(0x7UL << 16)) | ((uint32_t)(add_width - 1)) << 16;
 }
 
 void radio_set_payload_endian(radio_endian_t endian)
@@ -183,6 +206,12 @@ void radio_enable_whitening(bool en)
         NRF_RADIO->PCNF1 |= ((uint32_t)1U) << 25;
 }
 
+int8_t radio_get_rssi()
+{
+    // RSSISAMPLE holds the magnitude of the negative RSSI
+    return -(int8_t)NRF_RADIO->RSSISAMPLE;
+}
+
 uint8_t radio_get_received_address()
 {
     return NRF_RADIO->RXMATCH;
@@ -198,19 +227,32 @@ void radio_set_rx_logical_address(uint8_t logical_address)
     NRF_RADIO->RXADDRESSES |= 1UL << logical_address;
 }
 
+void radio_set_rx_logical_addresses(uint8_t logical_address_mask)
+{
+    NRF_RADIO->RXADDRESSES = logical_address_mask;
+}
+
+uint32_t radio_get_rx_crc()
+{
+    return NRF_RADIO->RXCRC;
+}
+
+/* Logical address 0 uses BASE0, logical addresses 1 to 7 share BASE1 and differ in their prefix byte only.
+ */
 void radio_set_address(const uint8_t *address, uint8_t logical_address)
 {
 
-    uint32_t prefix_mask = 0x000000FF << (logical_address * 8);
+    uint8_t prefix_shift = (logical_address % 4) * 8;
+    uint32_t prefix_mask = 0x000000FFUL << prefix_shift;
     if (logical_address < 4)
     {
         NRF_RADIO->PREFIX0 &= ~prefix_mask;
-        NRF_RADIO->PREFIX0 |= (uint32_t)(address[0] << (logical_address * 8));
+        NRF_RADIO->PREFIX0 |= (uint32_t)address[0] << prefix_shift;
     }
     else
     {
         NRF_RADIO->PREFIX1 &= ~prefix_mask;
-        NRF_RADIO->PREFIX1 |= (uint32_t)(address[0] << (logical_address * 8));
+        NRF_RADIO->PREFIX1 |= (uint32_t)address[0] << prefix_shift;
     }
 
     if (logical_address == 0)
@@ -221,7 +263,7 @@ void radio_set_address(const uint8_t *address, uint8_t logical_address)
     }
     else if (logical_address > 0 && logical_address <= 7)
     {
-        NRF_RADIO->BASE0 = 0UL;
+        NRF_RADIO->BASE1 = 0UL;
         for (uint8_t i = 0; i < 4; i++)
             NRF_RADIO->BASE1 |= (uint32_t)(address[4 - i] << (8 * i));
     }
@@ -262,9 +304,52 @@ void radio_set_packet_ptr(uint8_t *ptr)
     NRF_RADIO->PACKETPTR = (uint32_t)ptr;
 }
 
+void radio_set_shorts(uint32_t shorts)
+{
+    NRF_RADIO->SHORTS = shorts;
+}
+
+/* Function to switch the interrupt from the END event to the DISABLED event while a sequence of
+ * packets runs through the shortcuts. The busy-waiting mode changes must not be used meanwhile,
+ * the interrupt would clear the DISABLED event they wait for.
+ */
+void radio_enable_disabled_interrupt(bool enable)
+{
+    if (enable)
+    {
+        NRF_RADIO->INTENCLR = END_INT_MASK;
+        NRF_RADIO->INTENSET = DISABLED_INT_MASK;
+    }
+    else
+    {
+        NRF_RADIO->INTENCLR = DISABLED_INT_MASK;
+        NRF_RADIO->EVENTS_END = 0;
+        NRF_RADIO->INTENSET = END_INT_MASK;
+    }
+}
+
+bool radio_end_event()
+{
+    if (NRF_RADIO->EVENTS_END == 0)
+        return false;
+
+    NRF_RADIO->EVENTS_END = 0;
+    return true;
+}
+
+void radio_trigger_disable()
+{
+    NRF_RADIO->TASKS_DISABLE = 1U;
+}
+
+uint32_t radio_disable_task_address()
+{
+    return (uint32_t)(uintptr_t)&NRF_RADIO->TASKS_DISABLE;
+}
+
 void radio_enable_interrupts()
 {
-    NRF_RADIO->INTENSET = 1UL << 3;
+    NRF_RADIO->INTENSET = END_INT_MASK;
 
     NVIC_SetPriority(RADIO_IRQn, RADIO_IRQ_PRIORITY);
     NVIC_EnableIRQ(RADIO_IRQn);
@@ -272,6 +357,16 @@ void radio_enable_interrupts()
 
 void RADIO_IRQHandler(void)
 {
+    if (NRF_RADIO->EVENTS_DISABLED && (NRF_RADIO->INTENSET & DISABLED_INT_MASK))
+    {
+        NRF_RADIO->EVENTS_DISABLED = 0;
+
+        radio_disabled_handler();
+
+        // the sequence has ended unless a shortcut or the handler has enabled the radio again
+        if (radio_get_state() == DISABLED)
+            sleep_manager_release(SLEEP_VETO_RADIO);
+    }
 
     if (NRF_RADIO->EVENTS_END && radio_get_state() == RX_IDLE)
     {
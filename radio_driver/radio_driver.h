@@ -7,9 +7,16 @@ typedef enum{
 
 typedef  void (*radio_event_handler_t)(void);
 
+// RADIO shortcuts used to sequence packets without CPU involvement
+#define RADIO_SHORT_READY_START (1UL << 0)
+#define RADIO_SHORT_END_DISABLE (1UL << 1)
+#define RADIO_SHORT_DISABLED_TXEN (1UL << 2)
+#define RADIO_SHORT_DISABLED_RXEN (1UL << 3)
+#define RADIO_SHORT_ADDRESS_RSSISTART (1UL << 4) // Sample the RSSI of every received packet
+
 typedef enum{
 
-	RADIO_1MBPS, RADIO_2MBPS
+	RADIO_1MBPS, RADIO_2MBPS, RADIO_LR125KBPS = 5 // BLE Coded PHY with S=8 coding, nRF52840 only
 }radio_data_rate_t;
 
 typedef enum{
@@ -70,6 +77,20 @@ void radio_set_packet_ptr(uint8_t* ptr);
 
 void radio_set_evt_handler(radio_event_handler_t evt_handler);
 
+void radio_set_disabled_evt_handler(radio_event_handler_t evt_handler);
+
+void radio_set_shorts(uint32_t shorts);
+
+void radio_enable_disabled_interrupt(bool enable);
+
+bool radio_end_event();
+
+void radio_trigger_disable();
+
+uint32_t radio_disable_task_address();
+
+void radio_enable_mode(radio_mode_t mode);
+
 uint8_t radio_get_received_address();
 
 radio_state_t radio_get_state();
@@ -78,4 +99,11 @@ void radio_set_tx_logical_address(uint8_t logical_address);
 
 void radio_set_rx_logical_address(uint8_t logical_address);
 
+void radio_set_rx_logical_addresses(uint8_t logical_address_mask);
+
+uint32_t radio_get_rx_crc();
+
+// Function to get the RSSI sampled with RADIO_SHORT_ADDRESS_RSSISTART in dBm
+int8_t radio_get_rssi();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,117 @@
+/**
+ * @file sleep_manager.c
+ * @author Surya Poudel
+ * @brief Tickless idle for NRF52840 built on the softTimer queue
+ *
+ * The CPU sleeps with WFE in System ON mode. RTC2 keeps running from the LFCLK, so the next
+ * softTimer expiry always wakes the CPU. The HFXO is stopped only when the next expiry is far
+ * away and started again on wake-up, without waiting for it to settle. Drivers that need a stable
+ * crystal veto deep sleep while they are busy, and the veto waits for the restarted HFXO to run.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include "nrf.h"
+#include "softTimer.h"
+#include "sleep_manager.h"
+
+#define HFCLK_XTAL_RUNNING (CLOCK_HFCLKSTAT_SRC_Msk | CLOCK_HFCLKSTAT_STATE_Msk) // HFCLKSTAT when the HFXO is the running HFCLK source
+
+static volatile uint32_t sleep_vetoes = 0; // Sources vetoing deep sleep
+static bool deep_sleep_enabled = false;
+static volatile bool hfxo_starting = false; // HFXO restarted after deep sleep, not known to be running yet
+
+/* Function to initialize the sleep manager.
+ * SEVONPEND lets an interrupt that becomes pending while interrupts are disabled wake WFE, so that
+ * sleep_manager_idle() can check for work and go to sleep without an interrupt getting lost in between.
+ */
+void sleep_manager_init(bool deep_sleep)
+{
+	deep_sleep_enabled = deep_sleep;
+
+	SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk; // System ON sleep, RTC2 and RAM retention stay on
+	SCB->SCR |= SCB_SCR_SEVONPEND_Msk;
+}
+
+/* Function to set the deep sleep veto of the source.
+ * If the HFXO is still starting after a deep sleep, wait until it runs (~0.4 ms), so that the
+ * caller, e.g. a radio ramp-up, does not run on the HFINT.
+ */
+void sleep_manager_veto(sleep_veto_t source)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	sleep_vetoes |= source;
+	__set_PRIMASK(primask);
+
+	if (hfxo_starting)
+	{
+		while ((NRF_CLOCK->HFCLKSTAT & HFCLK_XTAL_RUNNING) != HFCLK_XTAL_RUNNING)
+			;
+		hfxo_starting = false;
+	}
+}
+
+/* Function to clear the deep sleep veto of the source.
+ */
+void sleep_manager_release(sleep_veto_t source)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	sleep_vetoes &= ~source;
+	__set_PRIMASK(primask);
+}
+
+/* Function to check if the HFXO may be stopped for this sleep.
+ */
+static bool deep_sleep_allowed()
+{
+	uint64_t deadline;
+
+	if (!deep_sleep_enabled || sleep_vetoes)
+		return false;
+
+	// no running timer, the next wake-up comes from a peripheral
+	if (!softTimer_next_deadline(&deadline))
+		return true;
+
+	uint64_t now = softTimer_now();
+
+	return deadline > now && deadline - now >= SLEEP_DEEP_MIN_TICKS;
+}
+
+/* Function to sleep until the next interrupt.
+ * Interrupts are disabled while the pending work is checked, so an interrupt queuing work after the
+ * check sets the event register and ends WFE at once. The interrupt is handled after interrupts are enabled again.
+ * A WFE ended by an old event returns early, the main loop just calls sleep_manager_idle() again.
+ */
+void sleep_manager_idle()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (softTimer_work_pending())
+	{
+		__set_PRIMASK(primask);
+		return;
+	}
+
+	bool hfxo_stopped = false;
+
+	if ((NRF_CLOCK->HFCLKSTAT & HFCLK_XTAL_RUNNING) == HFCLK_XTAL_RUNNING && deep_sleep_allowed())
+	{
+		NRF_CLOCK->TASKS_HFCLKSTOP = 1;
+		hfxo_stopped = true;
+	}
+
+	__DSB();
+	__WFE();
+
+	if (hfxo_stopped)
+	{
+		NRF_CLOCK->EVENTS_HFCLKSTARTED = 0;
+		NRF_CLOCK->TASKS_HFCLKSTART = 1;
+		hfxo_starting = true;
+	}
+
+	__set_PRIMASK(primask);
+}
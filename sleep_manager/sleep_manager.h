@@ -0,0 +1,40 @@
+#ifndef __SLEEP_MANAGER_H
+#define __SLEEP_MANAGER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "softTimer.h"
+
+/* Idle manager putting the CPU into System ON sleep between events.
+ * sleep_manager_idle() is called from the main loop when it has nothing left to do. It returns
+ * immediately if deferred softTimer handlers are queued, otherwise it sleeps until the next interrupt.
+ * With deep sleep enabled the HFXO is also stopped if the next softTimer deadline is at least
+ * SLEEP_DEEP_MIN_TICKS away and no driver vetoes it.
+ */
+
+#ifndef SLEEP_DEEP_MIN_TICKS
+#define SLEEP_DEEP_MIN_TICKS MS_TO_TICKS(5) // Minimum sleep time for which the HFXO is stopped, it takes ~0.4 ms to start again
+#endif
+
+// Sources of deep sleep vetoes. Drivers set their bit while they depend on the HFXO.
+typedef enum
+{
+	SLEEP_VETO_SPI = 1 << 0,
+	SLEEP_VETO_TWI = 1 << 1,
+	SLEEP_VETO_RADIO = 1 << 2,
+	SLEEP_VETO_APP = 1 << 3
+} sleep_veto_t;
+
+// Function to initialize the sleep manager. deep_sleep enables stopping the HFXO during long sleeps.
+void sleep_manager_init(bool deep_sleep);
+
+// Function to prevent deep sleep until sleep_manager_release() is called with the same source. Returns once the HFXO runs if deep sleep had stopped it.
+void sleep_manager_veto(sleep_veto_t source);
+
+// Function to withdraw the deep sleep veto of the source
+void sleep_manager_release(sleep_veto_t source);
+
+// Function to sleep until the next interrupt, called from the main loop when it is idle
+void sleep_manager_idle();
+
+#endif //__SLEEP_MANAGER_H
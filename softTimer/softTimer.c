@@ -10,191 +10,678 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include "math.h"
-#include "boards.h"
-#include "nrf_delay.h"
 #include "softTimer.h"
+#include "softTimer_rtc.h"
+#if defined(SOFT_TIMER_STATS)
+#if defined(SOFT_TIMER_HOST_SIM)
+#include <time.h>
+#endif
 #include "debug_log.h"
+#endif
 
 #define RTC_IRQ_PRIORITY 6 // IRQ Priority level
-#define CC1_INT_MASK 1 << 17
-#define RTC_PRESCALER 0
-#define NRF_RTC_MAX_CNT 0x00FFFFFF // Maximum count of RTC
-#define RTC_CC_OFFSET_MIN 3		   // Minimum offset required for CC register from current COUNTER value to generate an event.
+#define NRF_RTC_MAX_CNT 0x00FFFFFF			   // Maximum count of RTC
+#define RTC_COUNTER_BITS 24					   // Width of the RTC COUNTER register
+#define RTC_CC_OFFSET_MIN 3					   // Minimum offset required for CC register from current COUNTER value to generate an event.
+#define RTC_MAX_CC_DELTA (NRF_RTC_MAX_CNT / 2) // Maximum distance of a COMPARE event from the current COUNTER value
+#define DEFERRED_SWI_IRQ_PRIORITY 7			   // Lowest priority, deferred handlers never preempt other interrupts
 
-uint32_t next_trig_ticks; // RTC ticks to be loaded into CC register
-bool rtc_started = false; // rtc_started flag
+// Critical section used while the running timers or the overflow count are accessed.
+// Timers are started and stopped from thread context and from interrupts of other priorities.
+#define SOFT_TIMER_CRITICAL_ENTER() uint32_t primask = rtc_critical_enter()
+#define SOFT_TIMER_CRITICAL_EXIT() rtc_critical_exit(primask)
 
-softTimer_node_t *head_node = NULL; // head node in the list
+bool rtc_started = false;			   // rtc_started flag
+static volatile uint32_t rtc_overflows; // Number of COUNTER overflows, upper bits of the 64 bit tick count
 
-/*Function to add the timer instance in the queue of running timers.
- *This forms a linked list of running timers
+// FIFO queue of expired timers whose handlers are called from softTimer_process()
+static softTimer_node_t *deferred_head = NULL;
+static softTimer_node_t *deferred_tail = NULL;
+
+#if defined(SOFT_TIMER_STATS)
+static softTimer_node_t *created_head = NULL; // List of created timers, for softTimer_print_stats()
+
+/*Function to read the cycle counter used to measure the handler execution time.
+ * The host simulation has no cycle counter and uses nanoseconds instead.
  */
-static void timer_list_node_add(softTimer_node_t *instance)
+static uint32_t stats_cycles()
 {
-	// if there are no timers in the list, assign the head node with first timer instance.
-	if (head_node == NULL)
+#if defined(SOFT_TIMER_HOST_SIM)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#else
+	return DWT->CYCCNT;
+#endif
+}
+
+/*Function to record the expiry of the timer instance, now - deadline ticks after its deadline.
+ */
+static void stats_expiry(softTimer_node_t *instance, uint64_t now)
+{
+	uint32_t lateness = now > instance->deadline ? (uint32_t)(now - instance->deadline) : 0;
+
+	instance->stats.expiries++;
+	instance->stats.lateness_total += lateness;
+	if (lateness > instance->stats.lateness_max)
+		instance->stats.lateness_max = lateness;
+}
+#endif
+
+/*Function to queue the handler of an expired deferred timer. Must be called within the critical section.
+ */
+static void deferred_queue_add(softTimer_node_t *instance)
+{
+	// the handler is already queued
+	if (instance->is_pending)
 	{
-		head_node = instance;
-		head_node->next_node = NULL;
+#if defined(SOFT_TIMER_STATS)
+		instance->stats.missed_periods++;
+#endif
 		return;
 	}
 
-	softTimer_node_t *temp_node = head_node->next_node;
-	head_node = instance;
-	head_node->next_node = temp_node;
+	instance->is_pending = true;
+	instance->next_pending = NULL;
+
+	if (deferred_tail == NULL)
+		deferred_head = instance;
+	else
+		deferred_tail->next_pending = instance;
+	deferred_tail = instance;
+
+#if defined(SOFT_TIMER_DEFERRED_SWI)
+	NRF_EGU3->TASKS_TRIGGER[0] = 1;
+#endif
 }
 
-/*Function to delete the timer from the beginning of the list.
- * This removes the head node and reassigns head node with the next timer in the list.
+/*Function to remove the queued handler of a stopped timer. Must be called within the critical section.
  */
-static inline void delete_first_node(softTimer_node_t **head_node)
+static void deferred_queue_remove(softTimer_node_t *instance)
 {
-	softTimer_node_t *temp_node = (*head_node)->next_node;
-	(*head_node)->next_node = NULL;
-	*head_node = temp_node;
+	softTimer_node_t *prev_node = NULL;
+	softTimer_node_t *current_node = deferred_head;
+
+	while (current_node != NULL && current_node != instance)
+	{
+		prev_node = current_node;
+		current_node = current_node->next_pending;
+	}
+
+	if (current_node == NULL)
+		return;
+
+	if (prev_node == NULL)
+		deferred_head = instance->next_pending;
+	else
+		prev_node->next_pending = instance->next_pending;
+
+	if (deferred_tail == instance)
+		deferred_tail = prev_node;
+
+	instance->is_pending = false;
+	instance->next_pending = NULL;
 }
 
-/*Function to delete the timer from the list
+/*Function to load the CC register with the COMPARE event for a deadline on the 64 bit tick count.
  */
-static inline void timer_list_node_delete(softTimer_node_t *instance)
+static void load_cc_register(uint64_t deadline)
 {
-	softTimer_node_t *current_node = head_node;
+	uint64_t now = softTimer_now();
+	uint64_t ticks = deadline > now ? deadline - now : 0;
+
+	// Deadlines further away than RTC_MAX_CC_DELTA get an intermediate COMPARE event.
+	if (ticks > RTC_MAX_CC_DELTA)
+		ticks = RTC_MAX_CC_DELTA;
+
+	// The nRF52 Series User Specification states that if the COUNTER value is N
+	// writing N or N + 1 to a CC register may not trigger a COMPARE event.
+	// Deadlines that are closer than RTC_CC_OFFSET_MIN are therefore delayed to RTC_CC_OFFSET_MIN.
+	if (ticks < RTC_CC_OFFSET_MIN)
+		ticks = RTC_CC_OFFSET_MIN;
+
+	rtc_set_compare((now + ticks) & NRF_RTC_MAX_CNT); // load CC register with the ticks corresponding to next timer to be triggered.
+}
+
+/*Function to move the deadline of a repeated timer to its next period.
+ * The deadline advances by whole intervals from the previous deadline, so periodic timers do not drift
+ * with the interrupt latency and timers with related intervals keep expiring together.
+ * Periods which have passed completely before the timer could be handled are skipped.
+ * Returns the number of skipped periods.
+ */
+static uint32_t timer_next_period(softTimer_node_t *instance, uint64_t now)
+{
+	uint32_t skipped = 0;
+
+	instance->deadline += instance->interval;
 
-	// if the timer correponds to the head node in the list, remove the timer node and reassign head node.
-	if (instance == head_node)
+	if (instance->deadline < now)
 	{
-		delete_first_node(&head_node);
+		skipped = (now - instance->deadline - 1) / instance->interval + 1;
+		instance->deadline += (uint64_t)skipped * instance->interval;
 	}
 
+	return skipped;
+}
+
+/*Function to call the timeout handler of the timer instance, measuring its execution time if SOFT_TIMER_STATS is defined.
+ */
+static void timer_call_handler(softTimer_node_t *instance)
+{
+#if defined(SOFT_TIMER_STATS)
+	uint32_t cycles = stats_cycles();
+
+	instance->timeout_handler(instance->context);
+
+	cycles = stats_cycles() - cycles;
+	instance->stats.handler_calls++;
+	instance->stats.handler_cycles_total += cycles;
+	if (cycles > instance->stats.handler_cycles_max)
+		instance->stats.handler_cycles_max = cycles;
+#else
+	instance->timeout_handler(instance->context);
+#endif
+}
+
+#if defined(SOFT_TIMER_WHEEL)
+
+#define WHEEL_LEVELS 5													   // Number of levels of the timing wheel
+#define WHEEL_SLOT_BITS 6												   // Each level has 64 slots
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS)								   // Number of slots per level
+#define WHEEL_SLOT_MASK (WHEEL_SLOTS - 1)								   // Mask to get the slot index from a tick count
+#define WHEEL_LEVEL_SHIFT(level) ((level) * WHEEL_SLOT_BITS)			   // Each slot of a level spans WHEEL_SLOTS slots of the level below
+#define WHEEL_MAX_DELTA ((1UL << (WHEEL_LEVELS * WHEEL_SLOT_BITS)) - 1) // Maximum distance of a timer from the wheel cursor
+
+/* Running timers are kept in a hierarchical timing wheel.
+ * Level 0 has one slot per tick. A slot of level L spans 64^L ticks, and timers in it are
+ * cascaded into the lower levels when the wheel reaches the start of that slot. Occupied slots
+ * are tracked in a bitmap per level, so the next event is found without scanning empty slots and
+ * the COUNTER is only compared against the next event.
+ * Timers of an expired level 0 slot are moved to the list of expired timers as a batch.
+ */
+static softTimer_node_t *wheel[WHEEL_LEVELS][WHEEL_SLOTS]; // Doubly linked list of timers in each slot
+static uint64_t wheel_bitmap[WHEEL_LEVELS];				   // Occupied slots of each level
+static softTimer_node_t *expired_head = NULL;			   // Timers expired but whose handler has not run yet
+static uint64_t wheel_next;								   // Next tick to be processed by the wheel; all earlier ticks are processed
+
+/*Function to link the timer instance at the head of a slot or the list of expired timers.
+ */
+static void bucket_add(softTimer_node_t **bucket, softTimer_node_t *instance)
+{
+	instance->bucket = bucket;
+	instance->prev_node = NULL;
+	instance->next_node = *bucket;
+
+	if (*bucket != NULL)
+		(*bucket)->prev_node = instance;
+
+	*bucket = instance;
+}
+
+/*Function to unlink the timer instance from its slot or from the list of expired timers.
+ */
+static void bucket_remove(softTimer_node_t *instance)
+{
+	if (instance->prev_node != NULL)
+		instance->prev_node->next_node = instance->next_node;
 	else
+		*instance->bucket = instance->next_node;
+
+	if (instance->next_node != NULL)
+		instance->next_node->prev_node = instance->prev_node;
+
+	// clear the occupied bit of an emptied wheel slot
+	if (*instance->bucket == NULL && instance->bucket != &expired_head)
 	{
-		while (current_node->next_node != instance)
-			current_node = current_node->next_node;
+		uint32_t index = instance->bucket - &wheel[0][0];
+		wheel_bitmap[index / WHEEL_SLOTS] &= ~(1ULL << (index % WHEEL_SLOTS));
+	}
+
+	instance->bucket = NULL;
+	instance->prev_node = NULL;
+	instance->next_node = NULL;
+}
 
-		current_node->next_node = instance->next_node;
-		instance->next_node = NULL;
+/*Function to add the timer instance to the wheel slot of its deadline.
+ * The deadline is rounded up to a multiple of the largest power of two not exceeding the slack, so timers whose
+ * windows overlap are put in the same slot and expire in the same COMPARE event.
+ * The level is chosen by the distance of the expiry from the wheel cursor (wheel_next).
+ * Timers further away than WHEEL_MAX_DELTA are placed at the end of the top level and re-placed when cascaded.
+ */
+static void timer_wheel_node_add(softTimer_node_t *instance)
+{
+	uint64_t slot_ticks = instance->deadline;
+	uint8_t level = 0;
+
+	if (instance->slack)
+	{
+		uint64_t granularity = 1ULL << (31 - __builtin_clz(instance->slack));
+		slot_ticks = (slot_ticks + granularity - 1) & ~(granularity - 1);
 	}
+
+	// a deadline of the tick being processed expires at the next tick
+	if (slot_ticks < wheel_next)
+		slot_ticks = wheel_next;
+
+	uint64_t delta = slot_ticks - wheel_next;
+
+	if (delta > WHEEL_MAX_DELTA)
+	{
+		delta = WHEEL_MAX_DELTA;
+		slot_ticks = wheel_next + WHEEL_MAX_DELTA;
+	}
+
+	if (delta >= WHEEL_SLOTS)
+		level = (31 - __builtin_clz((uint32_t)delta)) / WHEEL_SLOT_BITS;
+
+	uint8_t slot = (slot_ticks >> WHEEL_LEVEL_SHIFT(level)) & WHEEL_SLOT_MASK;
+
+	bucket_add(&wheel[level][slot], instance);
+	wheel_bitmap[level] |= 1ULL << slot;
 }
 
-/*Function to update trig flag of timer nodes to be triggered next.
+/*Function to find the next tick at which the wheel has to do work, either expire a level 0 slot or cascade a slot of a higher level.
+ * Returns false if no timers are in the wheel. Otherwise the distance of the event from wheel_next is returned in offset.
  */
-static inline void update_trig_flag()
+static bool wheel_next_event(uint64_t *offset)
 {
-	softTimer_node_t *current_node = head_node;
+	bool found = false;
+
+	for (uint8_t level = 0; level < WHEEL_LEVELS; level++)
+	{
+		if (wheel_bitmap[level] == 0)
+			continue;
+
+		uint8_t shift = WHEEL_LEVEL_SHIFT(level);
+
+		// first slot boundary of this level at or after wheel_next
+		uint64_t index = wheel_next >> shift;
+		if (wheel_next & ((1ULL << shift) - 1))
+			index++;
+
+		// rotate the bitmap so that bit 0 is the slot at that boundary
+		uint8_t cursor = index & WHEEL_SLOT_MASK;
+		uint64_t pending = (wheel_bitmap[level] >> cursor) | (wheel_bitmap[level] << ((WHEEL_SLOTS - cursor) & WHEEL_SLOT_MASK));
+		uint64_t event_offset = ((index + __builtin_ctzll(pending)) << shift) - wheel_next;
+
+		if (!found || event_offset < *offset)
+			*offset = event_offset;
+		found = true;
+	}
+
+	return found;
+}
+
+/*Function to move the wheel cursor over ticks without any work, up to the tick count now.
+ */
+static void wheel_skip_idle(uint64_t now)
+{
+	uint64_t offset;
+	uint64_t lag = now + 1 - wheel_next; // ticks not processed yet
+
+	if (!wheel_next_event(&offset) || offset > lag)
+		offset = lag;
+
+	wheel_next += offset;
+}
+
+/*Function to process the tick wheel_next, where the wheel has work to do.
+ * Slots of the higher levels starting at this tick are cascaded into the lower levels, top level first,
+ * and the timers of the level 0 slot are moved to the list of expired timers.
+ */
+static void wheel_process_tick()
+{
+	for (uint8_t level = WHEEL_LEVELS - 1; level > 0; level--)
+	{
+		uint8_t shift = WHEEL_LEVEL_SHIFT(level);
+
+		if (wheel_next & ((1ULL << shift) - 1))
+			continue;
+
+		uint8_t slot = (wheel_next >> shift) & WHEEL_SLOT_MASK;
+		softTimer_node_t *current_node = wheel[level][slot];
+
+		wheel[level][slot] = NULL;
+		wheel_bitmap[level] &= ~(1ULL << slot);
+
+		while (current_node != NULL)
+		{
+			softTimer_node_t *next_node = current_node->next_node;
+			timer_wheel_node_add(current_node);
+			current_node = next_node;
+		}
+	}
+
+	uint8_t slot = wheel_next & WHEEL_SLOT_MASK;
+	softTimer_node_t *current_node = wheel[0][slot];
+
+	wheel[0][slot] = NULL;
+	wheel_bitmap[0] &= ~(1ULL << slot);
 
 	while (current_node != NULL)
 	{
-		if (current_node->trig_ticks == next_trig_ticks)
-			current_node->trig = true;
+		softTimer_node_t *next_node = current_node->next_node;
+		bucket_add(&expired_head, current_node);
+		current_node = next_node;
+	}
 
-		// Check if the diffrence between next RTC ticks of timer to be loaded into CC register and the current COUNTER value is less than RTC_CC_OFFSET_MINIMUM
-		// When this happens the COMPARE event may not be triggered by the RTC.
-		// The nRF52 Series User Specification states that if the COUNTER value is N
-		// writing N or N + 1 to a CC register may not trigger a COMPARE event.
-		// In this case, the timer can be made to trigger by setting its trig flag manually
+	wheel_next++;
+}
 
-		else if ((current_node->trig_ticks - next_trig_ticks) < RTC_CC_OFFSET_MIN)
-			current_node->trig = true;
+/*Function to update the value of CC register with the next event of the wheel
+ */
+static void update_cc_register()
+{
+	uint64_t offset;
+
+	// return if no timers are running
+	if (!wheel_next_event(&offset))
+		return;
+
+	load_cc_register(wheel_next + offset);
+}
+
+/*
+ * Function to handle the timer event generated in RTC2_IRQHandler
+ * The wheel is processed up to the current time, and handlers of expired timers are called one at a time
+ * from the list of expired timers, so handlers are free to start or stop any timer.
+ */
+void handle_timers()
+{
+	while (1)
+	{
+		SOFT_TIMER_CRITICAL_ENTER();
+
+		uint64_t now = softTimer_now();
+
+		if (expired_head == NULL)
+		{
+			// process the wheel up to the current time
+			wheel_skip_idle(now);
+			while (wheel_next != now + 1 && expired_head == NULL)
+			{
+				wheel_process_tick();
+				wheel_skip_idle(now);
+			}
+		}
+
+		// check if a timer has expired
+		if (expired_head == NULL)
+		{
+			// update the CC register with the next event
+			update_cc_register();
+			SOFT_TIMER_CRITICAL_EXIT();
+			break;
+		}
+
+		softTimer_node_t *current_node = expired_head;
+		bucket_remove(current_node);
+
+#if defined(SOFT_TIMER_STATS)
+		stats_expiry(current_node, now);
+#endif
+
+		// Check if the timer mode is SINGLE_SHOT. If true, stop the correponding timer
+		// Otherwise, schedule the next period.
+		if (current_node->mode == SOFT_TIMER_MODE_SINGLE_SHOT)
+			current_node->is_running = false;
 		else
-			current_node->trig = false;
+		{
+#if defined(SOFT_TIMER_STATS)
+			current_node->stats.missed_periods += timer_next_period(current_node, now);
+#else
+			timer_next_period(current_node, now);
+#endif
+			timer_wheel_node_add(current_node);
+		}
+
+		// deferred handlers are only queued here
+		if (current_node->dispatch == SOFT_TIMER_DISPATCH_DEFERRED)
+		{
+			deferred_queue_add(current_node);
+			SOFT_TIMER_CRITICAL_EXIT();
+			continue;
+		}
+
+		SOFT_TIMER_CRITICAL_EXIT();
+
+		timer_call_handler(current_node);
+	}
+}
+
+#else
+
+/* Running timers are kept in a list sorted by their absolute deadline on the 64 bit tick count.
+ * The next deadline is therefore always the head node and expired timers are popped from the head.
+ * Deadlines do not change when the COUNTER wraps around.
+ */
+softTimer_node_t *head_node = NULL; // head node in the list (earliest deadline)
+
+/*Function to add the timer instance in the list of running timers.
+ * The timer is inserted behind all timers expiring at or before its deadline.
+ */
+static void timer_list_node_add(softTimer_node_t *instance)
+{
+	softTimer_node_t *prev_node = NULL;
+	softTimer_node_t *current_node = head_node;
 
+	while (current_node != NULL && current_node->deadline <= instance->deadline)
+	{
+		prev_node = current_node;
 		current_node = current_node->next_node;
 	}
+
+	instance->next_node = current_node;
+
+	if (prev_node == NULL)
+		head_node = instance;
+	else
+		prev_node->next_node = instance;
 }
-/*Function to create a timer by initizing the timer instance with corresponding timer parameters.
- * This does not start the timer. softTimer_start() function should be called to start
- * the corresponding timer.
+
+/*Function to delete the timer from the list
  */
-void softTimer_create(softTimer_node_t *instance, timeout_handler_t timeout_handler, soft_timer_mode_t mode)
+static void timer_list_node_delete(softTimer_node_t *instance)
 {
-	instance->mode = mode;
-	instance->is_running = false;
-	instance->timeout_handler = timeout_handler;
+	softTimer_node_t *prev_node = NULL;
+	softTimer_node_t *current_node = head_node;
+
+	while (current_node != NULL && current_node != instance)
+	{
+		prev_node = current_node;
+		current_node = current_node->next_node;
+	}
+
+	if (current_node == NULL)
+		return;
+
+	if (prev_node == NULL)
+		head_node = instance->next_node;
+	else
+		prev_node->next_node = instance->next_node;
+
 	instance->next_node = NULL;
 }
 
-/* Function to get the next RTC ticks of the timer node to be triggered.
- * Corresponds to the next RTC ticks to be loaded into CC register.
+/*Function to update the value of CC register with the next COMPARE event.
+ * The event is delayed within the slack of the head node as long as the slack of every timer
+ * expiring until then allows it, so that all of them are handled in one interrupt.
+ * Only the timers expiring within that window are visited.
  */
-void get_next_trig_ticks()
+static void update_cc_register()
 {
 	// return if no timers are running
 	if (head_node == NULL)
 		return;
-	next_trig_ticks = head_node->trig_ticks;
-	softTimer_node_t *current_node = head_node->next_node;
 
-	// Determine the minimum number of RTC ticks from the list of timers that corresponds to the next trigger RTC ticks.
-	while (current_node != NULL)
-	{
-		if (current_node->trig_ticks < next_trig_ticks)
-			next_trig_ticks = current_node->trig_ticks;
+	uint64_t event_ticks = head_node->deadline + head_node->slack;
 
-		current_node = current_node->next_node;
+	for (softTimer_node_t *current_node = head_node->next_node;
+		 current_node != NULL && current_node->deadline <= event_ticks;
+		 current_node = current_node->next_node)
+	{
+		if (current_node->deadline + current_node->slack < event_ticks)
+			event_ticks = current_node->deadline + current_node->slack;
 	}
+
+	load_cc_register(event_ticks);
 }
 
-/*Function to update the value of CC register
+/*
+ * Function to handle the timer event generated in RTC2_IRQHandler
+ * Expired timers are popped from the head of the list one at a time. Repeated timers are
+ * re-inserted before their handler runs, so handlers are free to start or stop any timer.
  */
-static inline void update_cc_register()
+void handle_timers()
 {
-	// Check if the next RTC trigger ticks to be loaded into CC register are larger than the maximum COUNTER value of RTC.
-	// if true, subtract maximum COUNTER value from the next rtc trigger ticks.
-	if (next_trig_ticks > NRF_RTC_MAX_CNT)
+	while (1)
 	{
-		next_trig_ticks = next_trig_ticks - NRF_RTC_MAX_CNT - 1;
+		SOFT_TIMER_CRITICAL_ENTER();
+
+		uint64_t now = softTimer_now();
+
+		// check if the head node has expired
+		if (head_node == NULL || head_node->deadline > now)
+		{
+			// update the CC register with the next deadline
+			update_cc_register();
+			SOFT_TIMER_CRITICAL_EXIT();
+			break;
+		}
+
 		softTimer_node_t *current_node = head_node;
-		while (current_node != NULL)
+		head_node = current_node->next_node;
+		current_node->next_node = NULL;
+
+#if defined(SOFT_TIMER_STATS)
+		stats_expiry(current_node, now);
+#endif
+
+		// Check if the timer mode is SINGLE_SHOT. If true, stop the correponding timer
+		// Otherwise, schedule the next period.
+		if (current_node->mode == SOFT_TIMER_MODE_SINGLE_SHOT)
+			current_node->is_running = false;
+		else
 		{
-			current_node->trig_ticks = current_node->trig_ticks - NRF_RTC_MAX_CNT - 1;
-			current_node = current_node->next_node;
+#if defined(SOFT_TIMER_STATS)
+			current_node->stats.missed_periods += timer_next_period(current_node, now);
+#else
+			timer_next_period(current_node, now);
+#endif
+			timer_list_node_add(current_node);
 		}
+
+		// deferred handlers are only queued here
+		if (current_node->dispatch == SOFT_TIMER_DISPATCH_DEFERRED)
+		{
+			deferred_queue_add(current_node);
+			SOFT_TIMER_CRITICAL_EXIT();
+			continue;
+		}
+
+		SOFT_TIMER_CRITICAL_EXIT();
+
+		timer_call_handler(current_node);
 	}
+}
+
+#endif
+
+/*Function to create a timer by initizing the timer instance with corresponding timer parameters.
+ * This does not start the timer. softTimer_start() function should be called to start
+ * the corresponding timer.
+ */
+void softTimer_create(softTimer_node_t *instance, timeout_handler_t timeout_handler, soft_timer_mode_t mode, void *context)
+{
+	instance->mode = mode;
+	instance->is_running = false;
+	instance->timeout_handler = timeout_handler;
+	instance->context = context;
+	instance->dispatch = SOFT_TIMER_DISPATCH_ISR;
+	instance->is_pending = false;
+	instance->slack = 0;
+	instance->next_node = NULL;
+	instance->next_pending = NULL;
+
+#if defined(SOFT_TIMER_STATS)
+	// timers may be created again with another handler; register each instance only once and keep its statistics
+	softTimer_node_t *current_node = created_head;
+	while (current_node != NULL && current_node != instance)
+		current_node = current_node->next_created;
 
-	NRF_RTC2->CC[1] = next_trig_ticks; // load CC register with the ticks corresponding to next timer to be triggered.
+	if (current_node == NULL)
+	{
+		instance->name = NULL;
+		instance->stats = (softTimer_stats_t){0};
+		instance->next_created = created_head;
+		created_head = instance;
+	}
+#endif
+}
+
+/* Function to set the number of ticks the expiry of the timer instance may be delayed.
+ * Expiries of timers whose windows overlap are merged into one RTC COMPARE event, which reduces
+ * the number of wake-ups. The new slack applies from the next start or period of the timer.
+ */
+void softTimer_set_slack(softTimer_node_t *instance, uint32_t slack_ticks)
+{
+	instance->slack = slack_ticks;
+}
+
+/* Function to select where the handler of the timer instance is called.
+ * SOFT_TIMER_DISPATCH_DEFERRED keeps slow handlers out of RTC2_IRQHandler, so that the
+ * interrupt latency of the timers does not depend on the handlers.
+ */
+void softTimer_set_dispatch(softTimer_node_t *instance, soft_timer_dispatch_t dispatch)
+{
+	instance->dispatch = dispatch;
 }
 
 /* Function to start the timer instances
- * This stores the timer instances in a running timer queue and loads CC register with next minimum RTC ticks.
+ * This inserts the timer instance with the deadline interval ticks from now
+ * and reloads the CC register if the timer is the next one to expire.
  */
 void softTimer_start(softTimer_node_t *instance, uint32_t interval)
 {
+	SOFT_TIMER_CRITICAL_ENTER();
+
 	// check if the timer is already in running state. If true, abort.
 	if (instance->is_running)
 	{
+		SOFT_TIMER_CRITICAL_EXIT();
 		return;
 	}
-	instance->interval = interval;
 
-	// if RTC is not started, trigger ticks will be equal to the interval ticks
-	// Otherwise, next trigger ticks is determined by adding interval ticks to the current RTC counter value
+	// Check if RTC peripheral is started. If not, start the peripheral and set rtc_stated flag.
 	if (!rtc_started)
-		instance->trig_ticks = instance->interval;
-	else
-		instance->trig_ticks = NRF_RTC2->COUNTER + instance->interval;
+	{
+		rtc_start();
+		rtc_started = true;
+	}
+
+	// A repeated timer with an interval of 0 would expire again and again in the same interrupt.
+	instance->interval = interval ? interval : 1;
 
 	// Set is_running flag for the started timer instance.
 	instance->is_running = true;
 
-	// add the timer in the queue of running timers
-	timer_list_node_add(instance);
-
-	// get  RTC ticks corresponding to next timers to be triggered.
-	get_next_trig_ticks();
+	uint64_t now = softTimer_now();
+	instance->deadline = now + instance->interval;
 
-	// update cc register;
+#if defined(SOFT_TIMER_WHEEL)
+	// add the timer to the wheel
+	wheel_skip_idle(now);
+	timer_wheel_node_add(instance);
 	update_cc_register();
+#else
+	// add the timer in the list of running timers
+	timer_list_node_add(instance);
 
-	// update trig flag of the timers to be triggered next
-	update_trig_flag();
+	// update cc register, the timer may be the next one to expire or shorten the window of the next event
+	update_cc_register();
+#endif
 
-	// Check if RTC peripheral is started. If not, start the peripheral and set rtc_stated flag.
-	if (!rtc_started)
-	{
-		NRF_RTC2->TASKS_START = 1;
-		rtc_started = true;
-	}
+	SOFT_TIMER_CRITICAL_EXIT();
 }
 
 /* Function to stop the corresponding timer instance.
@@ -202,80 +689,272 @@ void softTimer_start(softTimer_node_t *instance, uint32_t interval)
  */
 void softTimer_stop(softTimer_node_t *instance)
 {
+	SOFT_TIMER_CRITICAL_ENTER();
+
 	if (instance->is_running)
 	{
 		instance->is_running = false;
+#if defined(SOFT_TIMER_WHEEL)
+		bucket_remove(instance);
+#else
 		timer_list_node_delete(instance);
+#endif
 	}
+
+	// drop the handler call of an expiry which happened before the timer was stopped
+	if (instance->is_pending)
+		deferred_queue_remove(instance);
+
+	SOFT_TIMER_CRITICAL_EXIT();
 }
 
-/*Function to trigger the timers
+/* Function to call the handlers of expired deferred timers in the order they expired.
+ * Handlers are called outside the critical section, so they are free to start or stop any timer.
  */
-static inline void trigger_timers()
+void softTimer_process()
 {
-
-	softTimer_node_t *current_node = head_node;
-	while (current_node != NULL)
+	while (1)
 	{
-		softTimer_node_t *temp = current_node->next_node;
+		SOFT_TIMER_CRITICAL_ENTER();
 
-		// Check if the trig flag has been set.If set, call the timeout_handler() and update the ticks for next event.
-		if (current_node->trig)
-		{
-			current_node->trig = false;
-			current_node->timeout_handler();
+		softTimer_node_t *current_node = deferred_head;
 
-			// check if the timer stopped itself in timeout_handler. It true, skip the node and jump to next node.
-			if (!current_node->is_running)
-			{
-				current_node = temp;
-				continue;
-			}
-			// Check if the timer mode is SINGLE_SHOT. If true, stop the correponding timer
-			if (current_node->mode == SOFT_TIMER_MODE_SINGLE_SHOT)
-			{
-				softTimer_stop(current_node);
-				current_node = temp;
-				continue;
-			}
-			current_node->trig_ticks = NRF_RTC2->COUNTER + current_node->interval;
+		if (current_node == NULL)
+		{
+			SOFT_TIMER_CRITICAL_EXIT();
+			break;
 		}
-		current_node = current_node->next_node;
+
+		deferred_head = current_node->next_pending;
+		if (deferred_head == NULL)
+			deferred_tail = NULL;
+
+		current_node->is_pending = false;
+		current_node->next_pending = NULL;
+
+		SOFT_TIMER_CRITICAL_EXIT();
+
+		timer_call_handler(current_node);
 	}
 }
 
-/*
- * Function to handle the timer event generated in RTC1_IRQHandler
+/* Function to check if deferred handlers are queued.
  */
-void handle_timers()
+bool softTimer_work_pending()
 {
-	// check for trig flag and trigger corresponding timers
-	trigger_timers();
+	return deferred_head != NULL;
+}
 
-	// get  RTC ticks corresponding to next timers to be triggered.
-	get_next_trig_ticks();
+/* Function to get the tick count of the next expiry.
+ * In timing wheel mode this is the next tick the wheel has work to do, which may be a cascade
+ * of a higher level slot before the actual expiry. It is never later than the next expiry.
+ */
+bool softTimer_next_deadline(uint64_t *deadline)
+{
+	bool found;
 
-	// update the CC register
-	update_cc_register();
+	SOFT_TIMER_CRITICAL_ENTER();
+
+#if defined(SOFT_TIMER_WHEEL)
+	uint64_t offset;
+
+	if (expired_head != NULL)
+	{
+		*deadline = wheel_next;
+		found = true;
+	}
+	else if ((found = wheel_next_event(&offset)))
+		*deadline = wheel_next + offset;
+#else
+	if ((found = head_node != NULL))
+		*deadline = head_node->deadline;
+#endif
+
+	SOFT_TIMER_CRITICAL_EXIT();
 
-	// set the trig flag of all the timers to be triggerd next.
-	update_trig_flag();
+	return found;
 }
 
 /* Function to initialize the timer module.
- * This initializes the RTC peripheral
+ * This initializes and starts the RTC peripheral so that the tick count is available
+ * to other modules (e.g. for driver timeouts) even before the first timer is started.
  */
 void softTimer_init()
 {
-	NRF_RTC2->INTENSET = CC1_INT_MASK;
-	NRF_RTC2->PRESCALER = RTC_PRESCALER;
-	NVIC_SetPriority(RTC2_IRQn, RTC_IRQ_PRIORITY);
-	NVIC_EnableIRQ(RTC2_IRQn); // Enable RTC2 Interrupt
+	rtc_init(RTC_IRQ_PRIORITY);
+
+#if defined(SOFT_TIMER_STATS) && !defined(SOFT_TIMER_HOST_SIM)
+	// enable the DWT cycle counter to measure the handler execution time
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+#if defined(SOFT_TIMER_DEFERRED_SWI)
+	NRF_EGU3->INTENSET = 1UL;
+	NVIC_SetPriority(SWI3_EGU3_IRQn, DEFERRED_SWI_IRQ_PRIORITY);
+	NVIC_EnableIRQ(SWI3_EGU3_IRQn);
+#endif
+
+	if (!rtc_started)
+	{
+		rtc_start();
+		rtc_started = true;
+	}
 }
 
-/*Interrrupt handler for RTC1 peripheral */
+#if defined(SOFT_TIMER_HOST_SIM)
+/* Function to drop the timer state built on the simulated RTC, called by RTC_sim_reset().
+ * Running timers are stopped, queued deferred handlers are dropped and the tick count restarts
+ * from the new COUNTER value. Created timers keep their handler, mode and settings.
+ */
+void softTimer_sim_reset()
+{
+#if defined(SOFT_TIMER_WHEEL)
+	for (uint32_t index = 0; index <= WHEEL_LEVELS * WHEEL_SLOTS; index++)
+	{
+		softTimer_node_t **bucket = index < WHEEL_LEVELS * WHEEL_SLOTS ? &wheel[0][0] + index : &expired_head;
+
+		while (*bucket != NULL)
+		{
+			(*bucket)->is_running = false;
+			bucket_remove(*bucket);
+		}
+	}
+	wheel_next = 0;
+#else
+	while (head_node != NULL)
+	{
+		softTimer_node_t *current_node = head_node;
+		head_node = current_node->next_node;
+		current_node->is_running = false;
+		current_node->next_node = NULL;
+	}
+#endif
+
+	while (deferred_head != NULL)
+		deferred_queue_remove(deferred_head);
+
+	rtc_overflows = 0;
+	rtc_started = false;
+}
+#endif
+
+/* Function to get the 64 bit tick count.
+ * The COUNTER value is extended with the number of overflows. An overflow whose interrupt has not been
+ * handled yet (called with interrupts disabled or from a higher priority) is taken from the pending event.
+ */
+uint64_t softTimer_now()
+{
+	SOFT_TIMER_CRITICAL_ENTER();
+
+	uint32_t overflows = rtc_overflows;
+	uint32_t counter = rtc_get_counter();
+
+	if (rtc_overflow_event())
+	{
+		// read the COUNTER again, it may have been read just before the overflow
+		overflows++;
+		counter = rtc_get_counter();
+	}
+
+	SOFT_TIMER_CRITICAL_EXIT();
+
+	return ((uint64_t)overflows << RTC_COUNTER_BITS) | counter;
+}
+
+/* Function to get the current tick count, the lower 32 bits of softTimer_now().
+ */
+uint32_t softTimer_get_ticks()
+{
+	return (uint32_t)softTimer_now();
+}
+
+/* Function to get the number of ticks elapsed since start_ticks.
+ * The unsigned subtraction handles a single wrap-around of the 32 bit tick count.
+ */
+uint32_t softTimer_ticks_elapsed(uint32_t start_ticks)
+{
+	return softTimer_get_ticks() - start_ticks;
+}
+
+#if defined(SOFT_TIMER_STATS)
+/* Function to set the name of the timer instance. The string is not copied.
+ */
+void softTimer_set_name(softTimer_node_t *instance, const char *name)
+{
+	instance->name = name;
+}
+
+/* Function to read the statistics of the timer instance.
+ * The statistics are copied within the critical section, so the expiry and handler counts are consistent.
+ */
+void softTimer_get_stats(softTimer_node_t *instance, softTimer_stats_t *stats)
+{
+	SOFT_TIMER_CRITICAL_ENTER();
+	*stats = instance->stats;
+	SOFT_TIMER_CRITICAL_EXIT();
+}
+
+/* Function to clear the statistics of the timer instance.
+ */
+void softTimer_reset_stats(softTimer_node_t *instance)
+{
+	SOFT_TIMER_CRITICAL_ENTER();
+	instance->stats = (softTimer_stats_t){0};
+	SOFT_TIMER_CRITICAL_EXIT();
+}
+
+/* Function to print the statistics of all created timers.
+ * Lateness is reported in microseconds (1 RTC tick = 30.5 us), handler time in CPU cycles.
+ */
+void softTimer_print_stats()
+{
+	for (softTimer_node_t *current_node = created_head; current_node != NULL; current_node = current_node->next_created)
+	{
+		softTimer_stats_t stats;
+		softTimer_get_stats(current_node, &stats);
+
+		debug_log_print("%s: expiries=%lu missed=%lu\r\n", current_node->name ? current_node->name : "timer",
+						(unsigned long)stats.expiries, (unsigned long)stats.missed_periods);
+
+		if (stats.expiries)
+			debug_log_print("\tlate: avg=%luus max=%luus\r\n",
+							(unsigned long)(stats.lateness_total * 1000000 / 32768 / stats.expiries),
+							(unsigned long)((uint64_t)stats.lateness_max * 1000000 / 32768));
+
+		if (stats.handler_calls)
+			debug_log_print("\thandler: calls=%lu avg=%lu max=%lu cycles\r\n", (unsigned long)stats.handler_calls,
+							(unsigned long)(stats.handler_cycles_total / stats.handler_calls), (unsigned long)stats.handler_cycles_max);
+	}
+}
+#endif
+
+/*Interrrupt handler for RTC2 peripheral */
 void RTC2_IRQHandler(void)
 {
-	NRF_RTC2->EVENTS_COMPARE[1] = 0;
-	handle_timers(); // Execute timers
+	if (rtc_overflow_event())
+	{
+		SOFT_TIMER_CRITICAL_ENTER();
+		rtc_clear_overflow_event();
+		rtc_overflows++;
+		SOFT_TIMER_CRITICAL_EXIT();
+	}
+
+	if (rtc_compare_event())
+	{
+		rtc_clear_compare_event();
+		handle_timers(); // Execute timers
+	}
+}
+
+#if defined(SOFT_TIMER_DEFERRED_SWI)
+/*Interrupt handler for SWI3/EGU3, triggered when a deferred handler is queued */
+void SWI3_EGU3_IRQHandler(void)
+{
+	if (NRF_EGU3->EVENTS_TRIGGERED[0])
+	{
+		NRF_EGU3->EVENTS_TRIGGERED[0] = 0;
+		softTimer_process();
+	}
 }
+#endif
@@ -1,6 +1,16 @@
 #ifndef __SOFT_TIMER_H
 #define __SOFT_TIMER_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Running timers are kept in a deadline-sorted list by default.
+ * Define SOFT_TIMER_WHEEL to use a hierarchical timing wheel instead, which gives O(1) start/stop
+ * for builds with hundreds of running timers.
+ * Define SOFT_TIMER_HOST_SIM to run the module on a PC against the simulated RTC of RTC_sim.c.
+ * Define SOFT_TIMER_STATS to record the expiry lateness and the handler execution time of every timer.
+ */
+
 /* Macro to define  timer instance */
 #define SOFT_TIMER_DEF(name) \
 	static softTimer_node_t name;
@@ -12,21 +22,53 @@ typedef enum
 	SOFT_TIMER_MODE_REPEATED
 } soft_timer_mode_t;
 
-typedef void (*timeout_handler_t)(void); // Timeout handler function
+typedef enum
+{
+	SOFT_TIMER_DISPATCH_ISR,	 // Handler is called from RTC2_IRQHandler
+	SOFT_TIMER_DISPATCH_DEFERRED // Handler is queued by RTC2_IRQHandler and called from softTimer_process()
+} soft_timer_dispatch_t;
+
+#if defined(SOFT_TIMER_STATS)
+typedef struct
+{
+	uint32_t expiries;			   // Number of expiries of the timer
+	uint32_t missed_periods;	   // Periods of a repeated timer that were skipped or merged into one handler call
+	uint64_t lateness_total;	   // Sum of the delays of the expiries from their deadlines, in ticks
+	uint32_t lateness_max;		   // Largest delay of an expiry from its deadline, in ticks
+	uint32_t handler_calls;		   // Number of calls of the timeout handler
+	uint64_t handler_cycles_total; // Sum of the execution times of the handler, in CPU cycles (nanoseconds on the host)
+	uint32_t handler_cycles_max;   // Longest execution time of the handler
+} softTimer_stats_t;
+#endif
+
+typedef void (*timeout_handler_t)(void *context); // Timeout handler function, called with the context given to softTimer_create()
 
 typedef struct timer_node
 {
-	bool trig;
 	bool is_running;
 	soft_timer_mode_t mode;
 	timeout_handler_t timeout_handler;
+	void *context; // Passed to the timeout handler, so that one handler can serve many timers
+	soft_timer_dispatch_t dispatch;
+	bool is_pending; // Deferred handler is queued but has not been called yet
 	uint32_t interval;
-	uint32_t trig_ticks;
+	uint32_t slack;	   // Ticks the expiry may be delayed to share a COMPARE event with other timers
+	uint64_t deadline; // Absolute expiry time on the 64 bit tick count
+#if defined(SOFT_TIMER_WHEEL)
+	struct timer_node *prev_node;
+	struct timer_node **bucket; // Wheel slot (or list of expired timers) the timer is linked in
+#endif
 	struct timer_node *next_node;
+	struct timer_node *next_pending; // Next timer in the queue of deferred handlers
+#if defined(SOFT_TIMER_STATS)
+	const char *name; // Name shown by softTimer_print_stats()
+	softTimer_stats_t stats;
+	struct timer_node *next_created; // Next timer in the list of created timers
+#endif
 } softTimer_node_t; // Timer instance structure
 
-// Function to create a timer by initializing the timer instance
-void softTimer_create(softTimer_node_t *instance, timeout_handler_t timeout_handler, soft_timer_mode_t mode);
+// Function to create a timer by initializing the timer instance. context is passed to timeout_handler on every expiry.
+void softTimer_create(softTimer_node_t *instance, timeout_handler_t timeout_handler, soft_timer_mode_t mode, void *context);
 
 // Function to start the timer instance by adding it to the list of running timers.
 void softTimer_start(softTimer_node_t *instance, uint32_t interval);
@@ -34,7 +76,52 @@ void softTimer_start(softTimer_node_t *instance, uint32_t interval);
 // Function to stop the timer instance
 void softTimer_stop(softTimer_node_t *instance);
 
-// Function to initialize the timer module
+// Function to allow the expiry of the timer instance to be delayed by up to slack_ticks, so that it can be merged with other timers
+void softTimer_set_slack(softTimer_node_t *instance, uint32_t slack_ticks);
+
+// Function to select where the handler of the timer instance is called. Timers are created with SOFT_TIMER_DISPATCH_ISR.
+void softTimer_set_dispatch(softTimer_node_t *instance, soft_timer_dispatch_t dispatch);
+
+// Function to call the handlers of expired SOFT_TIMER_DISPATCH_DEFERRED timers. Call it from the main loop.
+// If SOFT_TIMER_DEFERRED_SWI is defined, it is also called from the SWI3/EGU3 interrupt at the lowest priority.
+// A repeated timer which expires again before its handler has been called is queued only once.
+void softTimer_process();
+
+// Function to check if handlers of expired SOFT_TIMER_DISPATCH_DEFERRED timers are waiting for softTimer_process()
+bool softTimer_work_pending();
+
+// Function to get the tick count of the next expiry of the running timers. Returns false if no timer is running.
+bool softTimer_next_deadline(uint64_t *deadline);
+
+// Function to initialize the timer module. Calling it again keeps the running timers and the tick count.
 void softTimer_init();
 
+// Function to get the 64 bit monotonic tick count (32768 ticks per second), extended from the RTC COUNTER by its overflow events
+uint64_t softTimer_now();
+
+// Function to get the lower 32 bits of the tick count. The count wraps around every 36 hours.
+uint32_t softTimer_get_ticks();
+
+// Function to get the number of ticks elapsed since a tick count returned by softTimer_get_ticks()
+uint32_t softTimer_ticks_elapsed(uint32_t start_ticks);
+
+#if defined(SOFT_TIMER_HOST_SIM)
+// Function to stop all timers and restart the tick count from the simulated RTC. Called by RTC_sim_reset().
+void softTimer_sim_reset();
+#endif
+
+#if defined(SOFT_TIMER_STATS)
+// Function to set the name of the timer instance shown by softTimer_print_stats()
+void softTimer_set_name(softTimer_node_t *instance, const char *name);
+
+// Function to read the statistics of the timer instance
+void softTimer_get_stats(softTimer_node_t *instance, softTimer_stats_t *stats);
+
+// Function to clear the statistics of the timer instance
+void softTimer_reset_stats(softTimer_node_t *instance);
+
+// Function to print the statistics of all created timers over debug_log
+void softTimer_print_stats();
+#endif
+
 #endif //__SOFT_TIMER_H
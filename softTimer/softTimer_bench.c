@@ -0,0 +1,149 @@
+/**
+ * @file softTimer_bench.c
+ * @author Surya Poudel
+ * @brief Benchmark of the softTimer start/stop/expiry cost for large numbers of timers
+ *
+ * CPU cycles are measured with the DWT cycle counter. In the host simulation (SOFT_TIMER_HOST_SIM)
+ * host nanoseconds are measured instead and virtual time is advanced while waiting for expiries.
+ * The timers used by the benchmark
+ * get pseudo random intervals between 100 ms and 100 s, so that they are spread over the
+ * running timer container the same way as per-node timeouts of a gateway.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#if defined(SOFT_TIMER_HOST_SIM)
+#include <time.h>
+#include "RTC_sim.h"
+#else
+#include "nrf.h"
+#endif
+#include "softTimer.h"
+#include "softTimer_bench.h"
+#include "debug_log.h"
+
+#define BENCH_MIN_INTERVAL MS_TO_TICKS(100)
+#define BENCH_MAX_INTERVAL MS_TO_TICKS(100000)
+#define BENCH_EXPIRY_DELAY MS_TO_TICKS(100) // Delay of the common deadline used to measure expiry
+
+static softTimer_node_t bench_timers[SOFT_TIMER_BENCH_MAX_TIMERS];
+static volatile uint16_t expired_cnt;
+static volatile uint32_t first_expiry_cycles;
+static volatile uint32_t last_expiry_cycles;
+static uint32_t rand_state;
+
+/*Function to read the clock used for the measurements
+ */
+static uint32_t bench_cycles()
+{
+#if defined(SOFT_TIMER_HOST_SIM)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#else
+	return DWT->CYCCNT;
+#endif
+}
+
+/*Function to get a pseudo random number (xorshift32). A fixed seed makes every run use the same intervals.
+ */
+static uint32_t bench_rand()
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+/*Timeout handler of the benchmark timers. Records the cycle count of the first and the last expiry.
+ */
+static void bench_timeout_handler(void *context)
+{
+	uint32_t cycles = bench_cycles();
+
+	if (expired_cnt == 0)
+		first_expiry_cycles = cycles;
+	last_expiry_cycles = cycles;
+	expired_cnt++;
+}
+
+/* Function to measure the cost of softTimer_start(), softTimer_stop() and timer expiry with timer_cnt running timers.
+ */
+void softTimer_bench_run(uint16_t timer_cnt, softTimer_bench_result_t *result)
+{
+	uint32_t cycles;
+
+	if (timer_cnt > SOFT_TIMER_BENCH_MAX_TIMERS)
+		timer_cnt = SOFT_TIMER_BENCH_MAX_TIMERS;
+	if (timer_cnt < 2)
+		timer_cnt = 2;
+
+#if !defined(SOFT_TIMER_HOST_SIM)
+	// enable the DWT cycle counter
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+	rand_state = 0x2545F491;
+	result->timer_cnt = timer_cnt;
+
+	for (uint16_t i = 0; i < timer_cnt; i++)
+		softTimer_create(&bench_timers[i], bench_timeout_handler, SOFT_TIMER_MODE_SINGLE_SHOT, NULL);
+
+	// start timers with random intervals
+	cycles = bench_cycles();
+	for (uint16_t i = 0; i < timer_cnt; i++)
+		softTimer_start(&bench_timers[i], BENCH_MIN_INTERVAL + bench_rand() % (BENCH_MAX_INTERVAL - BENCH_MIN_INTERVAL));
+	result->start_cycles = (bench_cycles() - cycles) / timer_cnt;
+
+	// stop them in reverse order, which is unrelated to their deadlines
+	cycles = bench_cycles();
+	for (uint16_t i = 0; i < timer_cnt; i++)
+		softTimer_stop(&bench_timers[timer_cnt - 1 - i]);
+	result->stop_cycles = (bench_cycles() - cycles) / timer_cnt;
+
+	// Start all timers with a common deadline, so that they expire in the same interrupt.
+	// Time between the first and the last handler call is the cost of expiring the timers.
+	expired_cnt = 0;
+	uint32_t deadline = softTimer_get_ticks() + BENCH_EXPIRY_DELAY;
+	for (uint16_t i = 0; i < timer_cnt; i++)
+	{
+		uint32_t interval = deadline - softTimer_get_ticks();
+
+		// the deadline has passed while starting a large number of timers
+		if (interval > BENCH_EXPIRY_DELAY)
+			interval = 0;
+
+		softTimer_start(&bench_timers[i], interval);
+	}
+
+	while (expired_cnt < timer_cnt)
+	{
+#if defined(SOFT_TIMER_HOST_SIM)
+		RTC_sim_advance(1);
+#endif
+	}
+
+	result->expiry_cycles = (last_expiry_cycles - first_expiry_cycles) / (timer_cnt - 1);
+}
+
+/* Function to run the benchmark at 10, 100 and 1000 timers and print the results to the debug log.
+ */
+void softTimer_bench_print()
+{
+	static const uint16_t timer_cnts[] = {10, 100, 1000};
+	softTimer_bench_result_t result;
+
+#if defined(SOFT_TIMER_WHEEL)
+	debug_log_print("softTimer benchmark (timing wheel), cycles per timer\r\n");
+#else
+	debug_log_print("softTimer benchmark (sorted list), cycles per timer\r\n");
+#endif
+
+	for (uint8_t i = 0; i < sizeof(timer_cnts) / sizeof(timer_cnts[0]); i++)
+	{
+		softTimer_bench_run(timer_cnts[i], &result);
+		debug_log_print("timers: %d start: %d stop: %d expiry: %d\r\n",
+						result.timer_cnt, result.start_cycles, result.stop_cycles, result.expiry_cycles);
+	}
+}
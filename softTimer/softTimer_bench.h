@@ -0,0 +1,26 @@
+#ifndef __SOFT_TIMER_BENCH_H
+#define __SOFT_TIMER_BENCH_H
+
+#include <stdint.h>
+
+/* Benchmark of the running timer container of softTimer.
+ * Build once with and once without SOFT_TIMER_WHEEL defined to compare the timing wheel against the deadline sorted list.
+ */
+#define SOFT_TIMER_BENCH_MAX_TIMERS 1000 // Maximum number of timers used by the benchmark
+
+typedef struct
+{
+	uint16_t timer_cnt;		// Number of timers running during the measurement
+	uint32_t start_cycles;	// Average CPU cycles per softTimer_start()
+	uint32_t stop_cycles;	// Average CPU cycles per softTimer_stop()
+	uint32_t expiry_cycles; // Average CPU cycles per timer when timer_cnt timers expire in the same interrupt
+	// In the host simulation (SOFT_TIMER_HOST_SIM) the values are host nanoseconds instead of CPU cycles
+} softTimer_bench_result_t;
+
+// Function to measure start, stop and expiry cost with timer_cnt running timers. softTimer_init() must have been called.
+void softTimer_bench_run(uint16_t timer_cnt, softTimer_bench_result_t *result);
+
+// Function to run the benchmark at 10, 100 and 1000 timers and print the results to the debug log
+void softTimer_bench_print();
+
+#endif //__SOFT_TIMER_BENCH_H
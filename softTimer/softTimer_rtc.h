@@ -0,0 +1,65 @@
+#ifndef __SOFT_TIMER_RTC_H
+#define __SOFT_TIMER_RTC_H
+
+/* Access to the RTC used as timebase of softTimer.
+ * On target the functions map to the RTC2 registers. With SOFT_TIMER_HOST_SIM defined they map
+ * to the simulated RTC of RTC_sim.c, so that softTimer can run on a PC in virtual time.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(SOFT_TIMER_HOST_SIM)
+#include "RTC_sim.h"
+
+#if defined(SOFT_TIMER_DEFERRED_SWI)
+#error "SOFT_TIMER_DEFERRED_SWI is not available in the host simulation, call softTimer_process() instead"
+#endif
+
+static inline void rtc_init(uint8_t irq_priority) {}
+static inline void rtc_start() { RTC_sim_start(); }
+static inline uint32_t rtc_get_counter() { return RTC_sim_counter(); }
+static inline void rtc_set_compare(uint32_t value) { RTC_sim_set_cc(value); }
+static inline bool rtc_compare_event() { return RTC_sim_compare_event(); }
+static inline void rtc_clear_compare_event() { RTC_sim_clear_compare_event(); }
+static inline bool rtc_overflow_event() { return RTC_sim_overflow_event(); }
+static inline void rtc_clear_overflow_event() { RTC_sim_clear_overflow_event(); }
+static inline uint32_t rtc_critical_enter() { return RTC_sim_irq_disable(); }
+static inline void rtc_critical_exit(uint32_t state) { RTC_sim_irq_restore(state); }
+
+#else
+#include "nrf.h"
+
+#define OVRFLW_INT_MASK 1 << 1
+#define CC1_INT_MASK 1 << 17
+#define RTC_PRESCALER 0
+
+// Function to enable the COMPARE[1] and OVRFLW interrupts of RTC2
+static inline void rtc_init(uint8_t irq_priority)
+{
+	NRF_RTC2->INTENSET = CC1_INT_MASK | OVRFLW_INT_MASK;
+	NRF_RTC2->PRESCALER = RTC_PRESCALER;
+	NVIC_SetPriority(RTC2_IRQn, irq_priority);
+	NVIC_EnableIRQ(RTC2_IRQn); // Enable RTC2 Interrupt
+}
+
+static inline void rtc_start() { NRF_RTC2->TASKS_START = 1; }
+static inline uint32_t rtc_get_counter() { return NRF_RTC2->COUNTER; }
+static inline void rtc_set_compare(uint32_t value) { NRF_RTC2->CC[1] = value; }
+static inline bool rtc_compare_event() { return NRF_RTC2->EVENTS_COMPARE[1]; }
+static inline void rtc_clear_compare_event() { NRF_RTC2->EVENTS_COMPARE[1] = 0; }
+static inline bool rtc_overflow_event() { return NRF_RTC2->EVENTS_OVRFLW; }
+static inline void rtc_clear_overflow_event() { NRF_RTC2->EVENTS_OVRFLW = 0; }
+
+// Critical section used while the running timers or the overflow count are accessed.
+static inline uint32_t rtc_critical_enter()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	return primask;
+}
+
+static inline void rtc_critical_exit(uint32_t primask) { __set_PRIMASK(primask); }
+
+#endif
+
+#endif //__SOFT_TIMER_RTC_H